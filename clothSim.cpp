@@ -10,16 +10,44 @@
 	'D' - switch to left facing camera
 	'Z' - Toggle wind (on by default)
 	'X' - Toggle sphere movement (on by default)
+	'C' - Toggle continuous self-collision (off by default)
 	spacebar - drop cloth
 	enter - pause simulation
+	left mouse drag - grab and pull the cloth
+
+	BENCHMARKS:
+	--scene <flag|drape|curtains|crumple|obstacles|catenary|sag> [--frames n] [--seed s] [--events] - run a scene headless and
+		report its cost, optionally with the simulation events of every step
+	--microbench [--elements n] - time the vector maths and solver kernels, in cycles per element
+	--evaluate [--frames n] [--seed s] - sweep solver settings and iteration budgets, reporting error against cost
+	--check-gradient [--frames n] - compare the parameter gradient of the fitting solver with central differences
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <ctime>
 #include <chrono>
 #include <vector>
 #include <queue>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <random>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
@@ -49,6 +77,122 @@ const GLfloat PARTICLE_MASS_KG = 50.0f;
 const int CONSTRAINT_ITERATIONS = 50;
 const long MIN_TIME_STEP = 16;
 
+// Sphere speed when not driven by a keyframe track, in units per millisecond
+const GLfloat SPHERE_SPEED = 0.05f / MIN_TIME_STEP;
+
+// BVH settings
+const int BVH_LEAF_SIZE = 4;
+const int BVH_QUALITY_CHECK_INTERVAL = 30;
+const GLfloat BVH_REBUILD_RATIO = 2.0f;
+const GLfloat CLOTH_THICKNESS = 0.01f;
+
+// Fraction of the distance to the cursor closed per constraint iteration while grabbing
+const GLfloat GRAB_STIFFNESS = 0.2f;
+
+// Cloth-cloth collision settings
+const int CLOTH_TILE_CELLS = 8;
+const GLfloat CLOTH_CONTACT_DISTANCE = 2.0f * CLOTH_THICKNESS;
+
+// Fraction of a collider's radius particles are pushed out past its surface
+const GLfloat COLLIDER_SURFACE_OFFSET = 0.03f;
+
+// Distance from a mesh collider's surface within which particles are tested against it
+const GLfloat MESH_CONTACT_DISTANCE = 0.05f;
+
+// Continuous self-collision settings
+const int CCD_ITERATIONS = 3;
+const GLfloat CCD_RESPONSE_FRACTION = 0.9f;
+
+// Solver step length, the original fixed step squares to 0.01
+const GLfloat DEFAULT_TIME_STEP = 0.1f;
+
+// Rate at which the velocity integrator removes deformational (non-rigid) velocity, per unit of solver time
+const GLfloat RELATIVE_DAMPING_RATE = 0.2f;
+
+// Fraction of the previous step's constraint correction added to the predicted positions when warm starting,
+// the full correction is already partly carried by velocity and overshoots
+// Note: This first-order guess stands in for extrapolating the corrections to second order (2 c1 - c2). The
+// prediction is also the projection's only anchor, so either guess changes the result as well as convergence,
+// and in the sag and drape scenes the extrapolation took as many or more iterations to reach a tolerance
+const GLfloat WARM_START_FRACTION = 0.5f;
+
+// Wind occlusion settings, cells per axis and the fraction of wind a cloth tile blocks when facing it
+const int WIND_GRID_CELLS = 32;
+const GLfloat CLOTH_WIND_OPACITY = 0.5f;
+
+// Static equilibrium settings, spring stiffness is relative to a particle's weight per unit of rest length
+const GLfloat SETTLE_STIFFNESS = 100000.0f;
+const int SETTLE_ITERATIONS = 50;
+const int SETTLE_STAGES = 4;
+const int SETTLE_CG_ITERATIONS = 200;
+const GLfloat SETTLE_TOLERANCE = 0.01f;
+const GLfloat SETTLE_STEP_TOLERANCE = 0.0001f;
+
+// Rope settings, each iteration is one exact solve of the linearized length constraints
+const int ROPE_ITERATIONS = 4;
+const GLfloat ROPE_DAMPING = 0.99f;
+
+// Seam settings, the gap a sewn seam closes to. Colours past the limit share one overflow colour that is
+// solved serially
+const GLfloat SEAM_REST_LENGTH = CLOTH_CONTACT_DISTANCE;
+const int SEAM_MAX_COLORS = 64;
+
+// Barrier contact settings. The barrier acts within the activation distance of a collider's surface, and the
+// line search stops short of any surface at this fraction of the clearance the step started with.
+// Tolerance is a fraction of the activation distance
+const GLfloat BARRIER_ACTIVATION_DISTANCE = CLOTH_THICKNESS;
+const GLfloat BARRIER_STIFFNESS = 1.0f;
+const GLfloat BARRIER_CCD_SEPARATION = 0.1f;
+const GLfloat BARRIER_TOLERANCE = 0.001f;
+const int BARRIER_NEWTON_ITERATIONS = 10;
+const int BARRIER_CCD_ITERATIONS = 16;
+
+// Watchdog retries for a step that leaves particle state non-finite, each doubling the substeps and constraint
+// iterations, before the cloth is held at the start of the step
+const int WATCHDOG_MAX_RETRIES = 3;
+
+// Benchmark scene settings, headless runs step at a fixed frame time just over the interactive minimum.
+// There's no plane collider, so the ground is a sphere large enough to be flat under a cloth
+const long SCENE_FRAME_TIME = MIN_TIME_STEP + 1;
+const int SCENE_DEFAULT_FRAMES = 300;
+const unsigned int SCENE_DEFAULT_SEED = 1;
+const GLfloat SCENE_GROUND_RADIUS = 100.0f;
+
+// Wobbling mesh settings for the obstacles scene, cached frames per wobble cycle and their duration in
+// milliseconds, sphere tessellation, lobes around the axis and their height relative to the radius
+const int SCENE_BLOB_FRAMES = 60;
+const GLfloat SCENE_BLOB_FRAME_DURATION = 1000.0f / 30.0f;
+const int SCENE_BLOB_STACKS = 12;
+const int SCENE_BLOB_LOBES = 3;
+const GLfloat SCENE_BLOB_WOBBLE = 0.08f;
+
+// Microbenchmark settings, elements per kernel pass (small enough to stay in cache) and timed passes,
+// of which the fastest is reported
+const int MICROBENCH_DEFAULT_ELEMENTS = 4096;
+const int MICROBENCH_PASSES = 200;
+
+// Event queue settings, spare bytes after each thread buffer so no two threads write to the same cache line
+const int EVENT_BUFFER_PADDING = 64;
+
+// Solver evaluation settings, frames per run, the iteration budget of the reference run every cloth setting's
+// errors are measured against, and the catenary chain's span as a fraction of its length
+const int EVALUATION_DEFAULT_FRAMES = 60;
+const int EVALUATION_REFERENCE_ITERATIONS = 400;
+const GLfloat EVALUATION_CATENARY_SPAN = 0.8f;
+
+// Iterations to tolerance settings, the relative spring stretch every setting reaches and the budget it has to
+// reach it in
+const GLfloat EVALUATION_TOLERANCE = 0.1f;
+const int EVALUATION_TOLERANCE_BUDGET = 200;
+
+// Gradient check settings, sheet size and steps of the fitted run, a spring constant stiff enough for its
+// effect on the loss to rise above double rounding (springConstK doesn't), and the relative parameter
+// perturbation used for central differences
+const int GRADIENT_CHECK_SIZE = 8;
+const int GRADIENT_CHECK_DEFAULT_STEPS = 20;
+const GLfloat GRADIENT_CHECK_SPRING_K = 1.0f;
+const double GRADIENT_CHECK_PERTURBATION = 0.00001;
+
 //////////////////////////////
 // Vector Maths Declarations
 //////////////////////////
@@ -76,6 +220,31 @@ vec3 operator+(const vec3 &u, const vec3 &v);
 vec3 operator-(const vec3 &u, const vec3 &v);
 bool operator!=(const vec3 &u, const vec3 &v);
 vec4 operator+(const vec4 &u, const vec4 &v);
+vec3 componentMin(const vec3 &u, const vec3 &v);
+vec3 componentMax(const vec3 &u, const vec3 &v);
+
+typedef struct AABB {
+	vec3 min;
+	vec3 max;
+} AABB;
+
+typedef struct Ray {
+	vec3 origin;
+	vec3 direction;
+} Ray;
+
+AABB emptyAABB();
+AABB merge(const AABB &a, const AABB &b);
+AABB expand(const AABB &box, const vec3 &point);
+bool overlaps(const AABB &a, const AABB &b);
+GLfloat surfaceArea(const AABB &box);
+vec3 closestPointOnTriangle(const vec3 &point, const vec3 &a, const vec3 &b, const vec3 &c, vec3 &barycentric);
+GLfloat segmentDistance(const vec3 &p0, const vec3 &p1, const vec3 &q0, const vec3 &q1);
+GLfloat closestPointsOnSegments(const vec3 &p0, const vec3 &p1, const vec3 &q0, const vec3 &q1, vec3 &onP, vec3 &onQ);
+vec3 closestPointOnSegment(const vec3 &point, const vec3 &p0, const vec3 &p1);
+GLfloat closestPointsSegmentTriangle(const vec3 &p0, const vec3 &p1, const vec3 &a, const vec3 &b, const vec3 &c,
+	vec3 &onSegment, vec3 &onTriangle, vec3 &barycentric);
+int solveCubicInUnitInterval(double a, double b, double c, double d, double roots[3]);
 
 ///////////////////////////////
 // Forces & Physics Constants
@@ -92,6 +261,7 @@ const GLfloat damperConstD = 1.0f - 0.00002f;
 typedef struct Particle {
 	vec3 position;
 	vec3 prevPosition;
+	vec3 velocity;
 	vec3 acceleration;
 	vec4 color;
 	GLfloat mass;
@@ -104,6 +274,65 @@ typedef struct Spring {
 	GLfloat restLength;
 } Spring;
 
+typedef struct Triangle {
+	Particle *v0;
+	Particle *v1;
+	Particle *v2;
+} Triangle;
+
+typedef struct Edge {
+	Particle *p0;
+	Particle *p1;
+} Edge;
+
+/////////////////////////////////
+// class TriangleBVH declarations
+/////////////////////////////
+
+typedef struct BVHNode {
+	AABB bounds;
+	int left;
+	int right;
+	int first;
+	int count;
+} BVHNode;
+
+typedef struct RayHit {
+	int triangle;
+	GLfloat t;
+	GLfloat u;
+	GLfloat v;
+} RayHit;
+
+// Note: Built once from topology, then only refit as particles move (rebuilt when quality degrades)
+class TriangleBVH {
+	private:
+		const std::vector<Triangle> *triangles;
+		std::vector<BVHNode> nodes;
+		std::vector<int> triangleIndices;
+		std::vector< std::vector<int>> levels;
+		GLfloat margin;
+		GLfloat builtSurfaceArea;
+		int refitsSinceCheck;
+		bool swept;
+
+		int buildNode(int first, int count, int depth, const std::vector<vec3> &centroids);
+		AABB triangleBounds(int triangle);
+		GLfloat totalSurfaceArea();
+
+	public:
+		TriangleBVH();
+		void build(const std::vector<Triangle> *triangles, GLfloat margin, bool swept = false);
+		void refit();
+		void update();
+		RayHit intersectRay(const Ray &ray);
+		void intersectRays(const std::vector<Ray> &rays, std::vector<RayHit> &hits);
+		void queryAABB(const AABB &box, std::vector<int> &results);
+		void queryAABBs(const std::vector<AABB> &boxes, std::vector< std::vector<int>> &results);
+		AABB getBounds();
+		bool isEmpty();
+};
+
 ////////////////////////////////////////////////
 // virtual class Actor & modifier declarations
 ////////////////////////////////////////////
@@ -115,6 +344,7 @@ class Actor {
 		std::vector<GLfloat> vertices;
 
 	public:
+		virtual ~Actor() {}
 		virtual void draw() = 0;
 		virtual vec3 getPosition() = 0;
 };
@@ -132,6 +362,28 @@ class Collidable {
 		virtual bool contains(vec3 point) = 0;
 };
 
+//////////////////////////////////////
+// class KeyframeTrack declarations
+//////////////////////////////////
+
+typedef struct Keyframe {
+	GLfloat time;
+	vec3 position;
+} Keyframe;
+
+// Note: Times are in milliseconds, and tracks loop once past their last key
+class KeyframeTrack {
+	private:
+		std::vector<Keyframe> keys;
+
+	public:
+		bool loadFromFile(const char *path);
+		void addKey(GLfloat time, vec3 position);
+		void evaluate(GLfloat time, vec3 &position, vec3 &velocity);
+		GLfloat getDuration();
+		bool isEmpty();
+};
+
 //////////////////////////////
 // class Sphere declarations
 //////////////////////////
@@ -141,45 +393,787 @@ private:
 	vec3 scale;
 	GLfloat radius;
 	vec3 velocity;
+	vec3 frameStartPosition;
+	KeyframeTrack *track;
+	long animationTime;
+	long frameDeltaT;
 
 public:
 	Sphere(vec3 &position, vec4 &color, GLfloat radius, GLfloat scale, const std::vector<GLfloat> &vertices);
 	void draw();
 	void move(long deltaT);
+	void evaluateSubstep(GLfloat fraction);
+	void setKeyframeTrack(KeyframeTrack *track);
 	bool contains(vec3 point);
 	void toggleMovement();
 	vec3 getPosition();
+	vec3 getVelocity();
+	long getFrameDeltaT();
 	GLfloat getRadius();
 };
 
-////////////////////////////
-// class Rope declarations
-////////////////////////
+///////////////////////////////
+// class Capsule declarations
+///////////////////////////
+
+class Capsule : public Actor, Collidable, Moveable {
+private:
+	vec3 start;
+	vec3 end;
+	GLfloat radius;
+
+public:
+	Capsule(vec3 &start, vec3 &end, vec4 &color, GLfloat radius);
+	void draw();
+	void move(long deltaT);
+	bool contains(vec3 point);
+	vec3 getPosition();
+	vec3 getStart();
+	vec3 getEnd();
+	GLfloat getRadius();
+};
+
+////////////////////////////////////
+// class MeshCollider declarations
+////////////////////////////////
+
+typedef struct MeshContact {
+	int triangle;
+	vec3 closest;
+	vec3 normal;
+	GLfloat distance;
+} MeshContact;
+
+// Note: Triangles are wound counter-clockwise seen from outside, so face normals point out of the body
+class MeshCollider : public Actor, Moveable {
+	private:
+		std::vector<Particle> meshVertices;
+		std::vector<Triangle> meshTriangles;
+		std::vector< std::vector<vec3>> frames;
+		TriangleBVH bvh;
+		long animationTime;
+		GLfloat frameDuration;
+		GLfloat maxDisplacement;
+
+		void setTopology(int vertexCount, const std::vector<int> &indices);
+
+	public:
+		MeshCollider(vec4 &color);
+		bool loadAnimationCache(const char *path);
+		void setAnimationCache(const std::vector<int> &indices, const std::vector< std::vector<vec3>> &frames, GLfloat frameDuration);
+		void draw();
+		void move(long deltaT);
+		void closestPoints(const std::vector<vec3> &points, GLfloat maxDistance, std::vector<MeshContact> &contacts);
+		vec3 getPosition();
+		AABB getBounds();
+		GLfloat getMaxDisplacement();
+		TriangleBVH &getBVH();
+};
+
+// Note: ClothSheet's tiles, declared ahead of EntityWorld which collides particles tile by tile. Tiles own
+// the particles in rows/cols [begin, end) (plus the last row/col at the sheet edge), while their bounds cover
+// every cell in that range
+typedef struct ClothTile {
+	int rowBegin;
+	int rowEnd;
+	int colBegin;
+	int colEnd;
+	AABB bounds;
+} ClothTile;
+
+//////////////////////////////////
+// class EntityWorld declarations
+//////////////////////////////
+
+// Note: Entities are indices. Every entity has a transform, stored as dense arrays indexed by entity, while
+// the other components are packed arrays with an owning entity per slot, so each system streams only the
+// data it needs instead of chasing virtual calls through individual actors
+typedef int Entity;
+
+typedef struct BounceMotionComponents {
+	std::vector<Entity> entities;
+	std::vector<GLfloat> velocityX;
+	std::vector<GLfloat> velocityY;
+	std::vector<GLfloat> velocityZ;
+	std::vector<GLfloat> minX;
+	std::vector<GLfloat> minY;
+	std::vector<GLfloat> minZ;
+	std::vector<GLfloat> maxX;
+	std::vector<GLfloat> maxY;
+	std::vector<GLfloat> maxZ;
+} BounceMotionComponents;
+
+typedef struct KeyframeMotionComponents {
+	std::vector<Entity> entities;
+	std::vector<KeyframeTrack*> tracks;
+	std::vector<long> animationTimes;
+} KeyframeMotionComponents;
+
+// Note: Centres are gathered from the transforms once per update so collision queries stream one array
+typedef struct SphereColliderComponents {
+	std::vector<Entity> entities;
+	std::vector<GLfloat> radii;
+	std::vector<GLfloat> centerX;
+	std::vector<GLfloat> centerY;
+	std::vector<GLfloat> centerZ;
+} SphereColliderComponents;
+
+// Note: Ends are stored relative to the entity's position
+typedef struct CapsuleColliderComponents {
+	std::vector<Entity> entities;
+	std::vector<vec3> startOffsets;
+	std::vector<vec3> endOffsets;
+	std::vector<GLfloat> radii;
+	std::vector<vec3> starts;
+	std::vector<vec3> ends;
+} CapsuleColliderComponents;
+
+typedef struct RenderableComponents {
+	std::vector<Entity> entities;
+	std::vector<int> meshes;
+	std::vector<vec4> colors;
+	std::vector<GLfloat> scales;
+} RenderableComponents;
+
+// Note: Existing actors such as Sphere and ClothSheet join as entities through this component. They keep
+// stepping themselves in the order the solver needs, the world only draws them and tracks their position
+typedef struct ActorComponents {
+	std::vector<Entity> entities;
+	std::vector<Actor*> actors;
+} ActorComponents;
+
+class EntityWorld {
+	private:
+		std::vector<GLfloat> positionX;
+		std::vector<GLfloat> positionY;
+		std::vector<GLfloat> positionZ;
+		BounceMotionComponents bounceMotions;
+		KeyframeMotionComponents keyframeMotions;
+		SphereColliderComponents sphereColliders;
+		CapsuleColliderComponents capsuleColliders;
+		RenderableComponents renderables;
+		ActorComponents actorComponents;
+		std::vector< std::vector<GLfloat>> meshVertices;
+		std::vector< std::vector<vec3>> meshNormals;
+		std::vector<int> candidates;
+		std::vector<int> tileCandidates;
+
+		void updateBounceMotion(long deltaT);
+		void updateKeyframeMotion(long deltaT);
+		void updateActors();
+		void updateColliders();
+		bool collideTileParticles(std::vector< std::vector<Particle>> &particles, const std::vector<GLfloat> &particleMask,
+			int rowBegin, int rowEnd, int colBegin, int colEnd, int sphereCount);
+
+	public:
+		Entity createEntity(vec3 position);
+		void addBounceMotion(Entity entity, vec3 velocity, AABB bounds);
+		void addKeyframeMotion(Entity entity, KeyframeTrack *track);
+		void addSphereCollider(Entity entity, GLfloat radius);
+		void addCapsuleCollider(Entity entity, vec3 start, vec3 end, GLfloat radius);
+		int addMesh(const std::vector<GLfloat> &vertices);
+		void addRenderable(Entity entity, int mesh, vec4 color, GLfloat scale);
+		Entity addActor(Actor *actor);
+		void update(long deltaT);
+		void draw();
+		bool collideParticles(std::vector< std::vector<Particle>> &particles, const std::vector<GLfloat> &particleMask,
+			const std::vector<ClothTile> &tiles, const AABB &region);
+		bool contains(vec3 point);
+		vec3 getPosition(Entity entity);
+		int getEntityCount();
+};
+
+/////////////////////////////////
+// class ClothSheet declarations
+/////////////////////////////
+
+typedef struct Impact {
+	Particle *particles[4];
+	GLfloat time;
+} Impact;
+
+enum AttachmentTargetType {
+	ATTACH_STATIC,
+	ATTACH_KEYFRAME,
+	ATTACH_SPHERE
+};
+
+// Note: Verlet folds damping into prevPosition, which also slows rigid motion. The velocity
+// integrator keeps an explicit velocity and only damps motion relative to the best-fit rigid motion
+enum IntegratorMode {
+	INTEGRATOR_VERLET,
+	INTEGRATOR_VELOCITY
+};
+
+// Note: Projecting first starts the solve from last step's positions, so early iterations fight this step's
+// inertia. Predicting first projects the inertial positions and lets the correction feed into velocity
+enum SolverOrder {
+	SOLVER_PROJECT_FIRST,
+	SOLVER_PREDICT_FIRST
+};
+
+// Note: Projection moves penetrating particles to the nearest surface after the fact, so a large step can carry
+// a particle through a thin collider and out the far side. Barrier contact instead moves each particle from its
+// last intersection-free position towards its target, minimizing a log barrier plus the distance to the target
+// with a line search that never crosses a surface
+enum ContactMode {
+	CONTACT_PROJECT,
+	CONTACT_BARRIER
+};
+
+// Note: Stored as parallel arrays so the per-iteration pass only streams through particles, targets and stiffness.
+// Offsets hold the world position for static targets, and the offset from the track or sphere otherwise
+typedef struct AttachmentTable {
+	std::vector<int> ids;
+	std::vector<Particle*> particles;
+	std::vector<vec3> targets;
+	std::vector<GLfloat> stiffness;
+	std::vector<int> targetTypes;
+	std::vector<vec3> offsets;
+	std::vector<KeyframeTrack*> tracks;
+	std::vector<Sphere*> anchors;
+} AttachmentTable;
+
+// Note: Bounds are of the current positions, unlike the swept bounds used for broad phase culling.
+// Velocity is the last substep's displacement, so it matches both integrators after a move
+typedef struct ClothStatistics {
+	AABB bounds;
+	vec3 centroid;
+	GLfloat mass;
+	GLfloat kineticEnergy;
+	GLfloat gravitationalEnergy;
+	GLfloat elasticEnergy;
+	GLfloat averageStrain;
+	GLfloat maxStrain;
+} ClothStatistics;
+
+
+class WindOcclusionGrid;
+class SimulationEventQueue;
+
+// Fill level of a SimulationEventQueue's thread buffers, so a rolled back step can drop what it recorded
+// Note: A mark only applies within the step it was taken in, flushing hands the step's events to callbacks
+// for good
+typedef struct SimulationEventMark {
+	long step;
+	std::vector<int> sizes;
+} SimulationEventMark;
 
 class ClothSheet : public Actor, Moveable {
 	private:
 		std::vector< std::vector<Particle>> particles;
 		std::vector< std::vector<Spring>> springs;
+		std::vector<Triangle> triangles;
+		std::vector<Edge> edges;
+		std::vector<int> triangleEdges;
+		std::vector<GLfloat> cellMask;
+		std::vector<GLfloat> particleMask;
+		std::vector<int> cellTriangles;
+		std::vector< std::vector<Impact>> impacts;
+		std::vector<ClothTile> tiles;
+		AABB bounds;
 		std::vector<Sphere*> potentialColliders;
+		std::vector<Capsule*> capsuleColliders;
+		std::vector<MeshCollider*> meshColliders;
+		std::vector<EntityWorld*> entityWorlds;
+		std::vector<vec3> meshQueryPoints;
+		std::vector<MeshContact> meshContacts;
 		std::queue<Particle*> pinnedParticles;
+		AttachmentTable attachments;
+		int nextAttachmentId;
+		long animationTime;
+		std::vector<int> grabAttachmentIds;
+		std::vector<vec3> grabOffsets;
+		TriangleBVH bvh;
 		vec3 vWindForce;
-
+		vec3 vGrabTarget;
+		GLfloat grabDepth;
+		bool selfCollisionEnabled;
+		int substeps;
+		GLfloat springK;
+		GLfloat damping;
+		IntegratorMode integratorMode;
+		GLfloat timeStep;
+		GLfloat relativeDampingRate;
+		SolverOrder solverOrder;
+		bool warmStart;
+		GLfloat constraintTolerance;
+		int constraintIterations;
+		int lastIterationCount;
+		bool islandSolved;
+		std::vector<vec3> constraintCorrections;
+		WindOcclusionGrid *windOcclusion;
+		SimulationEventQueue *events;
+		bool fusedKernel;
+		bool boundsStale;
+		std::vector<vec3> gravityAccelerations;
+		std::vector<AABB> stripBounds;
+		std::vector<vec4> staticSpheres;
+		ClothStatistics statistics;
+		std::vector<vec3> faceNormals;
+		bool particleSumsDirty;
+		bool springSumsDirty;
+		bool faceNormalsDirty;
+		ContactMode contactMode;
+		std::vector<vec3> barrierStartPositions;
+		bool watchdogEnabled;
+		std::vector<Particle> checkpointParticles;
+		std::vector<vec3> checkpointCorrections;
+		long checkpointTime;
+		SimulationEventMark checkpointEvents;
+		int rollbackCount;
+
+		void initialize(int width, int height, const std::vector<char> &occupancy, bool settled);
+		void generateMasks(int rows, int cols, const std::vector<char> &occupancy);
 		void generateParticleSheet(GLfloat height, GLfloat width);
-		void satisfyConstraints();
+		bool isCellSolid(int row, int col);
+		void generateTriangles();
+		void generateTiles();
+		void pinTopCorners();
+		void updateTileBounds();
+		void integrate(GLfloat timeTSquared);
+		void integrateVelocity(GLfloat stepLength);
+		void dampRelativeMotion(GLfloat fraction);
+		int pushAttachment(Particle *particle, int targetType, vec3 offset, KeyframeTrack *track, Sphere *anchor, GLfloat stiffness);
+		void evaluateAttachmentTargets(GLfloat time);
+		void findVertexTriangleImpacts(int row, int col, std::vector<Impact> &found);
+		void findEdgeEdgeImpacts(int edge, std::vector<Impact> &found);
+		void handleTriangleCollision();
+		void handleMeshCollision();
+		void resolveTriangleContact(const Triangle &tri, const vec3 &barycentric, const vec3 &correction);
+		int satisfyConstraints(int iterations);
+		void predictAndProject(int iterations, GLfloat stepLength, GLfloat timeTSquared);
 		void accumulateForces();
+		void fusedStep(GLfloat timeTSquared, bool addGravity, bool gatherBounds);
+		void collideStaticColliders(Particle &particle);
+		bool usesFusedKernel();
+		void computeParticleSums();
+		void computeSpringSums();
+		void computeFaceNormals();
+		void handleBarrierContacts();
+		void solveBarrierContact(Particle &particle, vec3 start);
+		GLfloat colliderDistance(int collider, const vec3 &point, vec3 &normal);
+		GLfloat colliderClearance(const vec3 &point);
+		GLfloat barrierEnergy(const vec3 &point, const vec3 &target);
+		GLfloat advanceToContact(const vec3 &point, const vec3 &step, GLfloat separation);
+		void advance(long deltaT);
+		void rescaleSubsteps(int substeps);
+		int countNonFinite();
+		void saveCheckpoint();
+		void restoreCheckpoint();
+		int findNonFinite();
+		void reportRollback(const char *cause, int particle, int attempt);
 
 	public:
-		ClothSheet(vec3 position, vec4 color, int width, int height);
+		ClothSheet(vec3 position, vec4 color, int width, int height, bool settled = false);
+		ClothSheet(vec3 position, vec4 color, int width, int height, const std::vector<char> &occupancy, bool settled = false);
 		void draw();
 		void move(long deltaT);
 		void handleCollision();
+		void handleSelfCollision();
+		void toggleSelfCollision();
+		int settle();
+		void setSubsteps(int substeps);
+		void setMaterial(GLfloat springK, GLfloat damping);
+		GLfloat getSpringK();
+		GLfloat getDamping();
+		void setIntegrator(IntegratorMode mode);
+		void setTimeStep(GLfloat timeStep);
+		GLfloat getTimeStep();
+		void setRelativeDamping(GLfloat rate);
+		void setSolverOrder(SolverOrder order, bool warmStart);
+		void setConstraintTolerance(GLfloat tolerance);
+		void setConstraintIterations(int iterations);
+		int getConstraintIterations();
+		void setIslandSolved(bool islandSolved);
+		void refreshBounds();
+		void setFusedKernel(bool enabled);
+		void setContactMode(ContactMode mode);
+		void setWatchdog(bool enabled);
+		int getRollbackCount();
+		int getLastIterationCount();
 		void applyWindForce(vec3 &windForce);
+		void setWindOcclusion(WindOcclusionGrid *grid);
+		void setEventQueue(SimulationEventQueue *queue);
 		void detach();
+		bool grab(const Ray &ray);
+		void dragGrab(const Ray &ray);
+		void releaseGrab();
+		int attach(Particle *particle, vec3 target, GLfloat stiffness);
+		int attach(Particle *particle, KeyframeTrack *track, vec3 offset, GLfloat stiffness);
+		int attach(Particle *particle, Sphere *anchor, GLfloat stiffness);
+		void setAttachmentTarget(int id, vec3 target);
+		void removeAttachment(int id);
 		void pushCollidable(Sphere *collidable);
+		void pushCollidable(Capsule *collidable);
+		void pushCollidable(MeshCollider *collidable);
+		void pushCollidable(EntityWorld *world);
 		vec3 getPosition();
+		std::vector< std::vector<Particle>> &getParticles();
+		std::vector< std::vector<Spring>> &getSprings();
+		std::vector<Triangle> &getTriangles();
+		std::vector<ClothTile> &getTiles();
+		const std::vector<GLfloat> &getParticleMask();
+		TriangleBVH &getBVH();
+		AABB getBounds();
+		int triangleIndex(int row, int col);
+		int getParticleIndex(const Particle *particle);
+		int getColliderIndex(const void *collider);
+		void invalidateDerived();
+		AABB getParticleBounds();
+		vec3 getCentroid();
+		GLfloat getKineticEnergy();
+		GLfloat getPotentialEnergy();
+		GLfloat getAverageStrain();
+		const ClothStatistics &getStatistics();
+		const std::vector<vec3> &getFaceNormals();
+		void layFlat();
 };
 
-////////////////////////////
+//////////////////////////////////
+// class RopeBatch declarations
+//////////////////////////////
+
+// Note: Node data is stored node-major with the strand index fastest, so every sweep along the strands
+// streams through contiguous runs and vectorizes across strands. All strands share one node count
+class RopeBatch : public Actor, Moveable {
+	private:
+		int strandCount;
+		int nodeCount;
+		std::vector<GLfloat> positionX;
+		std::vector<GLfloat> positionY;
+		std::vector<GLfloat> positionZ;
+		std::vector<GLfloat> prevPositionX;
+		std::vector<GLfloat> prevPositionY;
+		std::vector<GLfloat> prevPositionZ;
+		std::vector<GLfloat> inverseMass;
+		std::vector<GLfloat> restLengths;
+		std::vector<GLfloat> directionX;
+		std::vector<GLfloat> directionY;
+		std::vector<GLfloat> directionZ;
+		std::vector<GLfloat> diagonal;
+		std::vector<GLfloat> offDiagonal;
+		std::vector<GLfloat> lambda;
+		int iterations;
+		GLfloat timeStep;
+		std::vector<Sphere*> potentialColliders;
+		std::vector<Capsule*> capsuleColliders;
+		std::vector<MeshCollider*> meshColliders;
+		std::vector<vec3> meshQueryPoints;
+		std::vector<MeshContact> meshContacts;
+
+		void integrate(GLfloat timeTSquared);
+		void solveConstraints();
+		void handleCollision();
+		void setNode(int index, const vec3 &point);
+
+	public:
+		RopeBatch(vec4 color, int nodeCount);
+		int addStrand(vec3 root, vec3 tip, bool pinnedRoot);
+		void placeNode(int strand, int node, vec3 point, bool pinned);
+		void setIterations(int iterations);
+		void setTimeStep(GLfloat timeStep);
+		void draw();
+		void move(long deltaT);
+		void pushCollidable(Sphere *collidable);
+		void pushCollidable(Capsule *collidable);
+		void pushCollidable(MeshCollider *collidable);
+		vec3 getPosition();
+		vec3 getNode(int strand, int node);
+		int getStrandCount();
+		int getNodeCount();
+		GLfloat getRestLength(int strand);
+};
+
+/////////////////////////////////////////////
+// class ClothCollisionSystem declarations
+/////////////////////////////////////////
+
+typedef struct TilePair {
+	int clothA;
+	int tileA;
+	int clothB;
+	int tileB;
+} TilePair;
+
+typedef struct ClothContact {
+	Particle *particle;
+	const Triangle *triangle;
+	vec3 barycentric;
+	vec3 correction;
+} ClothContact;
+
+// Note: Scene-level since contacts between sheets can't be resolved from inside either ClothSheet
+class ClothCollisionSystem {
+	private:
+		std::vector<ClothSheet*> cloths;
+		SimulationEventQueue *events;
+		std::vector<TilePair> tilePairs;
+		std::vector< std::vector<ClothContact>> pairContacts;
+
+		void findTilePairs(int clothA, int clothB);
+		void collideTiles(const TilePair &pair, std::vector<ClothContact> &contacts);
+		void collideParticles(ClothSheet *particleCloth, const ClothTile &particleTile,
+			ClothSheet *triangleCloth, const ClothTile &triangleTile, std::vector<ClothContact> &contacts);
+
+	public:
+		ClothCollisionSystem();
+		void pushCloth(ClothSheet *cloth);
+		void setEventQueue(SimulationEventQueue *queue);
+		void handleCollisions();
+};
+
+///////////////////////////////////////
+// class ClothSeamSystem declarations
+///////////////////////////////////
+
+enum ClothEdgeSide {
+	EDGE_TOP,
+	EDGE_BOTTOM,
+	EDGE_LEFT,
+	EDGE_RIGHT
+};
+
+// Note: Rest length shrinks from the stitched particles' starting distance to the target over sewDuration
+typedef struct Seam {
+	Particle *p0;
+	Particle *p1;
+	GLfloat startLength;
+	GLfloat targetLength;
+	long startTime;
+	long sewDuration;
+	int constraint;
+} Seam;
+
+// Note: Stitched cloths and their seams are solved together as one island, once the cloths have moved. Cloths
+// in the island leave their springs out of their own constraint pass. Every spring and seam is greedily
+// coloured so no two constraints of a colour share a particle, then stored colour by colour so each colour
+// projects in parallel. Colouring only reruns when seams are added, sewing rewrites seam rest lengths in place
+class ClothSeamSystem {
+	private:
+		std::vector<ClothSheet*> cloths;
+		std::vector<Seam> seams;
+		std::vector<Particle*> constraintP0;
+		std::vector<Particle*> constraintP1;
+		std::vector<GLfloat> restLengths;
+		std::vector<int> colorOffsets;
+		long sewingTime;
+		bool dirty;
+
+		void gatherEdge(ClothSheet *cloth, ClothEdgeSide side, std::vector<Particle*> &edge);
+		void buildIsland();
+		void projectRange(int begin, int end, bool parallel);
+
+	public:
+		ClothSeamSystem();
+		void pushCloth(ClothSheet *cloth);
+		int stitch(ClothSheet *clothA, ClothEdgeSide sideA, ClothSheet *clothB, ClothEdgeSide sideB, long sewDuration);
+		void solve(long deltaT);
+		int getColorCount();
+		int getConstraintCount();
+};
+
+////////////////////////////////////////////
+// class SimulationEventQueue declarations
+////////////////////////////////////////
+
+enum SimulationEventType {
+	EVENT_COLLIDER_CONTACT,
+	EVENT_CLOTH_CONTACT,
+	EVENT_SELF_IMPACT,
+	EVENT_PIN_RELEASE,
+	EVENT_ROLLBACK
+};
+
+// Note: Other is the collider or cloth involved, if any. Magnitude is the penetration depth for contacts,
+// the time of impact within the step for self impacts and the retry attempt for rollbacks. The indices are
+// filled in when the step is flushed and stay the same between runs, unlike the pointers: cloths in the order
+// they were registered with the queue, particles row-major, other as a cloth index for cloths and the
+// collider's registration order with the cloth otherwise, -1 when absent
+typedef struct SimulationEvent {
+	SimulationEventType type;
+	long step;
+	ClothSheet *cloth;
+	Particle *particle;
+	const void *other;
+	vec3 position;
+	GLfloat magnitude;
+	int clothIndex;
+	int particleIndex;
+	int otherIndex;
+} SimulationEvent;
+
+typedef void (*SimulationEventCallback)(const SimulationEvent &event, void *userData);
+
+// Note: A whole line of padding rather than alignas, which std::vector doesn't honour before C++17
+typedef struct SimulationEventBuffer {
+	std::vector<SimulationEvent> events;
+	char padding[EVENT_BUFFER_PADDING];
+} SimulationEventBuffer;
+
+// Note: Stages record into the buffer of the thread they run on, so recording from inside parallel loops needs
+// no locking. Buffers are merged, ordered and deduplicated once per step before callbacks see them
+class SimulationEventQueue {
+	private:
+		std::vector<SimulationEventBuffer> threadBuffers;
+		std::vector<SimulationEvent> events;
+		std::vector<SimulationEventType> callbackTypes;
+		std::vector<SimulationEventCallback> callbacks;
+		std::vector<void*> callbackData;
+		std::vector<ClothSheet*> cloths;
+		std::unordered_map<const void*, int> clothIndices;
+		std::unordered_map<const Particle*, int> particleIndices;
+		std::map<std::pair<const void*, const void*>, int> colliderIndices;
+		long step;
+
+		void merge();
+		int findCloth(const void *cloth);
+		int findParticle(ClothSheet *cloth, const Particle *particle);
+		int findOther(ClothSheet *cloth, const void *other);
+
+	public:
+		SimulationEventQueue();
+		void registerCloth(ClothSheet *cloth);
+		void record(SimulationEventType type, ClothSheet *cloth, Particle *particle, const void *other, GLfloat magnitude);
+		SimulationEventMark mark();
+		void discard(const SimulationEventMark &mark, const ClothSheet *cloth);
+		int getClothIndex(const ClothSheet *cloth);
+		void subscribe(SimulationEventType type, SimulationEventCallback callback, void *userData);
+		void flush();
+		const std::vector<SimulationEvent> &getEvents();
+		long getStep();
+};
+
+/////////////////////////////////////////
+// class WindOcclusionGrid declarations
+/////////////////////////////////////
+
+// Note: Cells are stored slice by slice along the wind's dominant axis, upwind slice first, so the
+// transmittance pass streams through memory and each slice only reads the one before it. A cloth's tile boxes
+// enclose its own triangles, so each cloth gets its own transmittance, marched through the colliders and
+// every other cloth
+class WindOcclusionGrid {
+	private:
+		std::vector<ClothSheet*> cloths;
+		std::vector<Sphere*> spheres;
+		std::vector<Capsule*> capsules;
+		std::vector<MeshCollider*> meshColliders;
+		std::vector<GLfloat> opacity;
+		std::vector<GLfloat> colliderOpacity;
+		std::vector< std::vector<GLfloat>> transmittances;
+		AABB bounds;
+		vec3 cellSize;
+		int axis;
+		bool reversed;
+		bool active;
+
+		int cellIndex(int x, int y, int z);
+		void computeBounds();
+		void rasterizeBox(const AABB &box, GLfloat boxOpacity);
+		void rasterizeSphere(const vec3 &centre, GLfloat radius);
+		void rasterizeCapsule(const vec3 &start, const vec3 &end, GLfloat radius);
+		void rasterizeMesh(MeshCollider *mesh);
+		void rasterizeCloth(ClothSheet *cloth, const vec3 &windDirection);
+		void propagate(const vec3 &windDirection, std::vector<GLfloat> &transmittance);
+
+	public:
+		WindOcclusionGrid();
+		void pushCloth(ClothSheet *cloth);
+		void pushCollidable(Sphere *collidable);
+		void pushCollidable(Capsule *collidable);
+		void pushCollidable(MeshCollider *collidable);
+		void update(const vec3 &windForce);
+		int findCloth(const ClothSheet *cloth);
+		GLfloat sample(int cloth, const vec3 &point);
+};
+
+//////////////////////////////////////////////
+// class ClothEquilibriumSolver declarations
+//////////////////////////////////////////
+
+// Note: Minimizes stiff spring plus gravity potential energy over the unpinned particles with Newton's method.
+// Spring Hessians are clamped positive semi-definite so compressed springs don't make the system indefinite
+class ClothEquilibriumSolver {
+	private:
+		int particleCount;
+		std::vector<Particle*> particleRefs;
+		std::vector<int> springEnds;
+		std::vector<double> restLengths;
+		std::vector<double> baseStiffness;
+		std::vector<double> stiffness;
+		std::vector<double> weights;
+		std::vector<char> pinned;
+		std::vector<double> positions;
+		std::vector<double> hessianBlocks;
+		double baseRegularization;
+		double regularization;
+
+		int newton(int maxIterations, double tolerance);
+
+		double energy(const std::vector<double> &x);
+		void gradient(const std::vector<double> &x, std::vector<double> &result);
+		void computeHessian(const std::vector<double> &x);
+		void multiplyHessian(const std::vector<double> &p, std::vector<double> &result);
+		void conjugateGradient(const std::vector<double> &rhs, std::vector<double> &result);
+
+	public:
+		ClothEquilibriumSolver(ClothSheet &cloth);
+		int solve(int maxIterations);
+		void apply();
+};
+
+///////////////////////////////////////////
+// class ClothGradientSolver declarations
+//////////////////////////////////////
+
+typedef struct SimulationParameters {
+	GLfloat springK;
+	GLfloat damping;
+	vec3 wind;
+} SimulationParameters;
+
+typedef struct ParameterGradient {
+	double springK;
+	double damping;
+	double windX;
+	double windY;
+	double windZ;
+} ParameterGradient;
+
+// Note: Differentiates a copy of the cloth's Verlet step (forces, constraint sweeps, integration) with a
+// constant, unoccluded wind, using the cloth's time step and constraint iterations. Collisions, attachments and
+// substeps are left out since they aren't smooth in the parameters
+class ClothGradientSolver {
+	private:
+		int particleCount;
+		int steps;
+		int checkpointInterval;
+		int iterations;
+		double timeTSquared;
+		std::vector<int> springEnds;
+		std::vector<double> restLengths;
+		std::vector<int> triangleVertices;
+		std::vector<char> pinned;
+		std::vector<double> masses;
+		std::vector<double> initialState;
+		std::vector<double> sweepPositions;
+		std::vector<double> springPositions;
+
+		void forwardStep(const SimulationParameters &params, std::vector<double> &state);
+		void accumulateForces(const SimulationParameters &params, const double *x, double *a);
+		void satisfyConstraints(double *x, int sweeps);
+		void backwardStep(const SimulationParameters &params, const std::vector<double> &stateBefore,
+			std::vector<double> &adjoint, ParameterGradient &gradient);
+		double frameLoss(const std::vector<double> &state, const std::vector<vec3> &reference, std::vector<double> *adjoint);
+
+	public:
+		ClothGradientSolver(ClothSheet &cloth, int steps);
+		void simulate(const SimulationParameters &params, std::vector< std::vector<vec3>> &frames);
+		double computeGradient(const SimulationParameters &params, const std::vector< std::vector<vec3>> &referenceFrames,
+			ParameterGradient &gradient);
+};
+
+///////////////////////////
 // class Wind declarations
 ////////////////////////
 
@@ -195,12 +1189,101 @@ class Wind {
 		void toggleWind();
 };
 
+//////////////////////////////////////
+// class BenchmarkScene declarations
+//////////////////////////////////
+
+// Note: Scenes own everything they create and step it in the same order as driver(), without drawing.
+// All randomness (placement, tracks, gusts) comes from the seeded generator, so a name and seed always
+// replay the same simulation
+class BenchmarkScene {
+	private:
+		std::string name;
+		std::mt19937 random;
+		std::vector<GLfloat> sphereVertices;
+		std::vector<ClothSheet*> cloths;
+		std::vector<RopeBatch*> ropes;
+		std::vector<Sphere*> spheres;
+		std::vector<Capsule*> capsules;
+		std::vector<MeshCollider*> meshColliders;
+		std::vector<KeyframeTrack*> tracks;
+		EntityWorld *world;
+		ClothCollisionSystem *clothCollisions;
+		WindOcclusionGrid *windOcclusion;
+		Wind *wind;
+		std::vector<GLfloat> gustFrequencies;
+		std::vector<GLfloat> gustPhases;
+		std::vector<vec3> gustAmplitudes;
+		long time;
+		bool valid;
+
+		GLfloat uniform(GLfloat min, GLfloat max);
+		ClothSheet *addCloth(vec3 position, int rows, int cols);
+		Sphere *addSphere(vec3 position, GLfloat radius);
+		MeshCollider *addWobblingBlob(vec3 center, GLfloat radius);
+		void addTurbulentWind(vec3 wind, GLfloat gustiness);
+		vec3 generateWindForce(long deltaT);
+		void buildFlag();
+		void buildDrape();
+		void buildCurtains();
+		void buildCrumple();
+		void buildObstacles();
+		void buildCatenary();
+		void buildSag();
+
+	public:
+		BenchmarkScene(const std::string &name, unsigned int seed);
+		~BenchmarkScene();
+		static const std::vector<std::string> &getSceneNames();
+		void step(long deltaT);
+		bool isValid();
+		int getParticleCount();
+		std::vector<ClothSheet*> &getCloths();
+		std::vector<RopeBatch*> &getRopes();
+		void setEventQueue(SimulationEventQueue *queue);
+};
+
+typedef struct SolverSetting {
+	const char *name;
+	IntegratorMode integrator;
+	SolverOrder order;
+	bool warmStart;
+	int substeps;
+	bool fused;
+} SolverSetting;
+
+typedef struct SolverEvaluation {
+	const char *setting;
+	int iterations;
+	double frameTime;
+	GLfloat error;
+	bool pareto;
+} SolverEvaluation;
+
 ///////////////////////////////////////////
 // Cloth Simulation Function Declarations
 ///////////////////////////////////////
 
 void generateCube(int smoothness, std::vector<GLfloat> &vertices);
 void generateSpherifiedCube(int smoothness, std::vector<GLfloat> &vertices);
+bool loadOccupancyMask(const char *path, int &width, int &height, std::vector<char> &cells);
+int runBenchmarkScene(const std::string &name, int frames, unsigned int seed, bool reportEvents);
+void countSimulationEvent(const SimulationEvent &event, void *userData);
+unsigned long long readCycleCounter();
+double measureCyclesPerElement(const std::function<void()> &kernel, int elements);
+int runMicroBenchmarks(int elements);
+void applySolverSetting(BenchmarkScene &scene, const SolverSetting &setting, int iterations);
+double measureSolverSetting(BenchmarkScene &scene, const SolverSetting &setting, int iterations, int frames);
+void gatherPositions(BenchmarkScene &scene, std::vector<vec3> &positions);
+GLfloat positionError(BenchmarkScene &scene, const std::vector<vec3> &reference);
+double measureRopeIterations(BenchmarkScene &scene, int iterations, int frames);
+double measureIterationsToTolerance(BenchmarkScene &scene, const SolverSetting &setting, int frames);
+double solveCatenaryParameter(double span, double length);
+GLfloat catenaryError(RopeBatch *chain);
+void markParetoFront(std::vector<SolverEvaluation> &results);
+int runSolverEvaluation(int frames, unsigned int seed);
+void printEvaluation(const std::vector<SolverEvaluation> &results);
+int runGradientCheck(int steps);
 void pause();
 
 ////////////////////////
@@ -228,22 +1311,35 @@ void resizeViewport(GLint width, GLint height);
 void draw();
 void driver();
 void switchCamera(Camera &camera);
+Ray cameraRay(const Camera &camera, int x, int y);
 void keyboardHandler(unsigned char key, int x, int y);
+void mouseHandler(int button, int state, int x, int y);
+void mouseMotionHandler(int x, int y);
 
 ////////////
 // Globals
 ////////
 
-// Note: Using std::vector since actors are persistent
-std::vector<Actor*> actors;
+// Note: Actors are wrapped as entities, so the world draws them alongside its own lightweight entities
+EntityWorld *world;
 std::vector<Collidable*> collidables;
 
 ClothSheet *cloth;
 Sphere *sphere;
 Wind *wind;
+ClothCollisionSystem *clothCollisions;
+WindOcclusionGrid *windOcclusion;
+RopeBatch *ropes = 0;
+ClothSheet *panel = 0;
+MeshCollider *meshCollider = 0;
+ClothSeamSystem *seams;
+SimulationEventQueue *simulationEvents;
 
 long lastUpdateT = 0;
 bool paused = false;
+bool grabbing = false;
+GLint windowWidth = WIDTH;
+GLint windowHeight = HEIGHT;
 
 // Lighting settings
 GLfloat lightOneAmbient[] = { 0.0f, 0.0f, 0.0f, 1.0f };
@@ -255,6 +1351,7 @@ Camera camera = { vec3{ 0.0f, 0.0f, 1.0f }, vec3{ 0.0f, 0.0f, 0.0f }, vec3{ 0.0f
 Camera cameraUp = { vec3{ 0.0f, 2.0f, 1.0f }, vec3{ 0.0f, 0.0f, -1.0f }, vec3{ 0.0f, 1.0f, 0.0f } };
 Camera cameraLeft = { vec3{ -2.0f, 0.5f, -3.0f }, vec3{ 0.0f, 0.0f, -1.0f }, vec3{ 0.0f, 1.0f, 0.0f } };
 Camera cameraRight = { vec3{ 2.0f, 0.5f, -3.0f }, vec3{ 0.0f, 0.0f, -1.0f }, vec3{ 0.0f, 1.0f, 0.0f } };
+Camera *activeCamera = &camera;
 
 ///////////
 // main()
@@ -263,6 +1360,76 @@ Camera cameraRight = { vec3{ 2.0f, 0.5f, -3.0f }, vec3{ 0.0f, 0.0f, -1.0f }, vec
 int main(int argc, char *argv[]) {
 	GLint window;
 
+	// Running a named benchmark scene headless instead of opening a window
+	int sceneFrames = SCENE_DEFAULT_FRAMES;
+	unsigned int sceneSeed = SCENE_DEFAULT_SEED;
+	bool sceneEvents = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--events") {
+			sceneEvents = true;
+		}
+	}
+
+	for (int i = 1; i < argc - 1; i++) {
+		if (std::string(argv[i]) == "--frames") {
+			sceneFrames = std::max(atoi(argv[i + 1]), 1);
+		} else if (std::string(argv[i]) == "--seed") {
+			sceneSeed = (unsigned int)strtoul(argv[i + 1], 0, 10);
+		}
+	}
+
+	for (int i = 1; i < argc - 1; i++) {
+		if (std::string(argv[i]) == "--scene") {
+			return runBenchmarkScene(argv[i + 1], sceneFrames, sceneSeed, sceneEvents);
+		}
+	}
+
+	// Timing the vector maths and per-element solver kernels in isolation
+	int microbenchElements = MICROBENCH_DEFAULT_ELEMENTS;
+
+	for (int i = 1; i < argc - 1; i++) {
+		if (std::string(argv[i]) == "--elements") {
+			microbenchElements = std::max(atoi(argv[i + 1]), 1);
+		}
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--microbench") {
+			return runMicroBenchmarks(microbenchElements);
+		}
+	}
+
+	// Sweeping solver settings against reference runs, with fewer frames by default since it runs every scene
+	// dozens of times
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--evaluate") {
+			int evaluationFrames = EVALUATION_DEFAULT_FRAMES;
+
+			for (int j = 1; j < argc - 1; j++) {
+				if (std::string(argv[j]) == "--frames") {
+					evaluationFrames = sceneFrames;
+				}
+			}
+
+			return runSolverEvaluation(evaluationFrames, sceneSeed);
+		}
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--check-gradient") {
+			int gradientSteps = GRADIENT_CHECK_DEFAULT_STEPS;
+
+			for (int j = 1; j < argc - 1; j++) {
+				if (std::string(argv[j]) == "--frames") {
+					gradientSteps = sceneFrames;
+				}
+			}
+
+			return runGradientCheck(gradientSteps);
+		}
+	}
+
 	srand(static_cast<unsigned int>(time(0)));
 
 	// Initializing scene state
@@ -273,18 +1440,194 @@ int main(int argc, char *argv[]) {
 	sphere = new Sphere(spherePos,
 						sphereColor, 
 						1.0f, 0.5f, vertices);
-	actors.push_back(sphere);
+	world = new EntityWorld();
+	world->addActor(sphere);
 
-	// Creating cloth
+	// Creating cloth, optionally cut to the outline of a PBM/PGM mask
     vec3 clothPos = vec3{ -1.0f, 1.0f, -2.0f };
     vec4 clothColor = vec4{ 0.212f, 0.969f, 0.627f, 1.0f };
-	cloth = new ClothSheet(clothPos, 
-							clothColor, 
-							50, 50);
-	actors.push_back(cloth);
+	std::vector<char> clothMask;
+	int maskWidth = 0;
+	int maskHeight = 0;
+
+	for (int i = 1; i < argc - 1; i++) {
+		if (std::string(argv[i]) == "--cloth-mask" && !loadOccupancyMask(argv[i + 1], maskWidth, maskHeight, clothMask)) {
+			fprintf(stderr, "Invalid --cloth-mask '%s', expected a PBM or PGM image\n", argv[i + 1]);
+			return 1;
+		}
+	}
+
+	if (!clothMask.empty()) {
+		cloth = new ClothSheet(clothPos, clothColor, maskHeight + 1, maskWidth + 1, clothMask);
+	} else {
+		cloth = new ClothSheet(clothPos, 
+								clothColor, 
+								50, 50);
+	}
+	world->addActor(cloth);
 
 	// Pushing nearby Collidable actors to cloth
 	cloth->pushCollidable(sphere);
+	cloth->pushCollidable(world);
+
+	// Registering cloths that may collide with each other
+	clothCollisions = new ClothCollisionSystem();
+	clothCollisions->pushCloth(cloth);
+
+	// Registering everything that can shelter cloth from the wind
+	windOcclusion = new WindOcclusionGrid();
+	windOcclusion->pushCloth(cloth);
+	windOcclusion->pushCollidable(sphere);
+
+	// Reporting contacts, impacts and pin releases once per step
+	simulationEvents = new SimulationEventQueue();
+	cloth->setEventQueue(simulationEvents);
+	clothCollisions->setEventQueue(simulationEvents);
+
+	// Optionally sewing a second panel behind the cloth along both sides
+	seams = new ClothSeamSystem();
+
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--seams") {
+			panel = new ClothSheet(clothPos + vec3{ 0.0f, 0.0f, -0.6f }, clothColor, 50, 50);
+			world->addActor(panel);
+			panel->pushCollidable(sphere);
+			panel->setEventQueue(simulationEvents);
+			clothCollisions->pushCloth(panel);
+			windOcclusion->pushCloth(panel);
+
+			seams->stitch(cloth, EDGE_LEFT, panel, EDGE_LEFT, 3000);
+			seams->stitch(cloth, EDGE_RIGHT, panel, EDGE_RIGHT, 3000);
+		}
+	}
+
+	// Optionally driving the sphere from a keyframe file instead of the default back and forth
+	for (int i = 1; i < argc - 1; i++) {
+		if (std::string(argv[i]) == "--sphere-track") {
+			KeyframeTrack *sphereTrack = new KeyframeTrack();
+
+			if (sphereTrack->loadFromFile(argv[i + 1])) {
+				sphere->setKeyframeTrack(sphereTrack);
+			}
+		}
+	}
+
+	// Solver options apply to the stitched panel too, so both sides of a seam step alike
+	std::vector<ClothSheet*> solverCloths(1, cloth);
+
+	if (panel != 0) {
+		solverCloths.push_back(panel);
+	}
+
+	for (int c = 0; c < solverCloths.size(); c++) {
+		ClothSheet *solverCloth = solverCloths.at(c);
+
+		for (int i = 1; i < argc - 1; i++) {
+			if (std::string(argv[i]) == "--integrator" && std::string(argv[i + 1]) == "velocity") {
+				solverCloth->setIntegrator(INTEGRATOR_VELOCITY);
+			} else if (std::string(argv[i]) == "--time-step") {
+				GLfloat timeStep = (GLfloat)atof(argv[i + 1]);
+
+				// Note: The velocity integrator divides by the step length, so a zero step would turn every particle NaN
+				if (!(timeStep > 0.0f)) {
+					fprintf(stderr, "Invalid --time-step '%s', expected a positive number\n", argv[i + 1]);
+					return 1;
+				}
+
+				solverCloth->setTimeStep(timeStep);
+			} else if (std::string(argv[i]) == "--solver-order" && std::string(argv[i + 1]) == "predict") {
+				solverCloth->setSolverOrder(SOLVER_PREDICT_FIRST, false);
+			} else if (std::string(argv[i]) == "--solver-order" && std::string(argv[i + 1]) == "predict-warm") {
+				solverCloth->setSolverOrder(SOLVER_PREDICT_FIRST, true);
+			} else if (std::string(argv[i]) == "--constraint-tolerance") {
+				solverCloth->setConstraintTolerance((GLfloat)atof(argv[i + 1]));
+			} else if (std::string(argv[i]) == "--contact" && std::string(argv[i + 1]) == "barrier") {
+				solverCloth->setContactMode(CONTACT_BARRIER);
+			}
+		}
+
+		for (int i = 1; i < argc; i++) {
+			if (std::string(argv[i]) == "--fused") {
+				solverCloth->setFusedKernel(true);
+			}
+		}
+	}
+
+	// Starting from the draped rest state rather than a flat sheet
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--settle") {
+			cloth->settle();
+		}
+	}
+
+	// Optionally hanging a row of ropes above the sphere
+	for (int i = 1; i < argc - 1; i++) {
+		if (std::string(argv[i]) == "--ropes") {
+			int ropeCount = std::max(atoi(argv[i + 1]), 1);
+			ropes = new RopeBatch(vec4{ 0.969f, 0.627f, 0.212f, 1.0f }, 32);
+
+			for (int r = 0; r < ropeCount; r++) {
+				GLfloat offset = (ropeCount > 1) ? (GLfloat)r / (ropeCount - 1) - 0.5f : 0.0f;
+				vec3 root = spherePos + vec3{ offset * 0.8f, 0.7f, 0.0f };
+				ropes->addStrand(root, root + vec3{ 0.6f, 0.0f, 0.0f }, true);
+			}
+
+			// Note: --time-step was validated with the cloth options above
+			for (int j = 1; j < argc - 1; j++) {
+				if (std::string(argv[j]) == "--time-step") {
+					ropes->setTimeStep((GLfloat)atof(argv[j + 1]));
+				}
+			}
+
+			ropes->pushCollidable(sphere);
+			world->addActor(ropes);
+		}
+	}
+
+	// Optionally adding an animated mesh collider read from an animation cache
+	for (int i = 1; i < argc - 1; i++) {
+		if (std::string(argv[i]) == "--mesh-collider") {
+			vec4 meshColor = vec4{ 0.627f, 0.212f, 0.969f, 1.0f };
+			meshCollider = new MeshCollider(meshColor);
+
+			if (!meshCollider->loadAnimationCache(argv[i + 1])) {
+				fprintf(stderr, "Invalid --mesh-collider '%s', expected a mesh animation cache\n", argv[i + 1]);
+				return 1;
+			}
+
+			cloth->pushCollidable(meshCollider);
+
+			if (panel != 0) {
+				panel->pushCollidable(meshCollider);
+			}
+
+			if (ropes != 0) {
+				ropes->pushCollidable(meshCollider);
+			}
+
+			windOcclusion->pushCollidable(meshCollider);
+			world->addActor(meshCollider);
+		}
+	}
+
+	// Optionally filling the space under the cloth with small bouncing spheres
+	for (int i = 1; i < argc - 1; i++) {
+		if (std::string(argv[i]) == "--crowd") {
+			int crowdCount = std::max(atoi(argv[i + 1]), 0);
+			int crowdMesh = world->addMesh(vertices);
+			AABB crowdBounds = AABB{ vec3{ -1.0f, -1.2f, -3.0f }, vec3{ 1.0f, 0.0f, -1.5f } };
+
+			for (int c = 0; c < crowdCount; c++) {
+				vec3 start = vec3{ -1.0f + 2.0f * rand() / RAND_MAX, -1.2f + 1.2f * rand() / RAND_MAX, -3.0f + 1.5f * rand() / RAND_MAX };
+				vec3 velocity = vec3{ (GLfloat)rand() / RAND_MAX - 0.5f, (GLfloat)rand() / RAND_MAX - 0.5f, (GLfloat)rand() / RAND_MAX - 0.5f } * SPHERE_SPEED;
+				Entity entity = world->createEntity(start);
+
+				world->addBounceMotion(entity, velocity, crowdBounds);
+				world->addSphereCollider(entity, 0.05f);
+				world->addRenderable(entity, crowdMesh, vec4{ 0.969f, 0.212f, 0.627f, 1.0f }, 0.05f);
+			}
+		}
+	}
 
 	// Seeding wind force
     vec3 windForce = vec3{ 0.0f, -2.0f, -1.5f };
@@ -304,6 +1647,8 @@ int main(int argc, char *argv[]) {
 
 	// Setting input callback functions
 	glutKeyboardFunc(&keyboardHandler);
+	glutMouseFunc(&mouseHandler);
+	glutMotionFunc(&mouseMotionHandler);
 
 	// Initializing OpenGL
 	initOpenGL();
@@ -360,12 +1705,14 @@ void resizeViewport(GLint width, GLint height) {
 
 	// Setting viewport to new window size
 	glViewport(0, 0, width, height);
+	windowWidth = width;
+	windowHeight = height;
 
 	// Preparing projection matrix
 	resetProjection();
 
 	// Resetting view
-	switchCamera(camera);
+	switchCamera(*activeCamera);
 }
 
 // Main "loop" since GLUT is event driven
@@ -390,9 +1737,30 @@ void driver() {
 		if (!paused) {
 			// Updating state
 			sphere->move(deltaT);
+
+			if (meshCollider != 0) {
+				meshCollider->move(deltaT);
+			}
+
+			world->update(deltaT);
             vec3 windUpdate = wind->generateWindForce(deltaT);
 			cloth->applyWindForce(windUpdate);
+			windOcclusion->update(windUpdate);
 			cloth->move(deltaT);
+
+			if (panel != 0) {
+				panel->applyWindForce(windUpdate);
+				panel->move(deltaT);
+			}
+
+			seams->solve(deltaT);
+			clothCollisions->handleCollisions();
+
+			if (ropes != 0) {
+				ropes->move(deltaT);
+			}
+
+			simulationEvents->flush();
 		}
 
 		// Drawing scene
@@ -408,13 +1776,8 @@ void draw() {
 	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	Actor *actor;
-
-	// Delegating draw to each Actor object
-	for (unsigned int i = 0; i < actors.size(); i++) {
-		actor = actors.at(i);
-		actor->draw();
-	}
+	// Delegating draw to the entity world's render system
+	world->draw();
 
 	glutSwapBuffers();
 }
@@ -427,6 +1790,24 @@ void switchCamera(Camera &camera) {
 	gluLookAt(camera.position.x, camera.position.y, camera.position.z,
 		camera.facing.x, camera.facing.y, camera.facing.z,
 		camera.up.x, camera.up.y, camera.up.z);
+
+	activeCamera = &camera;
+}
+
+// Builds a world space ray through window pixel (x, y) matching the gluPerspective/gluLookAt setup
+Ray cameraRay(const Camera &camera, int x, int y) {
+	vec3 forward = normalize(camera.facing - camera.position);
+	vec3 right = normalize(cross(forward, camera.up));
+	vec3 up = cross(right, forward);
+
+	GLfloat tanHalfFOV = tan((FOV * 0.5f) * PI / 180.0f);
+	GLfloat ndcX = (2.0f * (x + 0.5f)) / windowWidth - 1.0f;
+	GLfloat ndcY = 1.0f - (2.0f * (y + 0.5f)) / windowHeight;
+
+	// Note: Projection always uses ASPECT, even after the window is resized
+	vec3 direction = forward + (right * (ndcX * tanHalfFOV * ASPECT)) + (up * (ndcY * tanHalfFOV));
+
+	return Ray{ camera.position, normalize(direction) };
 }
 
 void keyboardHandler(unsigned char key, int x, int y) {
@@ -462,13 +1843,37 @@ void keyboardHandler(unsigned char key, int x, int y) {
 	case 'x':
 		sphere->toggleMovement();
 		break;
+	case 'c':
+		cloth->toggleSelfCollision();
+		break;
 	default:
 		break;
 	}
 }
 
-///////////////////////////////
-// CLoth Simulation functions
+// Grabs the cloth under the cursor on left click and lets go on release
+void mouseHandler(int button, int state, int x, int y) {
+	if (button != GLUT_LEFT_BUTTON) {
+		return;
+	}
+
+	if (state == GLUT_DOWN) {
+		grabbing = cloth->grab(cameraRay(*activeCamera, x, y));
+	} else if (grabbing) {
+		cloth->releaseGrab();
+		grabbing = false;
+	}
+}
+
+// Drags grabbed particles along with the cursor
+void mouseMotionHandler(int x, int y) {
+	if (grabbing) {
+		cloth->dragGrab(cameraRay(*activeCamera, x, y));
+	}
+}
+
+///////////////////////////////
+// CLoth Simulation functions
 ///////////////////////////
 
 void generateCube(int smoothness, std::vector<GLfloat> &vertices) {
@@ -656,6 +2061,730 @@ void generateSpherifiedCube(int smoothness, std::vector<GLfloat> &vertices) {
 	}
 }
 
+// Reads a PBM (P1/P4) or PGM (P2/P5) image as a row by row occupancy mask, one cell per pixel
+// Note: Set (black) PBM pixels and PGM pixels brighter than half the max value count as cloth
+bool loadOccupancyMask(const char *path, int &width, int &height, std::vector<char> &cells) {
+	std::ifstream file(path, std::ios::binary);
+	std::string magic;
+	int header[3] = { 0, 0, 1 };
+	int packed = 0;
+
+	if (!file.is_open() || !(file >> magic) || (magic != "P1" && magic != "P2" && magic != "P4" && magic != "P5")) {
+		return false;
+	}
+
+	bool bitmap = magic == "P1" || magic == "P4";
+	bool binary = magic == "P4" || magic == "P5";
+
+	// Reading width, height and (for PGM) max value, skipping comments
+	for (int k = 0; k < (bitmap ? 2 : 3); k++) {
+		while (file >> std::ws && file.peek() == '#') {
+			file.ignore(1 << 16, '\n');
+		}
+
+		if (!(file >> header[k])) {
+			return false;
+		}
+	}
+
+	width = header[0];
+	height = header[1];
+
+	if (width <= 0 || height <= 0 || header[2] <= 0) {
+		return false;
+	}
+
+	cells = std::vector<char>(width * height, 0);
+
+	if (binary) {
+		// Exactly one whitespace byte separates the header from the raster
+		file.get();
+	}
+
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			int value = 0;
+
+			if (!binary) {
+				if (!(file >> value)) {
+					return false;
+				}
+			} else if (bitmap) {
+				// Rows are packed eight pixels per byte, most significant bit first, padded to a whole byte
+				if (j % 8 == 0) {
+					packed = file.get();
+				}
+
+				value = (packed >> (7 - j % 8)) & 1;
+			} else {
+				value = file.get();
+
+				if (header[2] > 255) {
+					value = (value << 8) | file.get();
+				}
+			}
+
+			if (!file) {
+				return false;
+			}
+
+			cells[i * width + j] = bitmap ? value != 0 : 2 * value > header[2];
+		}
+	}
+
+	return true;
+}
+
+// Steps a benchmark scene for the given number of frames and reports its cost, with the final centroid and
+// energy of every cloth as a check that runs with the same seed match. Optionally subscribes to every event
+// type and prints how many of each every step reported
+int runBenchmarkScene(const std::string &name, int frames, unsigned int seed, bool reportEvents) {
+	BenchmarkScene scene(name, seed);
+
+	if (!scene.isValid()) {
+		fprintf(stderr, "Unknown scene '%s', available:", name.c_str());
+
+		for (int i = 0; i < BenchmarkScene::getSceneNames().size(); i++) {
+			fprintf(stderr, " %s", BenchmarkScene::getSceneNames().at(i).c_str());
+		}
+
+		fprintf(stderr, "\n");
+		return 1;
+	}
+
+	SimulationEventQueue queue;
+	int eventCounts[EVENT_ROLLBACK + 1] = { 0 };
+
+	if (reportEvents) {
+		scene.setEventQueue(&queue);
+
+		for (int type = 0; type <= EVENT_ROLLBACK; type++) {
+			queue.subscribe((SimulationEventType)type, countSimulationEvent, eventCounts);
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (int frame = 0; frame < frames; frame++) {
+		scene.step(SCENE_FRAME_TIME);
+
+		if (reportEvents) {
+			std::fill(eventCounts, eventCounts + EVENT_ROLLBACK + 1, 0);
+			queue.flush();
+
+			printf("step %ld: %d collider contacts, %d cloth contacts, %d self impacts, %d pin releases, %d rollbacks\n",
+				queue.getStep() - 1, eventCounts[EVENT_COLLIDER_CONTACT], eventCounts[EVENT_CLOTH_CONTACT],
+				eventCounts[EVENT_SELF_IMPACT], eventCounts[EVENT_PIN_RELEASE], eventCounts[EVENT_ROLLBACK]);
+		}
+	}
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	vec3 centroid = vec3{ 0.0f, 0.0f, 0.0f };
+	GLfloat mass = 0.0f;
+	GLfloat energy = 0.0f;
+	int rollbacks = 0;
+
+	for (int i = 0; i < scene.getCloths().size(); i++) {
+		const ClothStatistics &statistics = scene.getCloths().at(i)->getStatistics();
+
+		rollbacks += scene.getCloths().at(i)->getRollbackCount();
+
+		centroid = centroid + statistics.centroid * statistics.mass;
+		mass += statistics.mass;
+		energy += statistics.kineticEnergy + statistics.gravitationalEnergy + statistics.elasticEnergy;
+	}
+
+	centroid = mass > 0.0f ? centroid / mass : centroid;
+
+	printf("scene %s seed %u: %d frames, %d cloths, %d particles, %.1f ms (%.3f ms/frame)\n", name.c_str(), seed,
+		frames, (int)scene.getCloths().size(), scene.getParticleCount(), elapsed, elapsed / frames);
+	printf("  centroid (%.6f, %.6f, %.6f), energy %.6g, %d rollbacks\n", centroid.x, centroid.y, centroid.z, energy, rollbacks);
+
+	return 0;
+}
+
+// Event callback tallying events by type into the int array it was subscribed with
+void countSimulationEvent(const SimulationEvent &event, void *userData) {
+	((int*)userData)[event.type]++;
+}
+
+// Time stamp counter on x86, elsewhere steady_clock nanoseconds stand in for cycles
+unsigned long long readCycleCounter() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Fastest of the timed passes after one warm up pass, per element
+double measureCyclesPerElement(const std::function<void()> &kernel, int elements) {
+	unsigned long long best = ~0ULL;
+
+	kernel();
+
+	for (int pass = 0; pass < MICROBENCH_PASSES; pass++) {
+		unsigned long long start = readCycleCounter();
+		kernel();
+		best = std::min(best, readCycleCounter() - start);
+	}
+
+	return (double)best / elements;
+}
+
+// Times each kernel as the solver writes it (array of vec3 through the out-of-line operators) against a
+// structure of arrays loop the compiler can vectorize, so codegen regressions in either show up on their own
+// Note: Springs and triangles use disjoint particles so the structure of arrays loops have no dependencies.
+// sqrtf may set errno, so loops taking a square root only vectorize when built with -fno-math-errno.
+// The checksum only keeps the results live
+int runMicroBenchmarks(int elements) {
+	std::mt19937 random(SCENE_DEFAULT_SEED);
+	int n = elements;
+
+	// Array of structures inputs, as the cloth stores them
+	std::vector<vec3> a(n), b(n), out(n);
+	std::vector<GLfloat> scalars(n);
+	std::vector<Particle> particles(3 * n);
+	std::vector<Spring> springs(n);
+	std::vector<Triangle> triangles(n);
+
+	for (int i = 0; i < n; i++) {
+		a[i] = vec3{ (GLfloat)(random() / 4294967296.0) - 0.5f, (GLfloat)(random() / 4294967296.0) - 0.5f, (GLfloat)(random() / 4294967296.0) - 0.5f };
+		b[i] = vec3{ (GLfloat)(random() / 4294967296.0) - 0.5f, (GLfloat)(random() / 4294967296.0) - 0.5f, (GLfloat)(random() / 4294967296.0) - 0.5f };
+	}
+
+	for (int i = 0; i < 3 * n; i++) {
+		vec3 position = a[i / 3] + b[(i + 1) % n] * (GLfloat)(i % 3);
+		particles[i] = Particle{ position, position, vec3{ 0.0f, 0.0f, 0.0f }, vec3{ 0.0f, 0.0f, 0.0f },
+			vec4{ 1.0f, 1.0f, 1.0f, 1.0f }, PARTICLE_MASS_KG, false };
+	}
+
+	for (int i = 0; i < n; i++) {
+		springs[i] = Spring{ &particles[3 * i], &particles[3 * i + 1], 0.1f };
+		triangles[i] = Triangle{ &particles[3 * i], &particles[3 * i + 1], &particles[3 * i + 2] };
+	}
+
+	// Structure of arrays copies of the same data
+	std::vector<GLfloat> ax(n), ay(n), az(n), bx(n), by(n), bz(n), ox(n), oy(n), oz(n);
+	std::vector<GLfloat> px(3 * n), py(3 * n), pz(3 * n), accX(3 * n), accY(3 * n), accZ(3 * n), masses(3 * n), restLengths(n);
+
+	for (int i = 0; i < n; i++) {
+		ax[i] = a[i].x; ay[i] = a[i].y; az[i] = a[i].z;
+		bx[i] = b[i].x; by[i] = b[i].y; bz[i] = b[i].z;
+		restLengths[i] = springs[i].restLength;
+	}
+
+	for (int i = 0; i < 3 * n; i++) {
+		px[i] = particles[i].position.x; py[i] = particles[i].position.y; pz[i] = particles[i].position.z;
+		accX[i] = 0.0f; accY[i] = 0.0f; accZ[i] = 0.0f;
+		masses[i] = particles[i].mass;
+	}
+
+	std::vector<GLfloat> sphereVertices;
+	vec3 sphereCenter = vec3{ 0.0f, 0.0f, 0.0f };
+	vec4 sphereColor = vec4{ 1.0f, 1.0f, 1.0f, 1.0f };
+	Sphere sphere(sphereCenter, sphereColor, 1.0f, 0.5f, sphereVertices);
+	GLfloat radiusSquared = sphere.getRadius() * sphere.getRadius();
+	vec3 windForce = vec3{ 0.0f, -2.0f, -1.5f };
+	int containedCount = 0;
+
+	const char *names[7] = { "normalize", "cross", "magnitude", "spring projection", "triangle wind", "sphere contains", "face normal" };
+	double scalarCycles[7];
+	double simdCycles[7];
+
+	scalarCycles[0] = measureCyclesPerElement([&]() {
+		for (int i = 0; i < n; i++) {
+			out[i] = normalize(a[i]);
+		}
+	}, n);
+
+	simdCycles[0] = measureCyclesPerElement([&]() {
+		#pragma omp simd
+		for (int i = 0; i < n; i++) {
+			GLfloat inverse = 1.0f / sqrtf(ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i]);
+			ox[i] = ax[i] * inverse;
+			oy[i] = ay[i] * inverse;
+			oz[i] = az[i] * inverse;
+		}
+	}, n);
+
+	scalarCycles[1] = measureCyclesPerElement([&]() {
+		for (int i = 0; i < n; i++) {
+			out[i] = cross(a[i], b[i]);
+		}
+	}, n);
+
+	simdCycles[1] = measureCyclesPerElement([&]() {
+		#pragma omp simd
+		for (int i = 0; i < n; i++) {
+			ox[i] = ay[i] * bz[i] - az[i] * by[i];
+			oy[i] = az[i] * bx[i] - ax[i] * bz[i];
+			oz[i] = ax[i] * by[i] - ay[i] * bx[i];
+		}
+	}, n);
+
+	scalarCycles[2] = measureCyclesPerElement([&]() {
+		for (int i = 0; i < n; i++) {
+			scalars[i] = magnitude(a[i]);
+		}
+	}, n);
+
+	simdCycles[2] = measureCyclesPerElement([&]() {
+		#pragma omp simd
+		for (int i = 0; i < n; i++) {
+			ox[i] = sqrtf(ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i]);
+		}
+	}, n);
+
+	// Same body as ClothSheet::satisfyConstraints
+	scalarCycles[3] = measureCyclesPerElement([&]() {
+		for (int i = 0; i < n; i++) {
+			Particle *p0 = springs[i].p0;
+			Particle *p1 = springs[i].p1;
+			vec3 vCurrentDistance = p0->position - p1->position;
+			GLfloat deltaDistance = magnitude(vCurrentDistance);
+			vec3 vConstraints = vCurrentDistance * (1.0f - springs[i].restLength / deltaDistance) * 0.5f;
+
+			if (!p0->pinned) {
+				p0->position = p0->position - vConstraints;
+			}
+
+			if (!p1->pinned) {
+				p1->position = p1->position + vConstraints;
+			}
+		}
+	}, n);
+
+	simdCycles[3] = measureCyclesPerElement([&]() {
+		#pragma omp simd
+		for (int i = 0; i < n; i++) {
+			int p0 = 3 * i;
+			int p1 = 3 * i + 1;
+			GLfloat dx = px[p0] - px[p1];
+			GLfloat dy = py[p0] - py[p1];
+			GLfloat dz = pz[p0] - pz[p1];
+			GLfloat scale = 0.5f * (1.0f - restLengths[i] / sqrtf(dx * dx + dy * dy + dz * dz));
+
+			px[p0] -= dx * scale; py[p0] -= dy * scale; pz[p0] -= dz * scale;
+			px[p1] += dx * scale; py[p1] += dy * scale; pz[p1] += dz * scale;
+		}
+	}, n);
+
+	// Same body as the wind pass of ClothSheet::accumulateForces
+	scalarCycles[4] = measureCyclesPerElement([&]() {
+		for (int i = 0; i < n; i++) {
+			Particle *v0 = triangles[i].v0;
+			Particle *v1 = triangles[i].v1;
+			Particle *v2 = triangles[i].v2;
+			vec3 vFaceNormal = normalize(cross(v1->position - v0->position, v2->position - v0->position));
+			vec3 vWindAcceleration = vFaceNormal * dot(vFaceNormal, windForce);
+
+			vWindAcceleration = vWindAcceleration / (v0->mass + v1->mass + v2->mass);
+			v0->acceleration = v0->acceleration + vWindAcceleration;
+			v1->acceleration = v1->acceleration + vWindAcceleration;
+			v2->acceleration = v2->acceleration + vWindAcceleration;
+		}
+	}, n);
+
+	simdCycles[4] = measureCyclesPerElement([&]() {
+		#pragma omp simd
+		for (int i = 0; i < n; i++) {
+			int v0 = 3 * i;
+			int v1 = 3 * i + 1;
+			int v2 = 3 * i + 2;
+			GLfloat ex = px[v1] - px[v0], ey = py[v1] - py[v0], ez = pz[v1] - pz[v0];
+			GLfloat fx = px[v2] - px[v0], fy = py[v2] - py[v0], fz = pz[v2] - pz[v0];
+			GLfloat nx = ey * fz - ez * fy;
+			GLfloat ny = ez * fx - ex * fz;
+			GLfloat nz = ex * fy - ey * fx;
+			GLfloat inverseSquared = 1.0f / (nx * nx + ny * ny + nz * nz);
+			GLfloat scale = (nx * windForce.x + ny * windForce.y + nz * windForce.z) * inverseSquared
+				/ (masses[v0] + masses[v1] + masses[v2]);
+
+			accX[v0] += nx * scale; accY[v0] += ny * scale; accZ[v0] += nz * scale;
+			accX[v1] += nx * scale; accY[v1] += ny * scale; accZ[v1] += nz * scale;
+			accX[v2] += nx * scale; accY[v2] += ny * scale; accZ[v2] += nz * scale;
+		}
+	}, n);
+
+	scalarCycles[5] = measureCyclesPerElement([&]() {
+		int count = 0;
+
+		for (int i = 0; i < n; i++) {
+			count += sphere.contains(a[i]) ? 1 : 0;
+		}
+
+		containedCount = count;
+	}, n);
+
+	simdCycles[5] = measureCyclesPerElement([&]() {
+		int count = 0;
+
+		#pragma omp simd reduction(+:count)
+		for (int i = 0; i < n; i++) {
+			GLfloat dx = ax[i] - sphereCenter.x;
+			GLfloat dy = ay[i] - sphereCenter.y;
+			GLfloat dz = az[i] - sphereCenter.z;
+
+			count += (dx * dx + dy * dy + dz * dz < radiusSquared) ? 1 : 0;
+		}
+
+		containedCount += count;
+	}, n);
+
+	// Same body as ClothSheet::computeFaceNormals
+	scalarCycles[6] = measureCyclesPerElement([&]() {
+		for (int i = 0; i < n; i++) {
+			const Triangle &tri = triangles[i];
+			out[i] = normalize(cross(tri.v1->position - tri.v0->position, tri.v2->position - tri.v0->position));
+		}
+	}, n);
+
+	simdCycles[6] = measureCyclesPerElement([&]() {
+		#pragma omp simd
+		for (int i = 0; i < n; i++) {
+			int v0 = 3 * i;
+			GLfloat ex = px[v0 + 1] - px[v0], ey = py[v0 + 1] - py[v0], ez = pz[v0 + 1] - pz[v0];
+			GLfloat fx = px[v0 + 2] - px[v0], fy = py[v0 + 2] - py[v0], fz = pz[v0 + 2] - pz[v0];
+			GLfloat nx = ey * fz - ez * fy;
+			GLfloat ny = ez * fx - ex * fz;
+			GLfloat nz = ex * fy - ey * fx;
+			GLfloat inverse = 1.0f / sqrtf(nx * nx + ny * ny + nz * nz);
+
+			ox[i] = nx * inverse;
+			oy[i] = ny * inverse;
+			oz[i] = nz * inverse;
+		}
+	}, n);
+
+	double checksum = containedCount;
+
+	for (int i = 0; i < n; i++) {
+		checksum += out[i].x + scalars[i] + ox[i] + oy[i] + oz[i] + particles[3 * i].acceleration.y + accY[3 * i] + px[3 * i];
+	}
+
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	const char *unit = "cycles";
+#else
+	const char *unit = "ns";
+#endif
+
+	printf("%d elements, fastest of %d passes, %s per element\n", n, MICROBENCH_PASSES, unit);
+	printf("%-20s %10s %10s %8s\n", "kernel", "scalar", "simd", "speedup");
+
+	for (int k = 0; k < 7; k++) {
+		printf("%-20s %10.2f %10.2f %7.2fx\n", names[k], scalarCycles[k], simdCycles[k], scalarCycles[k] / simdCycles[k]);
+	}
+
+	printf("checksum %.6g\n", checksum);
+
+	return 0;
+}
+
+// Sets every cloth in the scene to the solver setting and iteration budget
+void applySolverSetting(BenchmarkScene &scene, const SolverSetting &setting, int iterations) {
+	for (int i = 0; i < scene.getCloths().size(); i++) {
+		ClothSheet *cloth = scene.getCloths().at(i);
+
+		cloth->setIntegrator(setting.integrator);
+		cloth->setSolverOrder(setting.order, setting.warmStart);
+		cloth->setSubsteps(setting.substeps);
+		cloth->setFusedKernel(setting.fused);
+		cloth->setConstraintIterations(iterations);
+	}
+}
+
+// Applies the solver setting and iteration budget, then steps the scene for the given number of frames,
+// returning milliseconds per frame
+double measureSolverSetting(BenchmarkScene &scene, const SolverSetting &setting, int iterations, int frames) {
+	applySolverSetting(scene, setting, iterations);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (int frame = 0; frame < frames; frame++) {
+		scene.step(SCENE_FRAME_TIME);
+	}
+
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+// Steps the scene with the solver setting stopping at the evaluation tolerance, returning the constraint
+// iterations each cloth ran per frame on average
+double measureIterationsToTolerance(BenchmarkScene &scene, const SolverSetting &setting, int frames) {
+	long total = 0;
+
+	applySolverSetting(scene, setting, EVALUATION_TOLERANCE_BUDGET);
+
+	for (int i = 0; i < scene.getCloths().size(); i++) {
+		scene.getCloths().at(i)->setConstraintTolerance(EVALUATION_TOLERANCE);
+	}
+
+	for (int frame = 0; frame < frames; frame++) {
+		scene.step(SCENE_FRAME_TIME);
+
+		for (int i = 0; i < scene.getCloths().size(); i++) {
+			total += scene.getCloths().at(i)->getLastIterationCount();
+		}
+	}
+
+	return (double)total / (frames * std::max((int)scene.getCloths().size(), 1));
+}
+
+// Sets every rope in the scene to the iteration budget, then steps it for the given number of frames,
+// returning milliseconds per frame
+double measureRopeIterations(BenchmarkScene &scene, int iterations, int frames) {
+	for (int i = 0; i < scene.getRopes().size(); i++) {
+		scene.getRopes().at(i)->setIterations(iterations);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (int frame = 0; frame < frames; frame++) {
+		scene.step(SCENE_FRAME_TIME);
+	}
+
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+// Particle positions of every cloth in the scene, row by row
+void gatherPositions(BenchmarkScene &scene, std::vector<vec3> &positions) {
+	positions.clear();
+
+	for (int c = 0; c < scene.getCloths().size(); c++) {
+		std::vector< std::vector<Particle>> &particles = scene.getCloths().at(c)->getParticles();
+
+		for (int i = 0; i < particles.size(); i++) {
+			for (int j = 0; j < particles.at(i).size(); j++) {
+				positions.push_back(particles.at(i).at(j).position);
+			}
+		}
+	}
+}
+
+// Root mean square distance of the scene's particles from the same particles in a reference run
+GLfloat positionError(BenchmarkScene &scene, const std::vector<vec3> &reference) {
+	std::vector<vec3> positions;
+	double sum = 0.0;
+
+	gatherPositions(scene, positions);
+
+	for (int n = 0; n < positions.size(); n++) {
+		vec3 offset = positions.at(n) - reference.at(n);
+
+		sum += dot(offset, offset);
+	}
+
+	return (GLfloat)sqrt(sum / std::max((int)positions.size(), 1));
+}
+
+// The catenary parameter a of a chain with the given length hanging between level ends span apart, bisecting
+// 2a * sinh(span / 2a) = length since the curve's length falls as a grows
+double solveCatenaryParameter(double span, double length) {
+	double low = span / 40.0;
+	double high = 1000.0 * span;
+
+	for (int k = 0; k < 100; k++) {
+		double a = (low + high) / 2.0;
+
+		if (2.0 * a * sinh(span / (2.0 * a)) > length) {
+			low = a;
+		} else {
+			high = a;
+		}
+	}
+
+	return (low + high) / 2.0;
+}
+
+// Root mean square height of the chain's free nodes from the catenary through its pinned ends with the chain's
+// rest length, y = yEnd - a * (cosh(span / 2a) - cosh((x - xMid) / a))
+GLfloat catenaryError(RopeBatch *chain) {
+	int last = chain->getNodeCount() - 1;
+	vec3 left = chain->getNode(0, 0);
+	vec3 right = chain->getNode(0, last);
+	double span = right.x - left.x;
+	double middle = (left.x + right.x) / 2.0;
+	double end = (left.y + right.y) / 2.0;
+	double a = solveCatenaryParameter(span, chain->getRestLength(0) * last);
+	double sum = 0.0;
+
+	for (int i = 1; i < last; i++) {
+		vec3 node = chain->getNode(0, i);
+		double height = end - a * (cosh(span / (2.0 * a)) - cosh((node.x - middle) / a));
+
+		sum += (node.y - height) * (node.y - height);
+	}
+
+	return (GLfloat)sqrt(sum / std::max(last - 1, 1));
+}
+
+// Marks the results no other result beats on both cost and error
+void markParetoFront(std::vector<SolverEvaluation> &results) {
+	std::sort(results.begin(), results.end(), [](const SolverEvaluation &a, const SolverEvaluation &b) {
+		return a.frameTime < b.frameTime || (a.frameTime == b.frameTime && a.error < b.error);
+	});
+
+	GLfloat bestError = 1e30f;
+
+	for (int i = 0; i < results.size(); i++) {
+		results.at(i).pareto = results.at(i).error < bestError;
+		bestError = std::min(bestError, results.at(i).error);
+	}
+}
+
+// Runs the sag and drape scenes with every cloth solver setting and iteration budget, and the catenary chain
+// with every rope iteration budget, reporting each run's cost and error sorted by cost with the Pareto front
+// marked. The cloth scenes also report the iterations per frame each setting needs to reach a tolerance. Errors share one reference per scene so settings compare directly: the analytic curve for the
+// catenary, and the first setting run with a high iteration budget for the cloths
+int runSolverEvaluation(int frames, unsigned int seed) {
+	const std::vector<std::string> scenes = { "sag", "drape" };
+	const std::vector<int> budgets = { 5, 10, 20, 50, 100 };
+	const std::vector<int> ropeBudgets = { 1, 2, 4, 8, 16 };
+	const std::vector<SolverSetting> settings = {
+		{ "verlet", INTEGRATOR_VERLET, SOLVER_PROJECT_FIRST, false, 1, false },
+		{ "verlet fused", INTEGRATOR_VERLET, SOLVER_PROJECT_FIRST, false, 1, true },
+		{ "verlet 2 substeps", INTEGRATOR_VERLET, SOLVER_PROJECT_FIRST, false, 2, false },
+		{ "velocity", INTEGRATOR_VELOCITY, SOLVER_PROJECT_FIRST, false, 1, false },
+		{ "predict first", INTEGRATOR_VERLET, SOLVER_PREDICT_FIRST, false, 1, false },
+		{ "predict warm start", INTEGRATOR_VERLET, SOLVER_PREDICT_FIRST, true, 1, false }
+	};
+	std::vector<SolverEvaluation> results;
+	int particleCount = 0;
+
+	for (int b = 0; b < ropeBudgets.size(); b++) {
+		BenchmarkScene scene("catenary", seed);
+		SolverEvaluation result;
+
+		result.setting = "rope";
+		result.iterations = ropeBudgets.at(b);
+		result.frameTime = measureRopeIterations(scene, ropeBudgets.at(b), frames);
+		result.error = catenaryError(scene.getRopes().at(0));
+		result.pareto = false;
+		results.push_back(result);
+		particleCount = scene.getParticleCount();
+	}
+
+	markParetoFront(results);
+	printf("scene catenary seed %u: %d frames, %d nodes, errors against the analytic catenary\n", seed, frames, particleCount);
+	printEvaluation(results);
+
+	for (int s = 0; s < scenes.size(); s++) {
+		const std::string &name = scenes.at(s);
+		std::vector<vec3> referencePositions;
+
+		results.clear();
+
+		{
+			BenchmarkScene scene(name, seed);
+
+			measureSolverSetting(scene, settings.at(0), EVALUATION_REFERENCE_ITERATIONS, frames);
+			gatherPositions(scene, referencePositions);
+			particleCount = scene.getParticleCount();
+		}
+
+		for (int k = 0; k < settings.size(); k++) {
+			for (int b = 0; b < budgets.size(); b++) {
+				BenchmarkScene scene(name, seed);
+				SolverEvaluation result;
+
+				result.setting = settings.at(k).name;
+				result.iterations = budgets.at(b);
+				result.frameTime = measureSolverSetting(scene, settings.at(k), budgets.at(b), frames);
+				result.error = positionError(scene, referencePositions);
+				result.pareto = false;
+				results.push_back(result);
+			}
+		}
+
+		markParetoFront(results);
+		printf("scene %s seed %u: %d frames, %d particles, errors against %s with %d iterations\n", name.c_str(), seed,
+			frames, particleCount, settings.at(0).name, EVALUATION_REFERENCE_ITERATIONS);
+		printEvaluation(results);
+
+		printf("%-20s %10s (%.0f%% stretch, up to %d)\n", "setting", "iterations", EVALUATION_TOLERANCE * 100.0f,
+			EVALUATION_TOLERANCE_BUDGET);
+
+		for (int k = 0; k < settings.size(); k++) {
+			BenchmarkScene scene(name, seed);
+
+			printf("%-20s %10.1f\n", settings.at(k).name, measureIterationsToTolerance(scene, settings.at(k), frames));
+		}
+
+		printf("\n");
+	}
+
+	return 0;
+}
+
+// Prints one scene's results as a table followed by a blank line
+void printEvaluation(const std::vector<SolverEvaluation> &results) {
+	printf("%-20s %10s %10s %12s %7s\n", "setting", "iterations", "ms/frame", "error", "pareto");
+
+	for (int i = 0; i < results.size(); i++) {
+		const SolverEvaluation &result = results.at(i);
+
+		printf("%-20s %10d %10.3f %12.6f %7s\n", result.setting, result.iterations, result.frameTime, result.error,
+			result.pareto ? "*" : "");
+	}
+
+	printf("\n");
+}
+
+// Fits from perturbed parameters towards a run with the cloth's own material and a steady wind, comparing each
+// component of ClothGradientSolver's adjoint gradient with a central difference of the same loss
+int runGradientCheck(int steps) {
+	vec4 color = vec4{ 1.0f, 1.0f, 1.0f, 1.0f };
+	ClothSheet cloth(vec3{ -1.0f, 1.0f, -2.0f }, color, GRADIENT_CHECK_SIZE, GRADIENT_CHECK_SIZE);
+	ClothGradientSolver solver(cloth, steps);
+	SimulationParameters target = { GRADIENT_CHECK_SPRING_K, cloth.getDamping(), vec3{ 0.0f, 0.0f, -0.5f } };
+	SimulationParameters params = { target.springK * 2.0f, 1.0f - (1.0f - target.damping) * 2.0f, vec3{ 0.1f, 0.0f, -0.3f } };
+	std::vector< std::vector<vec3>> referenceFrames;
+	ParameterGradient gradient;
+	ParameterGradient unused;
+
+	solver.simulate(target, referenceFrames);
+	double loss = solver.computeGradient(params, referenceFrames, gradient);
+
+	const char *names[5] = { "springK", "damping", "wind.x", "wind.y", "wind.z" };
+	double analytic[5] = { gradient.springK, gradient.damping, gradient.windX, gradient.windY, gradient.windZ };
+	double worst = 0.0;
+
+	printf("gradient check: %dx%d sheet, %d steps, %d sweeps, loss %g\n", GRADIENT_CHECK_SIZE, GRADIENT_CHECK_SIZE,
+		steps, cloth.getConstraintIterations(), loss);
+	printf("%-10s %14s %14s %12s\n", "parameter", "adjoint", "central", "rel. error");
+
+	for (int k = 0; k < 5; k++) {
+		SimulationParameters above = params;
+		SimulationParameters below = params;
+		GLfloat *values[2] = { 0, 0 };
+		SimulationParameters *sides[2] = { &above, &below };
+
+		for (int side = 0; side < 2; side++) {
+			GLfloat *components[5] = { &sides[side]->springK, &sides[side]->damping, &sides[side]->wind.x,
+				&sides[side]->wind.y, &sides[side]->wind.z };
+			values[side] = components[k];
+		}
+
+		// Note: Parameters are single precision, so the difference is taken over the step they actually moved
+		double step = (*values[0] != 0.0f ? fabs((double)*values[0]) : 1.0) * GRADIENT_CHECK_PERTURBATION;
+
+		*values[0] = (GLfloat)(*values[0] + step);
+		*values[1] = (GLfloat)(*values[1] - step);
+
+		double central = (solver.computeGradient(above, referenceFrames, unused)
+			- solver.computeGradient(below, referenceFrames, unused)) / ((double)*values[0] - (double)*values[1]);
+		double error = fabs(analytic[k] - central) / std::max(std::max(fabs(analytic[k]), fabs(central)), 1e-30);
+
+		worst = std::max(worst, error);
+		printf("%-10s %14.6e %14.6e %12.2e\n", names[k], analytic[k], central, error);
+	}
+
+	printf("worst relative error %.2e\n", worst);
+
+	return 0;
+}
+
 void pause() {
 	paused = !paused;
 }
@@ -670,7 +2799,11 @@ Sphere::Sphere(vec3 &position, vec4 &color, GLfloat radius, GLfloat scale, const
 	this->color = color;
 	this->radius = radius * scale;
 	this->vertices = vertices;
-	velocity = vec3{ 0.05f, 0.0f, 0.0f };
+	velocity = vec3{ SPHERE_SPEED, 0.0f, 0.0f };
+	frameStartPosition = position;
+	track = 0;
+	animationTime = 0;
+	frameDeltaT = 0;
 	isMoving = true;
 }
 
@@ -718,16 +2851,52 @@ void Sphere::draw() {
 	glPopMatrix();
 }
 
-// Moves the Sphere back and forth along the x-axis between the hard coded bounds
+// Moves the Sphere along its keyframe track, or back and forth along the x-axis between the hard coded bounds
 void Sphere::move(long deltaT) {
-	if (isMoving) {
-		if (position.x < -1.5f) {
-			velocity.x = 0.05f;
-		} else if (position.x > 1.5f) {
-			velocity.x = -0.05f;
-		}
+	frameStartPosition = position;
+	frameDeltaT = deltaT;
+
+	if (!isMoving) {
+		velocity = vec3{ 0.0f, 0.0f, 0.0f };
+		frameDeltaT = 0;
+		return;
+	}
+
+	if (track != 0) {
+		animationTime += deltaT;
+		track->evaluate((GLfloat)animationTime, position, velocity);
+		return;
+	}
+
+	if (position.x < -1.5f) {
+		velocity.x = SPHERE_SPEED;
+	} else if (position.x > 1.5f) {
+		velocity.x = -SPHERE_SPEED;
+	}
+
+	position = position + velocity * (GLfloat)deltaT;
+}
 
-		position = position + velocity;
+// Places the Sphere at a fraction of the way through the last frame for solver substeps
+void Sphere::evaluateSubstep(GLfloat fraction) {
+	if (frameDeltaT == 0) {
+		return;
+	}
+
+	if (track != 0) {
+		track->evaluate(animationTime - frameDeltaT * (1.0f - fraction), position, velocity);
+	} else {
+		position = frameStartPosition + velocity * (frameDeltaT * fraction);
+	}
+}
+
+void Sphere::setKeyframeTrack(KeyframeTrack *track) {
+	this->track = track;
+	animationTime = 0;
+
+	if (track != 0 && !track->isEmpty()) {
+		track->evaluate(0.0f, position, velocity);
+		frameStartPosition = position;
 	}
 }
 
@@ -756,399 +2925,5802 @@ GLfloat Sphere::getRadius() {
 	return radius;
 }
 
+// Velocity in units per millisecond
+vec3 Sphere::getVelocity() {
+	return velocity;
+}
+
+long Sphere::getFrameDeltaT() {
+	return frameDeltaT;
+}
+
+//////////////////////////
+// class: KeyframeTrack
 //////////////////////
-// class: ClothSheet
-//////////////////
 
-ClothSheet::ClothSheet(vec3 position,  vec4 color, int width, int height) {
-	this->position = position;
-	this->color = color;
+// Loads keys from a text file with one "<timeMs> <x> <y> <z>" key per line, '#' starts a comment
+bool KeyframeTrack::loadFromFile(const char *path) {
+	std::ifstream file(path);
+	std::string line;
 
-	// Note: Not the best place to store a wind force, but can sort that out some other time
+	if (!file.is_open()) {
+		return false;
+	}
+
+	keys.clear();
+
+	while (std::getline(file, line)) {
+		std::istringstream stream(line);
+		GLfloat time;
+		vec3 keyPosition;
+
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		if (stream >> time >> keyPosition.x >> keyPosition.y >> keyPosition.z) {
+			addKey(time, keyPosition);
+		}
+	}
+
+	return !keys.empty();
+}
+
+// Inserts a key keeping the track sorted by time
+void KeyframeTrack::addKey(GLfloat time, vec3 position) {
+	std::vector<Keyframe>::iterator it = keys.begin();
+
+	while (it != keys.end() && it->time < time) {
+		++it;
+	}
+
+	keys.insert(it, Keyframe{ time, position });
+}
+
+// Evaluates position and velocity (units per millisecond) with Catmull-Rom interpolation between keys
+void KeyframeTrack::evaluate(GLfloat time, vec3 &position, vec3 &velocity) {
+	if (keys.empty()) {
+		return;
+	}
+
+	if (keys.size() == 1) {
+		position = keys.front().position;
+		velocity = vec3{ 0.0f, 0.0f, 0.0f };
+		return;
+	}
+
+	GLfloat duration = getDuration();
+	GLfloat localTime = keys.front().time + ((duration > 0.0f) ? fmod(time, duration) : 0.0f);
+
+	if (localTime < keys.front().time) {
+		localTime += duration;
+	}
+
+	int k = 0;
+	while (k < (int)keys.size() - 2 && keys.at(k + 1).time <= localTime) {
+		k++;
+	}
+
+	const Keyframe &k1 = keys.at(k);
+	const Keyframe &k2 = keys.at(k + 1);
+	const Keyframe &k0 = keys.at(std::max(k - 1, 0));
+	const Keyframe &k3 = keys.at(std::min(k + 2, (int)keys.size() - 1));
+
+	GLfloat span = std::max(k2.time - k1.time, 1e-6f);
+	GLfloat t = std::min(std::max((localTime - k1.time) / span, 0.0f), 1.0f);
+
+	// Tangents scaled to the span of this segment so uneven key spacing doesn't overshoot
+	vec3 m1 = (k2.position - k0.position) * (span / std::max(k2.time - k0.time, 1e-6f));
+	vec3 m2 = (k3.position - k1.position) * (span / std::max(k3.time - k1.time, 1e-6f));
+
+	GLfloat t2 = t * t;
+	GLfloat t3 = t2 * t;
+
+	position = k1.position * (2.0f * t3 - 3.0f * t2 + 1.0f) + m1 * (t3 - 2.0f * t2 + t)
+		+ k2.position * (-2.0f * t3 + 3.0f * t2) + m2 * (t3 - t2);
+	velocity = (k1.position * (6.0f * t2 - 6.0f * t) + m1 * (3.0f * t2 - 4.0f * t + 1.0f)
+		+ k2.position * (-6.0f * t2 + 6.0f * t) + m2 * (3.0f * t2 - 2.0f * t)) / span;
+}
+
+GLfloat KeyframeTrack::getDuration() {
+	return keys.empty() ? 0.0f : keys.back().time - keys.front().time;
+}
+
+bool KeyframeTrack::isEmpty() {
+	return keys.empty();
+}
+
+///////////////////
+// class: Capsule
+///////////////
+
+Capsule::Capsule(vec3 &start, vec3 &end, vec4 &color, GLfloat radius) {
+	this->start = start;
+	this->end = end;
+	this->color = color;
+	this->radius = radius;
+	position = (start + end) * 0.5f;
+	isMoving = false;
+}
+
+void Capsule::draw() {
+	vec3 axis = end - start;
+	GLfloat length = magnitude(axis);
+	vec3 rotationAxis = cross(vec3{ 0.0f, 0.0f, 1.0f }, axis);
+	GLfloat angle = acos(std::min(std::max(axis.z / length, -1.0f), 1.0f)) * 180.0f / PI;
+
+	GLUquadric *quadric = gluNewQuadric();
+
+	glColor4f(color.x, color.y, color.z, color.w);
+
+	// Note: GLU cylinders run along +z, so rotating +z onto the capsule axis
+	glPushMatrix();
+	glTranslatef(start.x, start.y, start.z);
+
+	if (magnitude(rotationAxis) > 1e-6f) {
+		glRotatef(angle, rotationAxis.x, rotationAxis.y, rotationAxis.z);
+	} else if (axis.z < 0.0f) {
+		glRotatef(180.0f, 1.0f, 0.0f, 0.0f);
+	}
+
+	gluSphere(quadric, radius, 16, 16);
+	gluCylinder(quadric, radius, radius, length, 16, 1);
+	glTranslatef(0.0f, 0.0f, length);
+	gluSphere(quadric, radius, 16, 16);
+	glPopMatrix();
+
+	gluDeleteQuadric(quadric);
+}
+
+// Capsules are static obstacles
+void Capsule::move(long) {
+}
+
+// Checks whether a given point lies within this Capsule
+bool Capsule::contains(vec3 point) {
+	return magnitude(point - closestPointOnSegment(point, start, end)) < radius;
+}
+
+vec3 Capsule::getPosition() {
+	return position;
+}
+
+vec3 Capsule::getStart() {
+	return start;
+}
+
+vec3 Capsule::getEnd() {
+	return end;
+}
+
+GLfloat Capsule::getRadius() {
+	return radius;
+}
+
+/////////////////////////
+// class: MeshCollider
+/////////////////////
+
+MeshCollider::MeshCollider(vec4 &color) {
+	this->color = color;
+	position = vec3{ 0.0f, 0.0f, 0.0f };
+	animationTime = 0;
+	frameDuration = 1000.0f / 30.0f;
+	maxDisplacement = 0.0f;
+	isMoving = true;
+}
+
+// Loads topology and per-frame vertex positions from a text animation cache:
+//   mesh <vertexCount> <triangleCount> <frameCount> <frameDurationMs>
+//   t <i> <j> <k>     (triangleCount lines)
+//   v <x> <y> <z>     (vertexCount lines per frame, frame after frame)
+bool MeshCollider::loadAnimationCache(const char *path) {
+	std::ifstream file(path);
+	std::string line;
+	std::string tag;
+	int vertexCount = 0;
+	int triangleCount = 0;
+	int frameCount = 0;
+	GLfloat duration = 0.0f;
+
+	std::vector<int> indices;
+	std::vector< std::vector<vec3>> cache;
+
+	if (!file.is_open()) {
+		return false;
+	}
+
+	while (std::getline(file, line)) {
+		std::istringstream stream(line);
+
+		if (!(stream >> tag) || tag[0] == '#') {
+			continue;
+		}
+
+		if (tag == "mesh") {
+			if (!(stream >> vertexCount >> triangleCount >> frameCount >> duration) || vertexCount <= 0
+					|| triangleCount < 0 || frameCount <= 0 || duration <= 0.0f) {
+				return false;
+			}
+
+			cache = std::vector< std::vector<vec3>>(frameCount);
+		} else if (tag == "t") {
+			int i, j, k;
+
+			if (!(stream >> i >> j >> k)) {
+				return false;
+			}
+
+			indices.push_back(i);
+			indices.push_back(j);
+			indices.push_back(k);
+		} else if (tag == "v") {
+			vec3 vertex;
+
+			if (!(stream >> vertex.x >> vertex.y >> vertex.z)) {
+				return false;
+			}
+
+			// Note: Filling frames in order, each one holds vertexCount positions
+			for (int f = 0; f < frameCount; f++) {
+				if (cache.at(f).size() < vertexCount) {
+					cache.at(f).push_back(vertex);
+					break;
+				}
+			}
+		}
+	}
+
+	// Rejecting a missing mesh line, short frames and triangles indexing past the vertices
+	if (frameCount <= 0 || indices.size() != triangleCount * 3 || cache.back().size() != vertexCount) {
+		return false;
+	}
+
+	for (int k = 0; k < indices.size(); k++) {
+		if (indices.at(k) < 0 || indices.at(k) >= vertexCount) {
+			return false;
+		}
+	}
+
+	setAnimationCache(indices, cache, duration);
+
+	return true;
+}
+
+void MeshCollider::setAnimationCache(const std::vector<int> &indices, const std::vector< std::vector<vec3>> &frames, GLfloat frameDuration) {
+	this->frames = frames;
+	this->frameDuration = frameDuration;
+	animationTime = 0;
+
+	setTopology((int)frames.front().size(), indices);
+}
+
+// Creates mesh vertices at the first frame and builds the BVH over them once
+void MeshCollider::setTopology(int vertexCount, const std::vector<int> &indices) {
+	meshVertices = std::vector<Particle>(vertexCount);
+
+	for (int i = 0; i < vertexCount; i++) {
+		vec3 vertex = frames.front().at(i);
+		meshVertices.at(i) = Particle{ vertex, vertex, vec3{ 0.0f, 0.0f, 0.0f }, vec3{ 0.0f, 0.0f, 0.0f }, color, 0.0f, true };
+	}
+
+	meshTriangles = std::vector<Triangle>();
+
+	for (int k = 0; k + 2 < indices.size(); k += 3) {
+		meshTriangles.push_back(Triangle{ &meshVertices.at(indices.at(k)), &meshVertices.at(indices.at(k + 1)),
+			&meshVertices.at(indices.at(k + 2)) });
+	}
+
+	bvh.build(&meshTriangles, CLOTH_THICKNESS, true);
+}
+
+void MeshCollider::draw() {
+	vec3 normal;
+
+	glPushMatrix();
+	glBegin(GL_TRIANGLES);
+	glColor4f(color.x, color.y, color.z, color.w);
+
+	for (int k = 0; k < meshTriangles.size(); k++) {
+		const Triangle &tri = meshTriangles.at(k);
+
+		normal = normalize(cross(tri.v1->position - tri.v0->position, tri.v2->position - tri.v0->position));
+		glNormal3f(normal.x, normal.y, normal.z);
+
+		glVertex3f(tri.v0->position.x, tri.v0->position.y, tri.v0->position.z);
+		glVertex3f(tri.v1->position.x, tri.v1->position.y, tri.v1->position.z);
+		glVertex3f(tri.v2->position.x, tri.v2->position.y, tri.v2->position.z);
+	}
+
+	glEnd();
+	glPopMatrix();
+}
+
+// Advances the animation, blending between cached frames, and refits the BVH to the deformed surface
+void MeshCollider::move(long deltaT) {
+	if (!isMoving || frames.empty()) {
+		return;
+	}
+
+	animationTime += deltaT;
+
+	GLfloat framePosition = fmod(animationTime / frameDuration, (GLfloat)frames.size());
+	int frame = (int)framePosition;
+	int nextFrame = (frame + 1) % frames.size();
+	GLfloat alpha = framePosition - frame;
+
+	const std::vector<vec3> &from = frames.at(frame);
+	const std::vector<vec3> &to = frames.at(nextFrame);
+
+	GLfloat displacement = 0.0f;
+
+	#pragma omp parallel for schedule(static) reduction(max:displacement)
+	for (int i = 0; i < (int)meshVertices.size(); i++) {
+		meshVertices[i].prevPosition = meshVertices[i].position;
+		meshVertices[i].position = from[i] + (to[i] - from[i]) * alpha;
+		displacement = std::max(displacement, magnitude(meshVertices[i].position - meshVertices[i].prevPosition));
+	}
+
+	maxDisplacement = displacement;
+
+	bvh.update();
+
+	AABB meshBounds = bvh.getBounds();
+	position = (meshBounds.min + meshBounds.max) * 0.5f;
+}
+
+// Finds the closest surface point within maxDistance of each point, triangle is -1 where there is none
+void MeshCollider::closestPoints(const std::vector<vec3> &points, GLfloat maxDistance, std::vector<MeshContact> &contacts) {
+	contacts.resize(points.size());
+	vec3 vReach = vec3{ maxDistance, maxDistance, maxDistance };
+
+	#pragma omp parallel for schedule(dynamic, 256)
+	for (int i = 0; i < (int)points.size(); i++) {
+		std::vector<int> candidates;
+		MeshContact best = MeshContact{ -1, points[i], vec3{ 0.0f, 0.0f, 0.0f }, maxDistance };
+		GLfloat bestDistance = maxDistance;
+
+		bvh.queryAABB(AABB{ points[i] - vReach, points[i] + vReach }, candidates);
+
+		for (int k = 0; k < candidates.size(); k++) {
+			const Triangle &tri = meshTriangles[candidates[k]];
+			vec3 barycentric;
+			vec3 closest = closestPointOnTriangle(points[i], tri.v0->position, tri.v1->position, tri.v2->position, barycentric);
+			GLfloat distance = magnitude(points[i] - closest);
+
+			if (distance < bestDistance) {
+				vec3 normal = normalize(cross(tri.v1->position - tri.v0->position, tri.v2->position - tri.v0->position));
+
+				bestDistance = distance;
+				best = MeshContact{ candidates[k], closest, normal, dot(points[i] - closest, normal) };
+			}
+		}
+
+		contacts[i] = best;
+	}
+}
+
+vec3 MeshCollider::getPosition() {
+	return position;
+}
+
+AABB MeshCollider::getBounds() {
+	return bvh.getBounds();
+}
+
+TriangleBVH &MeshCollider::getBVH() {
+	return bvh;
+}
+
+// Largest distance any vertex moved during the last animation update
+GLfloat MeshCollider::getMaxDisplacement() {
+	return maxDisplacement;
+}
+
+////////////////////////
+// class: EntityWorld
+////////////////////
+
+Entity EntityWorld::createEntity(vec3 position) {
+	positionX.push_back(position.x);
+	positionY.push_back(position.y);
+	positionZ.push_back(position.z);
+
+	return (Entity)positionX.size() - 1;
+}
+
+// Bounces the entity back and forth between the faces of bounds, velocity is in units per millisecond
+void EntityWorld::addBounceMotion(Entity entity, vec3 velocity, AABB bounds) {
+	bounceMotions.entities.push_back(entity);
+	bounceMotions.velocityX.push_back(velocity.x);
+	bounceMotions.velocityY.push_back(velocity.y);
+	bounceMotions.velocityZ.push_back(velocity.z);
+	bounceMotions.minX.push_back(bounds.min.x);
+	bounceMotions.minY.push_back(bounds.min.y);
+	bounceMotions.minZ.push_back(bounds.min.z);
+	bounceMotions.maxX.push_back(bounds.max.x);
+	bounceMotions.maxY.push_back(bounds.max.y);
+	bounceMotions.maxZ.push_back(bounds.max.z);
+}
+
+void EntityWorld::addKeyframeMotion(Entity entity, KeyframeTrack *track) {
+	keyframeMotions.entities.push_back(entity);
+	keyframeMotions.tracks.push_back(track);
+	keyframeMotions.animationTimes.push_back(0);
+}
+
+void EntityWorld::addSphereCollider(Entity entity, GLfloat radius) {
+	sphereColliders.entities.push_back(entity);
+	sphereColliders.radii.push_back(radius);
+	sphereColliders.centerX.push_back(positionX[entity]);
+	sphereColliders.centerY.push_back(positionY[entity]);
+	sphereColliders.centerZ.push_back(positionZ[entity]);
+}
+
+// Start and end are world positions at the time of adding, they follow the entity afterwards
+void EntityWorld::addCapsuleCollider(Entity entity, vec3 start, vec3 end, GLfloat radius) {
+	vec3 position = getPosition(entity);
+
+	capsuleColliders.entities.push_back(entity);
+	capsuleColliders.startOffsets.push_back(start - position);
+	capsuleColliders.endOffsets.push_back(end - position);
+	capsuleColliders.radii.push_back(radius);
+	capsuleColliders.starts.push_back(start);
+	capsuleColliders.ends.push_back(end);
+}
+
+// Registers a triangle list shared by any number of renderables, returning its index
+int EntityWorld::addMesh(const std::vector<GLfloat> &vertices) {
+	std::vector<vec3> normals;
+
+	for (int j = 0; j + 8 < vertices.size(); j += 9) {
+		vec3 p1 = { vertices.at(j), vertices.at(j + 1), vertices.at(j + 2) };
+		vec3 p2 = { vertices.at(j + 3), vertices.at(j + 4), vertices.at(j + 5) };
+		vec3 p3 = { vertices.at(j + 6), vertices.at(j + 7), vertices.at(j + 8) };
+
+		normals.push_back(normalize(cross(p2 - p1, p3 - p1)));
+	}
+
+	meshVertices.push_back(vertices);
+	meshNormals.push_back(normals);
+
+	return (int)meshVertices.size() - 1;
+}
+
+void EntityWorld::addRenderable(Entity entity, int mesh, vec4 color, GLfloat scale) {
+	renderables.entities.push_back(entity);
+	renderables.meshes.push_back(mesh);
+	renderables.colors.push_back(color);
+	renderables.scales.push_back(scale);
+}
+
+// Wraps an existing actor as an entity, its transform follows the actor's position
+Entity EntityWorld::addActor(Actor *actor) {
+	Entity entity = createEntity(actor->getPosition());
+
+	actorComponents.entities.push_back(entity);
+	actorComponents.actors.push_back(actor);
+
+	return entity;
+}
+
+// Runs the motion systems, then picks up wrapped actor positions, then refreshes collider shapes
+void EntityWorld::update(long deltaT) {
+	updateBounceMotion(deltaT);
+	updateKeyframeMotion(deltaT);
+	updateActors();
+	updateColliders();
+}
+
+void EntityWorld::updateBounceMotion(long deltaT) {
+	int count = (int)bounceMotions.entities.size();
+
+	if (count == 0) {
+		return;
+	}
+
+	const Entity *entities = &bounceMotions.entities[0];
+	GLfloat *x = &positionX[0];
+	GLfloat *y = &positionY[0];
+	GLfloat *z = &positionZ[0];
+	GLfloat *vx = &bounceMotions.velocityX[0];
+	GLfloat *vy = &bounceMotions.velocityY[0];
+	GLfloat *vz = &bounceMotions.velocityZ[0];
+	GLfloat dt = (GLfloat)deltaT;
+
+	// Note: Each entity owns its slot, so the gather/scatter through entities vectorizes without conflicts
+	#pragma omp simd
+	for (int k = 0; k < count; k++) {
+		Entity e = entities[k];
+
+		vx[k] = (x[e] < bounceMotions.minX[k]) ? fabs(vx[k]) : ((x[e] > bounceMotions.maxX[k]) ? -fabs(vx[k]) : vx[k]);
+		vy[k] = (y[e] < bounceMotions.minY[k]) ? fabs(vy[k]) : ((y[e] > bounceMotions.maxY[k]) ? -fabs(vy[k]) : vy[k]);
+		vz[k] = (z[e] < bounceMotions.minZ[k]) ? fabs(vz[k]) : ((z[e] > bounceMotions.maxZ[k]) ? -fabs(vz[k]) : vz[k]);
+
+		x[e] += vx[k] * dt;
+		y[e] += vy[k] * dt;
+		z[e] += vz[k] * dt;
+	}
+}
+
+void EntityWorld::updateKeyframeMotion(long deltaT) {
+	for (int k = 0; k < keyframeMotions.entities.size(); k++) {
+		Entity e = keyframeMotions.entities[k];
+		vec3 position;
+		vec3 velocity;
+
+		keyframeMotions.animationTimes[k] += deltaT;
+
+		// Entities on a track without keys stay where they are
+		if (keyframeMotions.tracks[k]->isEmpty()) {
+			continue;
+		}
+
+		keyframeMotions.tracks[k]->evaluate((GLfloat)keyframeMotions.animationTimes[k], position, velocity);
+
+		positionX[e] = position.x;
+		positionY[e] = position.y;
+		positionZ[e] = position.z;
+	}
+}
+
+void EntityWorld::updateActors() {
+	for (int k = 0; k < actorComponents.entities.size(); k++) {
+		Entity e = actorComponents.entities[k];
+		vec3 position = actorComponents.actors[k]->getPosition();
+		positionX[e] = position.x;
+		positionY[e] = position.y;
+		positionZ[e] = position.z;
+	}
+}
+
+void EntityWorld::updateColliders() {
+	for (int k = 0; k < sphereColliders.entities.size(); k++) {
+		Entity e = sphereColliders.entities[k];
+
+		sphereColliders.centerX[k] = positionX[e];
+		sphereColliders.centerY[k] = positionY[e];
+		sphereColliders.centerZ[k] = positionZ[e];
+	}
+
+	for (int k = 0; k < capsuleColliders.entities.size(); k++) {
+		vec3 position = getPosition(capsuleColliders.entities[k]);
+
+		capsuleColliders.starts[k] = position + capsuleColliders.startOffsets[k];
+		capsuleColliders.ends[k] = position + capsuleColliders.endOffsets[k];
+	}
+}
+
+// Draws renderables in packed order, then the wrapped actors
+void EntityWorld::draw() {
+	for (int k = 0; k < renderables.entities.size(); k++) {
+		Entity e = renderables.entities[k];
+		const std::vector<GLfloat> &vertices = meshVertices[renderables.meshes[k]];
+		const std::vector<vec3> &normals = meshNormals[renderables.meshes[k]];
+		vec4 color = renderables.colors[k];
+
+		glPushMatrix();
+		glTranslatef(positionX[e], positionY[e], positionZ[e]);
+		glScalef(renderables.scales[k], renderables.scales[k], renderables.scales[k]);
+		glColor4f(color.x, color.y, color.z, color.w);
+
+		glBegin(GL_TRIANGLES);
+
+		for (int j = 0; j + 8 < vertices.size(); j += 9) {
+			const vec3 &normal = normals[j / 9];
+
+			glNormal3f(normal.x, normal.y, normal.z);
+			glVertex3f(vertices[j], vertices[j + 1], vertices[j + 2]);
+			glVertex3f(vertices[j + 3], vertices[j + 4], vertices[j + 5]);
+			glVertex3f(vertices[j + 6], vertices[j + 7], vertices[j + 8]);
+		}
+
+		glEnd();
+		glPopMatrix();
+	}
+
+	for (int k = 0; k < actorComponents.actors.size(); k++) {
+		actorComponents.actors[k]->draw();
+	}
+}
+
+// Projects active particles out of every sphere and capsule collider overlapping their tile, returns true if any moved
+// Note: Colliders are culled against the whole region and then per tile, so particles only loop over nearby shapes
+bool EntityWorld::collideParticles(std::vector< std::vector<Particle>> &particles, const std::vector<GLfloat> &particleMask,
+		const std::vector<ClothTile> &tiles, const AABB &region) {
+	candidates.clear();
+
+	for (int k = 0; k < sphereColliders.entities.size(); k++) {
+		vec3 center = vec3{ sphereColliders.centerX[k], sphereColliders.centerY[k], sphereColliders.centerZ[k] };
+		vec3 vReach = vec3{ sphereColliders.radii[k], sphereColliders.radii[k], sphereColliders.radii[k] };
+
+		if (overlaps(AABB{ center - vReach, center + vReach }, region)) {
+			candidates.push_back(k);
+		}
+	}
+
+	int sphereCount = (int)candidates.size();
+
+	for (int k = 0; k < capsuleColliders.entities.size(); k++) {
+		vec3 vReach = vec3{ capsuleColliders.radii[k], capsuleColliders.radii[k], capsuleColliders.radii[k] };
+		AABB capsuleBounds = expand(AABB{ capsuleColliders.starts[k], capsuleColliders.starts[k] }, capsuleColliders.ends[k]);
+
+		if (overlaps(AABB{ capsuleBounds.min - vReach, capsuleBounds.max + vReach }, region)) {
+			candidates.push_back(k);
+		}
+	}
+
+	if (candidates.empty()) {
+		return false;
+	}
+
+	bool moved = false;
+	int rows = (int)particles.size();
+	int cols = (int)particles.at(0).size();
+
+	for (int t = 0; t < tiles.size(); t++) {
+		const ClothTile &tile = tiles.at(t);
+		int tileSphereCount = 0;
+
+		tileCandidates.clear();
+
+		for (int c = 0; c < candidates.size(); c++) {
+			int k = candidates[c];
+			vec3 start = (c < sphereCount) ? vec3{ sphereColliders.centerX[k], sphereColliders.centerY[k], sphereColliders.centerZ[k] } : capsuleColliders.starts[k];
+			vec3 end = (c < sphereCount) ? start : capsuleColliders.ends[k];
+			GLfloat radius = (c < sphereCount) ? sphereColliders.radii[k] : capsuleColliders.radii[k];
+			vec3 vReach = vec3{ radius, radius, radius };
+			AABB shapeBounds = expand(AABB{ start, start }, end);
+
+			if (overlaps(AABB{ shapeBounds.min - vReach, shapeBounds.max + vReach }, tile.bounds)) {
+				tileCandidates.push_back(k);
+				tileSphereCount += (c < sphereCount) ? 1 : 0;
+			}
+		}
+
+		if (tileCandidates.empty()) {
+			continue;
+		}
+
+		// Note: Tiles on the last row/col also own the particles on the sheet edge
+		int rowEnd = (tile.rowEnd == rows - 1) ? tile.rowEnd + 1 : tile.rowEnd;
+		int colEnd = (tile.colEnd == cols - 1) ? tile.colEnd + 1 : tile.colEnd;
+
+		moved = collideTileParticles(particles, particleMask, tile.rowBegin, rowEnd, tile.colBegin, colEnd, tileSphereCount) || moved;
+	}
+
+	return moved;
+}
+
+bool EntityWorld::collideTileParticles(std::vector< std::vector<Particle>> &particles, const std::vector<GLfloat> &particleMask,
+		int rowBegin, int rowEnd, int colBegin, int colEnd, int sphereCount) {
+	bool moved = false;
+	int cols = (int)particles.at(0).size();
+
+	for (int i = rowBegin; i < rowEnd; i++) {
+		for (int j = colBegin; j < colEnd; j++) {
+			Particle *particle = &particles[i][j];
+
+			if (particleMask[i * cols + j] == 0.0f || particle->pinned) {
+				continue;
+			}
+
+			for (int c = 0; c < sphereCount; c++) {
+				int k = tileCandidates[c];
+				vec3 center = vec3{ sphereColliders.centerX[k], sphereColliders.centerY[k], sphereColliders.centerZ[k] };
+				vec3 vDistance = particle->position - center;
+				GLfloat radius = sphereColliders.radii[k];
+
+				if (dot(vDistance, vDistance) < radius * radius) {
+					particle->position = center + normalize(vDistance) * (radius * (1.0f + COLLIDER_SURFACE_OFFSET));
+					moved = true;
+				}
+			}
+
+			for (int c = sphereCount; c < tileCandidates.size(); c++) {
+				int k = tileCandidates[c];
+				vec3 vAxisPoint = closestPointOnSegment(particle->position, capsuleColliders.starts[k], capsuleColliders.ends[k]);
+				vec3 vDistance = particle->position - vAxisPoint;
+				GLfloat radius = capsuleColliders.radii[k];
+
+				if (dot(vDistance, vDistance) < radius * radius) {
+					particle->position = vAxisPoint + normalize(vDistance) * (radius * (1.0f + COLLIDER_SURFACE_OFFSET));
+					moved = true;
+				}
+			}
+		}
+	}
+
+	return moved;
+}
+
+// Checks whether a point lies within any sphere or capsule collider
+bool EntityWorld::contains(vec3 point) {
+	for (int k = 0; k < sphereColliders.entities.size(); k++) {
+		vec3 vDistance = point - vec3{ sphereColliders.centerX[k], sphereColliders.centerY[k], sphereColliders.centerZ[k] };
+
+		if (dot(vDistance, vDistance) < sphereColliders.radii[k] * sphereColliders.radii[k]) {
+			return true;
+		}
+	}
+
+	for (int k = 0; k < capsuleColliders.entities.size(); k++) {
+		if (magnitude(point - closestPointOnSegment(point, capsuleColliders.starts[k], capsuleColliders.ends[k])) < capsuleColliders.radii[k]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+vec3 EntityWorld::getPosition(Entity entity) {
+	return vec3{ positionX[entity], positionY[entity], positionZ[entity] };
+}
+
+int EntityWorld::getEntityCount() {
+	return (int)positionX.size();
+}
+
+//////////////////////
+// class: ClothSheet
+//////////////////
+
+// Note: A settled sheet starts at its draped rest state instead of flat, see settle()
+ClothSheet::ClothSheet(vec3 position,  vec4 color, int width, int height, bool settled) {
+	this->position = position;
+	this->color = color;
+
+	initialize(width, height, std::vector<char>(), settled);
+}
+
+// Builds a shaped panel from an occupancy mask of the (width - 1) rows by (height - 1) columns of grid cells
+// Note: Particles keep their grid slots so the stencil loops stay regular, those touching no occupied cell
+// are left pinned and never simulated, while springs, triangles and tiles only exist inside the mask
+ClothSheet::ClothSheet(vec3 position, vec4 color, int width, int height, const std::vector<char> &occupancy, bool settled) {
+	this->position = position;
+	this->color = color;
+
+	initialize(width, height, occupancy, settled);
+}
+
+void ClothSheet::initialize(int width, int height, const std::vector<char> &occupancy, bool settled) {
+	// Note: Not the best place to store a wind force, but can sort that out some other time
 	vWindForce = vec3{ 0.0f, 0.0f, 0.0f };
+	vGrabTarget = vec3{ 0.0f, 0.0f, 0.0f };
+	grabDepth = 0.0f;
+	nextAttachmentId = 0;
+	animationTime = 0;
+	selfCollisionEnabled = false;
+	substeps = 1;
+	springK = springConstK;
+	damping = damperConstD;
+	integratorMode = INTEGRATOR_VERLET;
+	timeStep = DEFAULT_TIME_STEP;
+	relativeDampingRate = RELATIVE_DAMPING_RATE;
+	solverOrder = SOLVER_PROJECT_FIRST;
+	warmStart = false;
+	constraintTolerance = 0.0f;
+	constraintIterations = CONSTRAINT_ITERATIONS;
+	islandSolved = false;
+	watchdogEnabled = true;
+	checkpointTime = 0;
+	rollbackCount = 0;
+	lastIterationCount = 0;
+	windOcclusion = 0;
+	events = 0;
+	fusedKernel = false;
+	boundsStale = false;
+	particleSumsDirty = true;
+	springSumsDirty = true;
+	faceNormalsDirty = true;
+	contactMode = CONTACT_PROJECT;
+
+	generateMasks(width, height, occupancy);
+	generateParticleSheet((GLfloat)width, (GLfloat)height);
+	generateTriangles();
+	generateTiles();
+	updateTileBounds();
+	bvh.build(&triangles, CLOTH_THICKNESS, true);
+
+	potentialColliders = std::vector<Sphere*>();
+
+	pinnedParticles = std::queue<Particle*>();
+
+	pinTopCorners();
+
+	if (settled) {
+		settle();
+	}
+}
+
+// Expands the cell occupancy (all occupied if empty) into cell and particle weights of 1 or 0
+void ClothSheet::generateMasks(int rows, int cols, const std::vector<char> &occupancy) {
+	cellMask = std::vector<GLfloat>((rows - 1) * (cols - 1), 1.0f);
+	particleMask = std::vector<GLfloat>(rows * cols, occupancy.empty() ? 1.0f : 0.0f);
+
+	if (occupancy.empty()) {
+		return;
+	}
+
+	for (int i = 0; i < rows - 1; i++) {
+		for (int j = 0; j < cols - 1; j++) {
+			int cell = i * (cols - 1) + j;
+
+			cellMask[cell] = (cell < occupancy.size() && occupancy[cell]) ? 1.0f : 0.0f;
+
+			// A particle is simulated if any of its cells is
+			particleMask[i * cols + j] = std::max(particleMask[i * cols + j], cellMask[cell]);
+			particleMask[i * cols + j + 1] = std::max(particleMask[i * cols + j + 1], cellMask[cell]);
+			particleMask[(i + 1) * cols + j] = std::max(particleMask[(i + 1) * cols + j], cellMask[cell]);
+			particleMask[(i + 1) * cols + j + 1] = std::max(particleMask[(i + 1) * cols + j + 1], cellMask[cell]);
+		}
+	}
+}
+
+// Pins the three leftmost and three rightmost particles of the top row the mask reaches
+void ClothSheet::pinTopCorners() {
+	int cols = (int)particles.at(0).size();
+	int row = 0;
+
+	while (row < particles.size() - 1 && std::find(particleMask.begin() + row * cols,
+			particleMask.begin() + (row + 1) * cols, 1.0f) == particleMask.begin() + (row + 1) * cols) {
+		row++;
+	}
+
+	std::vector<int> occupied;
+	for (int j = 0; j < cols; j++) {
+		if (particleMask[row * cols + j] != 0.0f) {
+			occupied.push_back(j);
+		}
+	}
+
+	// Pinning top left three particles
+	for (int k = 0; k < 3 && k < occupied.size(); k++) {
+		particles.at(row).at(occupied[k]).pinned = true;
+		pinnedParticles.push(&particles.at(row).at(occupied[k]));
+	}
+
+	// Pinning top right three particles
+	for (int k = (int)occupied.size() - 1; k >= 3 && k >= (int)occupied.size() - 3; k--) {
+		particles.at(row).at(occupied[k]).pinned = true;
+		pinnedParticles.push(&particles.at(row).at(occupied[k]));
+	}
+}
+
+// Moves the cloth straight to its static equilibrium under gravity with the current pins, returning the
+// Newton iterations used. The cloth is left at rest, so a simulation can start from a settled drape
+int ClothSheet::settle() {
+	ClothEquilibriumSolver solver(*this);
+	int iterations = solver.solve(SETTLE_ITERATIONS);
+
+	solver.apply();
+
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < particles.at(i).size(); j++) {
+			Particle &particle = particles.at(i).at(j);
+
+			particle.prevPosition = particle.position;
+			particle.velocity = vec3{ 0.0f, 0.0f, 0.0f };
+		}
+	}
+
+	constraintCorrections.clear();
+	updateTileBounds();
+	bvh.update();
+	invalidateDerived();
+
+	return iterations;
+}
+
+// Draws cloth using particle positions for vertices
+void ClothSheet::draw() {
+	const std::vector<vec3> &normals = getFaceNormals();
+	vec3 normal;
+	vec3 p1;
+	vec3 p2;
+	vec3 p3;
+
+	// Applying transformations
+	glPushMatrix();
+
+	// Drawing current actor
+	glBegin(GL_TRIANGLES);
+
+	// Drawing object
+	for (int i = 0; i < particles.size() - 1; i++) {
+		for (int j = 0; j < particles.at(i).size() - 1; j++) {
+			int triangle = triangleIndex(i, j);
+
+			if (triangle < 0) {
+				continue;
+			}
+
+			//glColor4f(color.x, color.y, color.z, color.w);
+			glColor4f(particles.at(i).at(j).color.x, particles.at(i).at(j).color.y, 
+						particles.at(i).at(j).color.z, particles.at(i).at(j).color.w);
+
+			// Upper tri normal for lighting
+			p1 = particles.at(i + 1).at(j).position;
+			p2 = particles.at(i).at(j).position;
+			p3 = particles.at(i).at(j + 1).position;
+
+			normal = normals[triangle];
+			glNormal3f(normal.x, normal.y, normal.z);
+
+			// Specifying upper triangle vertices
+			glVertex3f(p1.x, p1.y, p1.z);
+			glVertex3f(p2.x, p2.y, p2.z);
+			glVertex3f(p3.x, p3.y, p3.z);
+
+			// Lower tri normal for lighting
+			p1 = particles.at(i + 1).at(j).position;
+			p2 = particles.at(i).at(j + 1).position;
+			p3 = particles.at(i + 1).at(j + 1).position;
+
+			normal = normals[triangle + 1];
+			glNormal3f(normal.x, normal.y, normal.z);
+
+			// Specifying lower triangle vertices
+			glVertex3f(p1.x, p1.y, p1.z);
+			glVertex3f(p2.x, p2.y, p2.z);
+			glVertex3f(p3.x, p3.y, p3.z);
+		}
+	}
+
+	// Done drawing current actor
+	glEnd();
+	glPopMatrix();
+}
+
+// Moves particles one step, keeping the state from the start of the step so a step that leaves any particle
+// state non-finite can be rolled back and retried with twice the substeps and iterations
+// Note: A step that still fails after the last retry is rolled back and the cloth held where it was, so a
+// single bad step costs one frame of motion rather than the rest of the run
+void ClothSheet::move(long deltaT) {
+	if (!watchdogEnabled) {
+		advance(deltaT);
+		return;
+	}
+
+	// Rolling back state broken outside move() since the last step, by cloth contact or seams
+	if (countNonFinite() > 0 && !checkpointParticles.empty()) {
+		int particle = findNonFinite();
+
+		restoreCheckpoint();
+		reportRollback("after the last step", particle, 0);
+	}
+
+	saveCheckpoint();
+	advance(deltaT);
+
+	int baseSubsteps = substeps;
+	int baseIterations = constraintIterations;
+	int attempt = 0;
+
+	while (countNonFinite() > 0) {
+		int particle = findNonFinite();
+
+		// Note: The checkpoint holds displacements per base substep
+		restoreCheckpoint();
+		substeps = baseSubsteps;
+		constraintIterations = baseIterations;
+
+		if (++attempt > WATCHDOG_MAX_RETRIES) {
+			reportRollback("on every retry, holding the cloth", particle, attempt - 1);
+			break;
+		}
+
+		rescaleSubsteps(baseSubsteps << attempt);
+		constraintIterations = baseIterations << attempt;
+		reportRollback("during the step, retrying", particle, attempt);
+		advance(deltaT);
+	}
+
+	rescaleSubsteps(baseSubsteps);
+	constraintIterations = baseIterations;
+}
+
+// Moves particles using Verlet integration, split into substeps that see colliders at interpolated positions
+void ClothSheet::advance(long deltaT) {
+	// Note: Using a fixed timestep for this simulation
+	GLfloat stepLength = timeStep / substeps;
+	GLfloat timeTSquared = stepLength * stepLength;
+	int iterations = std::max(constraintIterations / substeps, 1);
+
+	animationTime += deltaT;
+	lastIterationCount = 0;
+	boundsStale = false;
+	accumulateForces();
+
+	for (int step = 1; step <= substeps; step++) {
+		GLfloat fraction = (GLfloat)step / substeps;
+
+		for (int i = 0; i < potentialColliders.size(); i++) {
+			potentialColliders.at(i)->evaluateSubstep(fraction);
+		}
+
+		evaluateAttachmentTargets(animationTime - deltaT * (1.0f - fraction));
+
+		// Each substep's barrier solve starts from where the last one left particles
+		if (contactMode == CONTACT_BARRIER) {
+			int cols = (int)particles.at(0).size();
+			barrierStartPositions.resize(particles.size() * cols);
+
+			for (int i = 0; i < particles.size(); i++) {
+				for (int j = 0; j < cols; j++) {
+					barrierStartPositions[i * cols + j] = particles[i][j].position;
+				}
+			}
+		}
+
+		if (solverOrder == SOLVER_PREDICT_FIRST) {
+			predictAndProject(iterations, stepLength, timeTSquared);
+		} else if (usesFusedKernel()) {
+			lastIterationCount += satisfyConstraints(iterations);
+			fusedStep(timeTSquared, step == 1, step == substeps);
+		} else {
+			lastIterationCount += satisfyConstraints(iterations);
+
+			if (integratorMode == INTEGRATOR_VELOCITY) {
+				integrateVelocity(stepLength);
+			} else {
+				integrate(timeTSquared);
+			}
+		}
+
+		// Note: Refitting before collision so triangle contact sees this step's positions
+		bvh.update();
+
+		handleCollision();
+
+		if (selfCollisionEnabled) {
+			bvh.refit();
+			handleSelfCollision();
+		}
+	}
+
+	// Keeping tile bounds in sync with the new particle positions, unless the fused pass gathered them and
+	// nothing has moved particles since
+	if (!usesFusedKernel() || boundsStale) {
+		updateTileBounds();
+	}
+
+	invalidateDerived();
+}
+
+// Particles with a non-finite position, previous position, velocity or acceleration
+// Note: Summing the components carries any NaN or infinity through, and x - x is only zero when x is finite.
+// Comparing instead of calling isfinite keeps the inner loop branch-free so it vectorizes
+int ClothSheet::countNonFinite() {
+	int nonFinite = 0;
+
+	#pragma omp parallel for reduction(+:nonFinite)
+	for (int i = 0; i < particles.size(); i++) {
+		const Particle *row = particles[i].data();
+		int cols = (int)particles[i].size();
+
+		#pragma omp simd reduction(+:nonFinite)
+		for (int j = 0; j < cols; j++) {
+			GLfloat sum = row[j].position.x + row[j].position.y + row[j].position.z
+				+ row[j].prevPosition.x + row[j].prevPosition.y + row[j].prevPosition.z
+				+ row[j].velocity.x + row[j].velocity.y + row[j].velocity.z
+				+ row[j].acceleration.x + row[j].acceleration.y + row[j].acceleration.z;
+
+			nonFinite += (sum - sum != 0.0f) ? 1 : 0;
+		}
+	}
+
+	return nonFinite;
+}
+
+// Keeps the particle state and everything else a step reads and changes, attachment targets and colliders
+// being evaluated from the animation time
+void ClothSheet::saveCheckpoint() {
+	int cols = (int)particles.at(0).size();
+
+	checkpointParticles.resize(particles.size() * cols);
+
+	for (int i = 0; i < particles.size(); i++) {
+		std::copy(particles[i].begin(), particles[i].end(), checkpointParticles.begin() + i * cols);
+	}
+
+	checkpointCorrections = constraintCorrections;
+	checkpointTime = animationTime;
+
+	if (events != 0) {
+		checkpointEvents = events->mark();
+	}
+}
+
+// Note: Copies back in place, since springs, triangles and attachments point into the particle rows. Events
+// the cloth recorded since the checkpoint are dropped with the state that raised them
+void ClothSheet::restoreCheckpoint() {
+	int cols = (int)particles.at(0).size();
+
+	for (int i = 0; i < particles.size(); i++) {
+		std::copy(checkpointParticles.begin() + i * cols, checkpointParticles.begin() + (i + 1) * cols, particles[i].begin());
+	}
+
+	constraintCorrections = checkpointCorrections;
+	animationTime = checkpointTime;
+
+	if (events != 0) {
+		events->discard(checkpointEvents, this);
+	}
+
+	updateTileBounds();
+	bvh.update();
+	invalidateDerived();
+}
+
+// Row-major index of the first particle with non-finite state, only searched once a count finds one
+int ClothSheet::findNonFinite() {
+	int cols = (int)particles.at(0).size();
+
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < cols; j++) {
+			const Particle &particle = particles[i][j];
+			GLfloat sum = particle.position.x + particle.position.y + particle.position.z
+				+ particle.prevPosition.x + particle.prevPosition.y + particle.prevPosition.z
+				+ particle.velocity.x + particle.velocity.y + particle.velocity.z
+				+ particle.acceleration.x + particle.acceleration.y + particle.acceleration.z;
+
+			if (sum - sum != 0.0f) {
+				return i * cols + j;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// Logs a rollback to stderr and the event queue, which sees the offending particle at its restored position
+// Note: Cloths are named by their event queue index, so logs match between runs, -1 without a queue
+void ClothSheet::reportRollback(const char *cause, int particle, int attempt) {
+	int cols = (int)particles.at(0).size();
+	int clothIndex = events != 0 ? events->getClothIndex(this) : -1;
+
+	rollbackCount++;
+	fprintf(stderr, "cloth %d: particle (%d, %d) non-finite %s at %ld ms, rolled back to the start of the step "
+		"(substeps %d, iterations %d)\n", clothIndex, particle / cols, particle % cols, cause, animationTime,
+		substeps, constraintIterations);
+
+	if (events != 0) {
+		events->record(EVENT_ROLLBACK, this, &particles[particle / cols][particle % cols], 0, (GLfloat)attempt);
+	}
+}
+
+// Gravity, Verlet integration, sphere and capsule collision and (on the last substep) swept tile bounds in one pass
+// Note: Bounds are gathered per row and tile column while each particle is still in registers, a particle on a
+// tile column boundary counting for both sides. A tile's bounds then merge the row strips it spans
+void ClothSheet::fusedStep(GLfloat timeTSquared, bool addGravity, bool gatherBounds) {
+	int rows = (int)particles.size();
+	int cols = (int)particles.at(0).size();
+	int tileCols = (cols - 1 + CLOTH_TILE_CELLS - 1) / CLOTH_TILE_CELLS;
+
+	// Note: Each free particle gets gravity once per spring touching it, as the unfused spring pass adds it
+	if (gravityAccelerations.size() != rows * cols) {
+		std::unordered_map<Particle*, int> indices;
+
+		for (int i = 0; i < rows; i++) {
+			for (int j = 0; j < cols; j++) {
+				indices[&particles[i][j]] = i * cols + j;
+			}
+		}
+
+		gravityAccelerations = std::vector<vec3>(rows * cols, vec3{ 0.0f, 0.0f, 0.0f });
+
+		for (int i = 0; i < springs.size(); i++) {
+			for (int j = 0; j < springs.at(i).size(); j++) {
+				Spring &spring = springs.at(i).at(j);
+				vec3 &gravity0 = gravityAccelerations[indices[spring.p0]];
+				vec3 &gravity1 = gravityAccelerations[indices[spring.p1]];
+
+				gravity0 = gravity0 + gravity / spring.p0->mass;
+				gravity1 = gravity1 + gravity / spring.p1->mass;
+			}
+		}
+	}
+
+	// Gathering sphere centres and squared radii once so the per-particle rejection test is plain arithmetic
+	staticSpheres.clear();
+
+	for (int i = 0; i < potentialColliders.size(); i++) {
+		Sphere *collidable = potentialColliders.at(i);
+		vec3 center = collidable->getPosition();
+
+		staticSpheres.push_back(vec4{ center.x, center.y, center.z, collidable->getRadius() * collidable->getRadius() });
+	}
+
+	stripBounds.resize(rows * tileCols);
+
+	// Note: Hoisting member state into locals, since the particle stores could otherwise alias it
+	GLfloat stepDamping = damping;
+	const GLfloat *mask = &particleMask[0];
+	const vec3 *gravityRow = &gravityAccelerations[0];
+	const vec4 *spheres = staticSpheres.empty() ? 0 : &staticSpheres[0];
+	int sphereCount = (int)staticSpheres.size();
+	bool hasCapsules = !capsuleColliders.empty();
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < rows; i++) {
+		AABB *strips = &stripBounds[i * tileCols];
+		Particle *row = &particles[i][0];
+
+		for (int tileCol = 0; tileCol < tileCols; tileCol++) {
+			int colBegin = tileCol * CLOTH_TILE_CELLS;
+			int colEnd = (tileCol == tileCols - 1) ? cols : colBegin + CLOTH_TILE_CELLS;
+			AABB strip = emptyAABB();
+
+			for (int j = colBegin; j < colEnd; j++) {
+				Particle &particle = row[j];
+
+				if (mask[i * cols + j] == 0.0f) {
+					continue;
+				}
+
+				if (!particle.pinned) {
+					vec3 vTempPos = particle.position;
+
+					if (addGravity) {
+						particle.acceleration = particle.acceleration + gravityRow[i * cols + j];
+					}
+
+					particle.position = ((particle.position * 2.0f) - particle.prevPosition * stepDamping)
+								+ (particle.acceleration * timeTSquared);
+					particle.prevPosition = vTempPos;
+
+					// Cheap rejection against the gathered spheres, capsules are left to the exact test
+					bool touching = hasCapsules;
+
+					for (int s = 0; s < sphereCount && !touching; s++) {
+						vec3 vDistance = particle.position - vec3{ spheres[s].x, spheres[s].y, spheres[s].z };
+						touching = dot(vDistance, vDistance) < spheres[s].w;
+					}
+
+					if (touching) {
+						collideStaticColliders(particle);
+					}
+				}
+
+				if (gatherBounds) {
+					strip = expand(expand(strip, particle.position), particle.prevPosition);
+
+					// Tiles also span their closing column, which is the first column of the next strip
+					if (j == colBegin && tileCol > 0) {
+						strips[tileCol - 1] = expand(expand(strips[tileCol - 1], particle.position), particle.prevPosition);
+					}
+				}
+			}
+
+			strips[tileCol] = strip;
+		}
+	}
+
+	if (!gatherBounds) {
+		return;
+	}
+
+	vec3 vPadding = vec3{ CLOTH_CONTACT_DISTANCE, CLOTH_CONTACT_DISTANCE, CLOTH_CONTACT_DISTANCE };
+	bounds = emptyAABB();
+
+	for (int k = 0; k < tiles.size(); k++) {
+		ClothTile &tile = tiles.at(k);
+		int tileCol = tile.colBegin / CLOTH_TILE_CELLS;
+		AABB tileBounds = emptyAABB();
+
+		for (int i = tile.rowBegin; i <= tile.rowEnd; i++) {
+			tileBounds = merge(tileBounds, stripBounds[i * tileCols + tileCol]);
+		}
+
+		tile.bounds = AABB{ tileBounds.min - vPadding, tileBounds.max + vPadding };
+		bounds = merge(bounds, tile.bounds);
+	}
+}
+
+// Per-particle sphere and capsule projection used by the fused pass, matching handleCollision
+void ClothSheet::collideStaticColliders(Particle &particle) {
+	GLfloat offsetScalar = COLLIDER_SURFACE_OFFSET;
+
+	for (int i = 0; i < potentialColliders.size(); i++) {
+		Sphere *collidable = potentialColliders.at(i);
+
+		if (!collidable->contains(particle.position)) {
+			continue;
+		}
+
+		vec3 vColliderStep = collidable->getVelocity() * ((GLfloat)collidable->getFrameDeltaT() / substeps);
+		vec3 vDistance = particle.position - collidable->getPosition();
+		vec3 vNormalizedDist = normalize(vDistance);
+
+		if (events != 0) {
+			events->record(EVENT_COLLIDER_CONTACT, this, &particle, collidable,
+				collidable->getRadius() * (1.0f + offsetScalar) - magnitude(vDistance));
+		}
+
+		particle.position = collidable->getPosition() + vNormalizedDist * (collidable->getRadius() * (1.0f + offsetScalar));
+
+		// Making sure the particle leaves at least as fast as the surface pushing it
+		GLfloat particleSpeed = dot(particle.position - particle.prevPosition, vNormalizedDist);
+		GLfloat surfaceSpeed = dot(vColliderStep, vNormalizedDist);
+
+		if (particleSpeed < surfaceSpeed) {
+			particle.prevPosition = particle.prevPosition - vNormalizedDist * (surfaceSpeed - particleSpeed);
+		}
+	}
+
+	for (int k = 0; k < capsuleColliders.size(); k++) {
+		Capsule *capsule = capsuleColliders.at(k);
+
+		if (!capsule->contains(particle.position)) {
+			continue;
+		}
+
+		vec3 vAxisPoint = closestPointOnSegment(particle.position, capsule->getStart(), capsule->getEnd());
+
+		if (events != 0) {
+			events->record(EVENT_COLLIDER_CONTACT, this, &particle, capsule,
+				capsule->getRadius() * (1.0f + offsetScalar) - magnitude(particle.position - vAxisPoint));
+		}
+
+		particle.position = vAxisPoint + normalize(particle.position - vAxisPoint) * (capsule->getRadius() * (1.0f + offsetScalar));
+	}
+}
+
+// The fused pass covers the default project-first Verlet path only
+bool ClothSheet::usesFusedKernel() {
+	return fusedKernel && integratorMode == INTEGRATOR_VERLET && solverOrder == SOLVER_PROJECT_FIRST
+		&& contactMode == CONTACT_PROJECT;
+}
+
+void ClothSheet::integrate(GLfloat timeTSquared) {
+	vec3 vTempPos;
+
+	Particle *particle;
+
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < particles.at(i).size(); j++) {
+			particle = &particles.at(i).at(j);
+
+			if(!particle->pinned) {
+				vTempPos = particle->position;
+				
+				// Calculating new position and storing previous position
+				particle->position = ((particle->position * 2.0f) - particle->prevPosition * damping) 
+							+ (particle->acceleration * timeTSquared);
+				particle->prevPosition = vTempPos;
+			}
+		}
+	}
+}
+
+// Velocity is recovered from the last step's displacement, so constraint and collision corrections carry over
+// into it, then relative motion is damped before the explicit position update
+void ClothSheet::integrateVelocity(GLfloat stepLength) {
+	int rows = (int)particles.size();
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < particles[i].size(); j++) {
+			Particle &particle = particles[i][j];
+
+			if (!particle.pinned) {
+				particle.velocity = (particle.position - particle.prevPosition) / stepLength
+								+ particle.acceleration * stepLength;
+			}
+		}
+	}
+
+	dampRelativeMotion(1.0f - exp(-relativeDampingRate * stepLength));
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < particles[i].size(); j++) {
+			Particle &particle = particles[i][j];
+
+			if (!particle.pinned) {
+				particle.prevPosition = particle.position;
+				particle.position = particle.position + particle.velocity * stepLength;
+			}
+		}
+	}
+}
+
+// Removes a fraction of each free particle's velocity relative to the rigid motion (linear and angular
+// momentum preserving) of all free particles, so damping doesn't slow falling or spinning cloth
+void ClothSheet::dampRelativeMotion(GLfloat fraction) {
+	int rows = (int)particles.size();
+	double mass = 0.0;
+	double mx = 0.0, my = 0.0, mz = 0.0;
+	double px = 0.0, py = 0.0, pz = 0.0;
+	double lx = 0.0, ly = 0.0, lz = 0.0;
+	double sxx = 0.0, syy = 0.0, szz = 0.0, sxy = 0.0, sxz = 0.0, syz = 0.0;
+
+	// Mass moments, momentum and angular momentum about the origin in one pass
+	#pragma omp parallel for schedule(static) reduction(+:mass,mx,my,mz,px,py,pz,lx,ly,lz,sxx,syy,szz,sxy,sxz,syz)
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < particles[i].size(); j++) {
+			const Particle &particle = particles[i][j];
+
+			if (particle.pinned) {
+				continue;
+			}
+
+			double m = particle.mass;
+			double x = particle.position.x, y = particle.position.y, z = particle.position.z;
+			double vx = particle.velocity.x, vy = particle.velocity.y, vz = particle.velocity.z;
+
+			mass += m;
+			mx += m * x; my += m * y; mz += m * z;
+			px += m * vx; py += m * vy; pz += m * vz;
+			lx += m * (y * vz - z * vy); ly += m * (z * vx - x * vz); lz += m * (x * vy - y * vx);
+			sxx += m * x * x; syy += m * y * y; szz += m * z * z;
+			sxy += m * x * y; sxz += m * x * z; syz += m * y * z;
+		}
+	}
+
+	if (mass <= 0.0) {
+		return;
+	}
+
+	// Shifting to the centre of mass with the parallel axis theorem
+	double cx = mx / mass, cy = my / mass, cz = mz / mass;
+	double vx = px / mass, vy = py / mass, vz = pz / mass;
+
+	lx -= mass * (cy * vz - cz * vy);
+	ly -= mass * (cz * vx - cx * vz);
+	lz -= mass * (cx * vy - cy * vx);
+	sxx -= mass * cx * cx; syy -= mass * cy * cy; szz -= mass * cz * cz;
+	sxy -= mass * cx * cy; sxz -= mass * cx * cz; syz -= mass * cy * cz;
+
+	// Solving I w = L with I = tr(S) - S, leaving w at zero for degenerate (e.g. collinear) sets
+	double trace = sxx + syy + szz;
+	double ixx = trace - sxx, iyy = trace - syy, izz = trace - szz;
+	double ixy = -sxy, ixz = -sxz, iyz = -syz;
+	double c00 = iyy * izz - iyz * iyz;
+	double c01 = ixz * iyz - ixy * izz;
+	double c02 = ixy * iyz - ixz * iyy;
+	double determinant = ixx * c00 + ixy * c01 + ixz * c02;
+	vec3 omega = vec3{ 0.0f, 0.0f, 0.0f };
+
+	if (fabs(determinant) > 1e-9 * trace * trace * trace) {
+		double c11 = ixx * izz - ixz * ixz;
+		double c12 = ixy * ixz - ixx * iyz;
+		double c22 = ixx * iyy - ixy * ixy;
+
+		omega = vec3{ (GLfloat)((c00 * lx + c01 * ly + c02 * lz) / determinant),
+					(GLfloat)((c01 * lx + c11 * ly + c12 * lz) / determinant),
+					(GLfloat)((c02 * lx + c12 * ly + c22 * lz) / determinant) };
+	}
+
+	vec3 centre = vec3{ (GLfloat)cx, (GLfloat)cy, (GLfloat)cz };
+	vec3 linear = vec3{ (GLfloat)vx, (GLfloat)vy, (GLfloat)vz };
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < particles[i].size(); j++) {
+			Particle &particle = particles[i][j];
+
+			if (!particle.pinned) {
+				vec3 rigid = linear + cross(omega, particle.position - centre);
+				particle.velocity = particle.velocity - (particle.velocity - rigid) * fraction;
+			}
+		}
+	}
+}
+
+// Integrates to the inertial positions, then projects constraints from there. Velocity follows from the
+// projected displacement: implicitly through prevPosition for Verlet, explicitly for the velocity integrator
+// Note: With warm starting the solve starts from the prediction plus part of last step's correction at each particle
+void ClothSheet::predictAndProject(int iterations, GLfloat stepLength, GLfloat timeTSquared) {
+	int width = (int)particles.at(0).size();
+
+	if (integratorMode == INTEGRATOR_VELOCITY) {
+		integrateVelocity(stepLength);
+	} else {
+		integrate(timeTSquared);
+	}
+
+	if (constraintCorrections.size() != particles.size() * width) {
+		constraintCorrections = std::vector<vec3>(particles.size() * width, vec3{ 0.0f, 0.0f, 0.0f });
+	}
+
+	// Storing the predicted positions, applying the previous correction as the initial guess
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < width; j++) {
+			Particle &particle = particles[i][j];
+			vec3 &correction = constraintCorrections[i * width + j];
+			vec3 predicted = particle.position;
+
+			if (warmStart && !particle.pinned) {
+				particle.position = particle.position + correction * WARM_START_FRACTION;
+			}
+
+			correction = predicted;
+		}
+	}
+
+	lastIterationCount += satisfyConstraints(iterations);
+
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < width; j++) {
+			Particle &particle = particles[i][j];
+			vec3 &correction = constraintCorrections[i * width + j];
+
+			correction = particle.position - correction;
+
+			if (integratorMode == INTEGRATOR_VELOCITY && !particle.pinned) {
+				particle.velocity = (particle.position - particle.prevPosition) / stepLength;
+			}
+		}
+	}
+}
+
+// Selects between the original damped Verlet update and the explicit velocity integrator
+void ClothSheet::setIntegrator(IntegratorMode mode) {
+	integratorMode = mode;
+}
+
+// Solver time per move, split evenly between substeps
+void ClothSheet::setTimeStep(GLfloat timeStep) {
+	this->timeStep = timeStep;
+	particleSumsDirty = true;
+}
+
+GLfloat ClothSheet::getTimeStep() {
+	return timeStep;
+}
+
+// Only used by the velocity integrator
+void ClothSheet::setRelativeDamping(GLfloat rate) {
+	relativeDampingRate = rate;
+}
+
+// Switches the project-first Verlet path to the single-pass integration kernel
+void ClothSheet::setFusedKernel(bool enabled) {
+	fusedKernel = enabled;
+	gravityAccelerations.clear();
+}
+
+// The watchdog costs a copy of the particle state and a finiteness pass per step
+void ClothSheet::setWatchdog(bool enabled) {
+	watchdogEnabled = enabled;
+	checkpointParticles.clear();
+}
+
+// Rollbacks since the cloth was created, including retries within one step
+int ClothSheet::getRollbackCount() {
+	return rollbackCount;
+}
+
+// Barrier contact costs a few Newton iterations per particle near a collider, but stays intersection-free at
+// time steps where projection lets particles tunnel through
+void ClothSheet::setContactMode(ContactMode mode) {
+	contactMode = mode;
+	barrierStartPositions.clear();
+}
+
+void ClothSheet::setSolverOrder(SolverOrder order, bool warmStart) {
+	solverOrder = order;
+	this->warmStart = warmStart;
+	constraintCorrections.clear();
+}
+
+// Stops constraint iterations early once no spring is off its rest length by more than this fraction,
+// zero always runs the full iteration count
+void ClothSheet::setConstraintTolerance(GLfloat tolerance) {
+	constraintTolerance = tolerance;
+}
+
+// Constraint iterations per move, divided between substeps
+void ClothSheet::setConstraintIterations(int iterations) {
+	constraintIterations = std::max(iterations, 1);
+}
+
+int ClothSheet::getConstraintIterations() {
+	return constraintIterations;
+}
+
+// Leaves the springs to a solver island projecting them alongside other constraints, attachments are still
+// pulled in move()
+void ClothSheet::setIslandSolved(bool islandSolved) {
+	this->islandSolved = islandSolved;
+}
+
+// Brings tile bounds, the BVH and derived quantities up to date after something outside move() moved particles
+void ClothSheet::refreshBounds() {
+	updateTileBounds();
+	bvh.update();
+	invalidateDerived();
+}
+
+// Constraint iterations run during the last move, summed over substeps
+int ClothSheet::getLastIterationCount() {
+	return lastIterationCount;
+}
+
+// Splits each move into substeps, dividing the constraint iterations between them
+void ClothSheet::setSubsteps(int substeps) {
+	rescaleSubsteps(std::max(substeps, 1));
+	particleSumsDirty = true;
+}
+
+// Changes the substep count, scaling each particle's Verlet displacement to the new substep length so the
+// cloth keeps its velocity
+void ClothSheet::rescaleSubsteps(int substeps) {
+	if (substeps == this->substeps) {
+		return;
+	}
+
+	GLfloat scale = (GLfloat)this->substeps / substeps;
+
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < particles.at(i).size(); j++) {
+			Particle &particle = particles.at(i).at(j);
+
+			particle.prevPosition = particle.position - (particle.position - particle.prevPosition) * scale;
+		}
+	}
+
+	this->substeps = substeps;
+}
+
+// Overrides the default springConstK and damperConstD, e.g. with values fitted by ClothGradientSolver
+void ClothSheet::setMaterial(GLfloat springK, GLfloat damping) {
+	this->springK = springK;
+	this->damping = damping;
+	springSumsDirty = true;
+}
+
+GLfloat ClothSheet::getSpringK() {
+	return springK;
+}
+
+GLfloat ClothSheet::getDamping() {
+	return damping;
+}
+
+// Handles collisions with nearby Spheres and Capsules
+void ClothSheet::handleCollision() {
+	Particle *particle;
+	Sphere* collidable;
+	Capsule *capsule;
+	vec3 vDistance;
+	vec3 vNormalizedDist;
+	vec3 vScaledDist;
+
+	// Setting offset from surface when projecting
+	GLfloat offsetScalar = COLLIDER_SURFACE_OFFSET;
+
+	// Note: The fused kernel already projected particles out of spheres and capsules during integration,
+	// and barrier contact replaces projection for them
+	bool projectColliders = !usesFusedKernel() && contactMode == CONTACT_PROJECT;
+	int sphereCount = projectColliders ? (int)potentialColliders.size() : 0;
+	int capsuleCount = projectColliders ? (int)capsuleColliders.size() : 0;
+
+	if (contactMode == CONTACT_BARRIER) {
+		handleBarrierContacts();
+	}
+
+	for (int i = 0; i < sphereCount; i++) {
+		collidable = potentialColliders.at(i);
+
+		// Distance the collider's surface travels during one substep
+		vec3 vColliderStep = collidable->getVelocity() * ((GLfloat)collidable->getFrameDeltaT() / substeps);
+		
+		for (int i = 0; i < particles.size(); i++) {
+			for (int j = 0; j < particles.at(i).size(); j++) {
+				particle = &particles.at(i).at(j);
+
+				if (particleMask[i * particles.at(i).size() + j] != 0.0f && collidable->contains(particle->position)) {
+					vDistance = particle->position - collidable->getPosition();
+					vNormalizedDist = normalize(vDistance);
+					vScaledDist = (vNormalizedDist * collidable->getRadius());
+					
+					// Getting vector to position on surface of sphere from origin plus small offset
+					particle->position = collidable->getPosition() 
+										+ (vNormalizedDist * collidable->getRadius())
+										+ (vScaledDist * offsetScalar);
+
+					if (events != 0) {
+						events->record(EVENT_COLLIDER_CONTACT, this, particle, collidable,
+							collidable->getRadius() * (1.0f + offsetScalar) - magnitude(vDistance));
+					}
+
+					// Making sure the particle leaves at least as fast as the surface pushing it
+					GLfloat particleSpeed = dot(particle->position - particle->prevPosition, vNormalizedDist);
+					GLfloat surfaceSpeed = dot(vColliderStep, vNormalizedDist);
+
+					if (particleSpeed < surfaceSpeed) {
+						particle->prevPosition = particle->prevPosition - vNormalizedDist * (surfaceSpeed - particleSpeed);
+					}
+				}
+			}
+		}
+	}
+
+	for (int k = 0; k < capsuleCount; k++) {
+		capsule = capsuleColliders.at(k);
+
+		for (int i = 0; i < particles.size(); i++) {
+			for (int j = 0; j < particles.at(i).size(); j++) {
+				particle = &particles.at(i).at(j);
+
+				if (particleMask[i * particles.at(i).size() + j] != 0.0f && capsule->contains(particle->position)) {
+					// Projecting out from the closest point on the capsule's axis
+					vec3 vAxisPoint = closestPointOnSegment(particle->position, capsule->getStart(), capsule->getEnd());
+					vNormalizedDist = normalize(particle->position - vAxisPoint);
+
+					if (events != 0) {
+						events->record(EVENT_COLLIDER_CONTACT, this, particle, capsule,
+							capsule->getRadius() * (1.0f + offsetScalar) - magnitude(particle->position - vAxisPoint));
+					}
+
+					particle->position = vAxisPoint + vNormalizedDist * (capsule->getRadius() * (1.0f + offsetScalar));
+				}
+			}
+		}
+	}
+
+	for (int k = 0; k < entityWorlds.size(); k++) {
+		boundsStale = entityWorlds.at(k)->collideParticles(particles, particleMask, tiles, bounds) || boundsStale;
+	}
+
+	handleTriangleCollision();
+	handleMeshCollision();
+}
+
+// Moves every simulated particle from its substep start to its integrated position through the sphere and
+// capsule barriers
+void ClothSheet::handleBarrierContacts() {
+	int rows = (int)particles.size();
+	int cols = (int)particles.at(0).size();
+
+	if (potentialColliders.empty() && capsuleColliders.empty()) {
+		return;
+	}
+
+	if (barrierStartPositions.size() != rows * cols) {
+		return;
+	}
+
+	#pragma omp parallel for schedule(dynamic, 4)
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < cols; j++) {
+			if (particleMask[i * cols + j] != 0.0f && !particles[i][j].pinned) {
+				solveBarrierContact(particles[i][j], barrierStartPositions[i * cols + j]);
+			}
+		}
+	}
+}
+
+// Newton's method on E(x) = 0.5 |x - target|^2 + k sum b(d), with b(d) = -(d - dHat)^2 ln(d / dHat) for each
+// collider within dHat, starting from the particle's intersection-free start
+// Note: Dropping the barrier's curvature along the surface keeps the Hessian positive definite
+void ClothSheet::solveBarrierContact(Particle &particle, vec3 start) {
+	vec3 target = particle.position;
+	int colliderCount = (int)(potentialColliders.size() + capsuleColliders.size());
+	GLfloat dHat = BARRIER_ACTIVATION_DISTANCE;
+	vec3 normal;
+
+	// Colliders move between substeps, so a start they have swept over is pushed back out first
+	for (int c = 0; c < colliderCount; c++) {
+		GLfloat distance = colliderDistance(c, start, normal);
+
+		if (distance <= 0.0f) {
+			start = start + normal * (0.5f * dHat - distance);
+		}
+	}
+
+	if (colliderClearance(start) <= 0.0f) {
+		particle.position = start;
+		return;
+	}
+
+	// Nothing within reach of the barrier anywhere along the move
+	if (advanceToContact(start, target - start, dHat) >= 1.0f) {
+		return;
+	}
+
+	vec3 x = start;
+
+	for (int iteration = 0; iteration < BARRIER_NEWTON_ITERATIONS; iteration++) {
+		vec3 grad = x - target;
+		double h[6] = { 1.0, 0.0, 0.0, 1.0, 0.0, 1.0 };
+
+		for (int c = 0; c < colliderCount; c++) {
+			GLfloat d = colliderDistance(c, x, normal);
+
+			if (d >= dHat) {
+				continue;
+			}
+
+			GLfloat logRatio = log(d / dHat);
+			GLfloat db = -2.0f * (d - dHat) * logRatio - (d - dHat) * (d - dHat) / d;
+			double ddb = BARRIER_STIFFNESS * (-2.0f * logRatio - 4.0f * (d - dHat) / d + (d - dHat) * (d - dHat) / (d * d));
+
+			grad = grad + normal * (BARRIER_STIFFNESS * db);
+			h[0] += ddb * normal.x * normal.x;
+			h[1] += ddb * normal.x * normal.y;
+			h[2] += ddb * normal.x * normal.z;
+			h[3] += ddb * normal.y * normal.y;
+			h[4] += ddb * normal.y * normal.z;
+			h[5] += ddb * normal.z * normal.z;
+		}
+
+		// Solving the 3x3 Newton system by its cofactors
+		double c00 = h[3] * h[5] - h[4] * h[4];
+		double c01 = h[2] * h[4] - h[1] * h[5];
+		double c02 = h[1] * h[4] - h[2] * h[3];
+		double c11 = h[0] * h[5] - h[2] * h[2];
+		double c12 = h[1] * h[2] - h[0] * h[4];
+		double c22 = h[0] * h[3] - h[1] * h[1];
+		double determinant = h[0] * c00 + h[1] * c01 + h[2] * c02;
+		vec3 step = vec3{ (GLfloat)(-(c00 * grad.x + c01 * grad.y + c02 * grad.z) / determinant),
+						(GLfloat)(-(c01 * grad.x + c11 * grad.y + c12 * grad.z) / determinant),
+						(GLfloat)(-(c02 * grad.x + c12 * grad.y + c22 * grad.z) / determinant) };
+
+		if (magnitude(step) < BARRIER_TOLERANCE * dHat) {
+			break;
+		}
+
+		// Continuous collision filter first, then backtracking until the energy decreases enough
+		GLfloat alpha = advanceToContact(x, step, BARRIER_CCD_SEPARATION * colliderClearance(x));
+		GLfloat energy = barrierEnergy(x, target);
+		GLfloat slope = dot(grad, step);
+
+		while (alpha > 1e-6f && barrierEnergy(x + step * alpha, target) > energy + 1e-4f * alpha * slope) {
+			alpha *= 0.5f;
+		}
+
+		x = x + step * alpha;
+	}
+
+	particle.position = x;
+
+	if (events != 0) {
+		for (int c = 0; c < colliderCount; c++) {
+			GLfloat d = colliderDistance(c, x, normal);
+
+			if (d < dHat) {
+				const void *collider = c < potentialColliders.size() ? (const void*)potentialColliders.at(c)
+					: (const void*)capsuleColliders.at(c - potentialColliders.size());
+
+				events->record(EVENT_COLLIDER_CONTACT, this, &particle, collider, dHat - d);
+			}
+		}
+	}
+}
+
+// Signed distance from a sphere (indices first) or capsule surface, with the outward normal at the closest point
+GLfloat ClothSheet::colliderDistance(int collider, const vec3 &point, vec3 &normal) {
+	vec3 center;
+	GLfloat radius;
+
+	if (collider < potentialColliders.size()) {
+		center = potentialColliders.at(collider)->getPosition();
+		radius = potentialColliders.at(collider)->getRadius();
+	} else {
+		Capsule *capsule = capsuleColliders.at(collider - potentialColliders.size());
+
+		center = closestPointOnSegment(point, capsule->getStart(), capsule->getEnd());
+		radius = capsule->getRadius();
+	}
+
+	GLfloat centerDistance = magnitude(point - center);
+
+	normal = centerDistance > 0.0f ? (point - center) / centerDistance : vec3{ 0.0f, 1.0f, 0.0f };
+
+	return centerDistance - radius;
+}
+
+// Distance to the nearest sphere or capsule surface, negative inside one
+GLfloat ClothSheet::colliderClearance(const vec3 &point) {
+	int colliderCount = (int)(potentialColliders.size() + capsuleColliders.size());
+	GLfloat clearance = 1e30f;
+	vec3 normal;
+
+	for (int c = 0; c < colliderCount; c++) {
+		clearance = std::min(clearance, colliderDistance(c, point, normal));
+	}
+
+	return clearance;
+}
+
+GLfloat ClothSheet::barrierEnergy(const vec3 &point, const vec3 &target) {
+	int colliderCount = (int)(potentialColliders.size() + capsuleColliders.size());
+	GLfloat dHat = BARRIER_ACTIVATION_DISTANCE;
+	GLfloat energy = 0.5f * dot(point - target, point - target);
+	vec3 normal;
+
+	for (int c = 0; c < colliderCount; c++) {
+		GLfloat d = colliderDistance(c, point, normal);
+
+		if (d <= 0.0f) {
+			return 1e30f;
+		}
+
+		if (d < dHat) {
+			energy -= BARRIER_STIFFNESS * (d - dHat) * (d - dHat) * log(d / dHat);
+		}
+	}
+
+	return energy;
+}
+
+// Largest fraction of the step, up to 1, that keeps the point at least the separation from every surface
+// Note: Conservative advancement, a point can't close more distance to a surface than it travels, so each
+// advance is safe and the result never passes through a collider however far the step reaches
+GLfloat ClothSheet::advanceToContact(const vec3 &point, const vec3 &step, GLfloat separation) {
+	GLfloat length = magnitude(step);
+	GLfloat t = 0.0f;
+
+	if (length == 0.0f) {
+		return 1.0f;
+	}
+
+	for (int iteration = 0; iteration < BARRIER_CCD_ITERATIONS && t < 1.0f; iteration++) {
+		GLfloat gap = colliderClearance(point + step * t) - separation;
+
+		if (gap <= BARRIER_TOLERANCE * separation) {
+			return t;
+		}
+
+		t += gap / length;
+	}
+
+	return std::min(t, 1.0f);
+}
+
+// Keeps particles outside deforming mesh colliders using one batched closest point query per mesh
+void ClothSheet::handleMeshCollision() {
+	if (meshColliders.empty()) {
+		return;
+	}
+
+	int cols = (int)particles.at(0).size();
+	GLfloat maxDisplacement = 0.0f;
+	meshQueryPoints.resize(particles.size() * cols);
+
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < cols; j++) {
+			meshQueryPoints[i * cols + j] = particles[i][j].position;
+			maxDisplacement = std::max(maxDisplacement, magnitude(particles[i][j].position - particles[i][j].prevPosition));
+		}
+	}
+
+	for (int m = 0; m < meshColliders.size(); m++) {
+		MeshCollider *mesh = meshColliders.at(m);
+
+		if (!overlaps(mesh->getBounds(), bvh.getBounds())) {
+			continue;
+		}
+
+		// Note: Widening the query by how far things moved this step so fast particles are still caught inside
+		mesh->closestPoints(meshQueryPoints, MESH_CONTACT_DISTANCE + maxDisplacement + mesh->getMaxDisplacement(), meshContacts);
+
+		for (int k = 0; k < meshContacts.size(); k++) {
+			MeshContact &contact = meshContacts[k];
+			Particle *particle = &particles[k / cols][k % cols];
+
+			// Projecting particles just inside or too close to the surface back out along the face normal
+			if (contact.triangle < 0 || contact.distance >= CLOTH_THICKNESS || particle->pinned) {
+				continue;
+			}
+
+			if (events != 0) {
+				events->record(EVENT_COLLIDER_CONTACT, this, particle, mesh, CLOTH_THICKNESS - contact.distance);
+			}
+
+			particle->position = contact.closest + contact.normal * CLOTH_THICKNESS;
+			meshQueryPoints[k] = particle->position;
+			boundsStale = true;
+		}
+	}
+}
+
+// Pushes triangles off colliders that poke through the cloth between particles
+void ClothSheet::handleTriangleCollision() {
+	std::vector<int> candidates;
+	vec3 barycentric;
+	vec3 closest;
+
+	// Note: Barrier contact keeps particles within its activation distance of the surface itself, so triangles
+	// only count as poking through once they reach the surface
+	GLfloat offsetScalar = contactMode == CONTACT_BARRIER ? 0.0f : COLLIDER_SURFACE_OFFSET;
+
+	for (int i = 0; i < potentialColliders.size(); i++) {
+		Sphere *collidable = potentialColliders.at(i);
+		vec3 center = collidable->getPosition();
+		GLfloat surfaceDistance = collidable->getRadius() * (1.0f + offsetScalar);
+		vec3 vReach = vec3{ surfaceDistance, surfaceDistance, surfaceDistance };
+
+		candidates.clear();
+		bvh.queryAABB(AABB{ center - vReach, center + vReach }, candidates);
+
+		for (int k = 0; k < candidates.size(); k++) {
+			const Triangle &tri = triangles.at(candidates.at(k));
+			closest = closestPointOnTriangle(center, tri.v0->position, tri.v1->position, tri.v2->position, barycentric);
+
+			vec3 vDistance = closest - center;
+			GLfloat distance = magnitude(vDistance);
+
+			if (distance >= surfaceDistance || distance < 1e-6f) {
+				continue;
+			}
+
+			resolveTriangleContact(tri, barycentric, vDistance * ((surfaceDistance - distance) / distance));
+		}
+	}
+
+	for (int i = 0; i < capsuleColliders.size(); i++) {
+		Capsule *capsule = capsuleColliders.at(i);
+		GLfloat surfaceDistance = capsule->getRadius() * (1.0f + offsetScalar);
+		vec3 vReach = vec3{ surfaceDistance, surfaceDistance, surfaceDistance };
+		AABB reach = expand(AABB{ capsule->getStart(), capsule->getStart() }, capsule->getEnd());
+
+		candidates.clear();
+		bvh.queryAABB(AABB{ reach.min - vReach, reach.max + vReach }, candidates);
+
+		for (int k = 0; k < candidates.size(); k++) {
+			const Triangle &tri = triangles.at(candidates.at(k));
+			vec3 axisPoint;
+			GLfloat distance = closestPointsSegmentTriangle(capsule->getStart(), capsule->getEnd(),
+				tri.v0->position, tri.v1->position, tri.v2->position, axisPoint, closest, barycentric);
+
+			if (distance >= surfaceDistance || distance < 1e-6f) {
+				continue;
+			}
+
+			resolveTriangleContact(tri, barycentric, (closest - axisPoint) * ((surfaceDistance - distance) / distance));
+		}
+	}
+}
+
+// Moves a triangle's vertices so its point at the given barycentric coordinates moves by the correction
+void ClothSheet::resolveTriangleContact(const Triangle &tri, const vec3 &barycentric, const vec3 &correction) {
+	Particle *vertices[3] = { tri.v0, tri.v1, tri.v2 };
+	GLfloat weights[3] = { barycentric.x, barycentric.y, barycentric.z };
+	GLfloat totalWeight = 0.0f;
+
+	// Note: Pinned vertices can't move, so the free ones take up their share
+	for (int v = 0; v < 3; v++) {
+		totalWeight += vertices[v]->pinned ? 0.0f : weights[v] * weights[v];
+	}
+
+	if (totalWeight <= 0.0f) {
+		return;
+	}
+
+	for (int v = 0; v < 3; v++) {
+		if (!vertices[v]->pinned) {
+			vertices[v]->position = vertices[v]->position + correction * (weights[v] / totalWeight);
+		}
+	}
+
+	boundsStale = true;
+}
+
+// Finds vertex-triangle and edge-edge crossings over the last step and stops the particles involved just before impact
+void ClothSheet::handleSelfCollision() {
+	int rows = (int)particles.size();
+	int cols = (int)particles.at(0).size();
+
+	for (int iteration = 0; iteration < CCD_ITERATIONS; iteration++) {
+		// Note: One result list per vertex and per edge so detection needs no locking
+		impacts.resize(rows * cols + edges.size());
+
+		#pragma omp parallel for schedule(dynamic, 64)
+		for (int k = 0; k < rows * cols; k++) {
+			impacts[k].clear();
+
+			if (particleMask[k] != 0.0f) {
+				findVertexTriangleImpacts(k / cols, k % cols, impacts[k]);
+			}
+		}
+
+		#pragma omp parallel for schedule(dynamic, 64)
+		for (int k = 0; k < (int)edges.size(); k++) {
+			impacts[rows * cols + k].clear();
+			findEdgeEdgeImpacts(k, impacts[rows * cols + k]);
+		}
+
+		// Keeping only the earliest impact of each particle
+		std::unordered_map<Particle*, GLfloat> earliest;
+
+		for (int k = 0; k < impacts.size(); k++) {
+			for (int l = 0; l < impacts.at(k).size(); l++) {
+				Impact &impact = impacts.at(k).at(l);
+
+				for (int p = 0; p < 4; p++) {
+					std::unordered_map<Particle*, GLfloat>::iterator it = earliest.find(impact.particles[p]);
+
+					if (it == earliest.end() || it->second > impact.time) {
+						earliest[impact.particles[p]] = impact.time;
+					}
+				}
+			}
+		}
+
+		if (earliest.empty()) {
+			break;
+		}
+
+		// Rewinding particles along their path to just before their first impact
+		for (std::unordered_map<Particle*, GLfloat>::iterator it = earliest.begin(); it != earliest.end(); ++it) {
+			Particle *particle = it->first;
+
+			if (!particle->pinned) {
+				particle->position = particle->prevPosition
+					+ (particle->position - particle->prevPosition) * (it->second * CCD_RESPONSE_FRACTION);
+
+				if (events != 0) {
+					events->record(EVENT_SELF_IMPACT, this, particle, this, it->second);
+				}
+			}
+		}
+	}
+}
+
+void ClothSheet::toggleSelfCollision() {
+	selfCollisionEnabled = !selfCollisionEnabled;
+}
+
+// Solves for times during the step when a vertex becomes coplanar with a non-adjacent triangle while inside it
+void ClothSheet::findVertexTriangleImpacts(int row, int col, std::vector<Impact> &found) {
+	Particle *particle = &particles[row][col];
+	AABB sweptBounds = expand(AABB{ particle->prevPosition, particle->prevPosition }, particle->position);
+
+	std::vector<int> candidates;
+	bvh.queryAABB(sweptBounds, candidates);
+
+	for (int k = 0; k < candidates.size(); k++) {
+		const Triangle &tri = triangles[candidates[k]];
+
+		if (tri.v0 == particle || tri.v1 == particle || tri.v2 == particle) {
+			continue;
+		}
+
+		// Coplanarity of (b - a) x (c - a) . (p - a) as a cubic in t over the step
+		vec3 a0 = tri.v1->prevPosition - tri.v0->prevPosition;
+		vec3 b0 = tri.v2->prevPosition - tri.v0->prevPosition;
+		vec3 c0 = particle->prevPosition - tri.v0->prevPosition;
+		vec3 av = (tri.v1->position - tri.v0->position) - a0;
+		vec3 bv = (tri.v2->position - tri.v0->position) - b0;
+		vec3 cv = (particle->position - tri.v0->position) - c0;
+
+		vec3 n0 = cross(a0, b0);
+		vec3 n1 = cross(a0, bv) + cross(av, b0);
+		vec3 n2 = cross(av, bv);
+
+		double roots[3];
+		int rootCount = solveCubicInUnitInterval(dot(n2, cv), dot(n1, cv) + dot(n2, c0), dot(n0, cv) + dot(n1, c0), dot(n0, c0), roots);
+
+		for (int r = 0; r < rootCount; r++) {
+			GLfloat t = (GLfloat)roots[r];
+			vec3 p = particle->prevPosition + (particle->position - particle->prevPosition) * t;
+			vec3 v0 = tri.v0->prevPosition + (tri.v0->position - tri.v0->prevPosition) * t;
+			vec3 v1 = tri.v1->prevPosition + (tri.v1->position - tri.v1->prevPosition) * t;
+			vec3 v2 = tri.v2->prevPosition + (tri.v2->position - tri.v2->prevPosition) * t;
+			vec3 barycentric;
+
+			if (magnitude(p - closestPointOnTriangle(p, v0, v1, v2, barycentric)) < CLOTH_THICKNESS) {
+				found.push_back(Impact{ { particle, tri.v0, tri.v1, tri.v2 }, t });
+				break;
+			}
+		}
+	}
+}
+
+// Solves for times during the step when two non-adjacent edges become coplanar while crossing
+void ClothSheet::findEdgeEdgeImpacts(int edge, std::vector<Impact> &found) {
+	const Edge &e = edges[edge];
+	AABB sweptBounds = expand(expand(expand(AABB{ e.p0->prevPosition, e.p0->prevPosition }, e.p0->position),
+		e.p1->prevPosition), e.p1->position);
+
+	std::vector<int> candidates;
+	bvh.queryAABB(sweptBounds, candidates);
+
+	for (int k = 0; k < candidates.size(); k++) {
+		for (int side = 0; side < 3; side++) {
+			int otherIndex = triangleEdges[3 * candidates[k] + side];
+
+			// Note: Each pair is tested once, from the lower edge index
+			if (otherIndex <= edge) {
+				continue;
+			}
+
+			const Edge &other = edges[otherIndex];
+
+			if (other.p0 == e.p0 || other.p0 == e.p1 || other.p1 == e.p0 || other.p1 == e.p1) {
+				continue;
+			}
+
+			// Coplanarity of (p1 - p0) x (q1 - q0) . (q0 - p0) as a cubic in t over the step
+			vec3 a0 = e.p1->prevPosition - e.p0->prevPosition;
+			vec3 b0 = other.p1->prevPosition - other.p0->prevPosition;
+			vec3 c0 = other.p0->prevPosition - e.p0->prevPosition;
+			vec3 av = (e.p1->position - e.p0->position) - a0;
+			vec3 bv = (other.p1->position - other.p0->position) - b0;
+			vec3 cv = (other.p0->position - e.p0->position) - c0;
+
+			vec3 n0 = cross(a0, b0);
+			vec3 n1 = cross(a0, bv) + cross(av, b0);
+			vec3 n2 = cross(av, bv);
+
+			double roots[3];
+			int rootCount = solveCubicInUnitInterval(dot(n2, cv), dot(n1, cv) + dot(n2, c0), dot(n0, cv) + dot(n1, c0), dot(n0, c0), roots);
+
+			for (int r = 0; r < rootCount; r++) {
+				GLfloat t = (GLfloat)roots[r];
+				vec3 p0 = e.p0->prevPosition + (e.p0->position - e.p0->prevPosition) * t;
+				vec3 p1 = e.p1->prevPosition + (e.p1->position - e.p1->prevPosition) * t;
+				vec3 q0 = other.p0->prevPosition + (other.p0->position - other.p0->prevPosition) * t;
+				vec3 q1 = other.p1->prevPosition + (other.p1->position - other.p1->prevPosition) * t;
+
+				if (segmentDistance(p0, p1, q0, q1) < CLOTH_THICKNESS) {
+					found.push_back(Impact{ { e.p0, e.p1, other.p0, other.p1 }, t });
+					break;
+				}
+			}
+		}
+	}
+}
+
+// Applies a given wind force to the cloth
+void ClothSheet::applyWindForce(vec3 &windForce) {
+	vWindForce = windForce;
+}
+
+// Scales the wind on each triangle by the grid's transmittance at its centroid, null applies full wind
+void ClothSheet::setWindOcclusion(WindOcclusionGrid *grid) {
+	windOcclusion = grid;
+}
+
+void ClothSheet::setEventQueue(SimulationEventQueue *queue) {
+	events = queue;
+
+	if (queue != 0) {
+		queue->registerCloth(this);
+	}
+}
+
+// Unpins pinned particles
+void ClothSheet::detach() {
+	while (!pinnedParticles.empty()) {
+		pinnedParticles.front()->pinned = false;
+
+		if (events != 0) {
+			events->record(EVENT_PIN_RELEASE, this, pinnedParticles.front(), 0, 0.0f);
+		}
+
+		pinnedParticles.pop();
+	}
+}
+
+// Attaches the particles of the triangle under the ray to the cursor, returns false on a miss
+bool ClothSheet::grab(const Ray &ray) {
+	RayHit hit = bvh.intersectRay(ray);
+
+	if (hit.triangle < 0) {
+		return false;
+	}
+
+	const Triangle &tri = triangles.at(hit.triangle);
+	Particle *vertices[3] = { tri.v0, tri.v1, tri.v2 };
+	GLfloat weights[3] = { 1.0f - hit.u - hit.v, hit.u, hit.v };
+
+	releaseGrab();
+
+	grabDepth = hit.t;
+	vGrabTarget = ray.origin + (ray.direction * hit.t);
+
+	// Note: Weighting by barycentric coordinates so the particle nearest the cursor follows most closely
+	for (int i = 0; i < 3; i++) {
+		grabOffsets.push_back(vertices[i]->position - vGrabTarget);
+		grabAttachmentIds.push_back(attach(vertices[i], vertices[i]->position, GRAB_STIFFNESS * weights[i]));
+	}
+
+	return true;
+}
+
+// Moves the grab target along the new ray, keeping the depth at which the cloth was picked
+void ClothSheet::dragGrab(const Ray &ray) {
+	vGrabTarget = ray.origin + (ray.direction * grabDepth);
+
+	for (int i = 0; i < grabAttachmentIds.size(); i++) {
+		setAttachmentTarget(grabAttachmentIds.at(i), vGrabTarget + grabOffsets.at(i));
+	}
+}
+
+// Drops the grab attachments, leaving particles to the regular simulation
+void ClothSheet::releaseGrab() {
+	for (int i = 0; i < grabAttachmentIds.size(); i++) {
+		removeAttachment(grabAttachmentIds.at(i));
+	}
+
+	grabAttachmentIds.clear();
+	grabOffsets.clear();
+}
+
+// Attaches a particle to a fixed world position, returning an id for later updates or removal
+int ClothSheet::attach(Particle *particle, vec3 target, GLfloat stiffness) {
+	return pushAttachment(particle, ATTACH_STATIC, target, 0, 0, stiffness);
+}
+
+// Attaches a particle to a keyframed target, offset from the track's position
+int ClothSheet::attach(Particle *particle, KeyframeTrack *track, vec3 offset, GLfloat stiffness) {
+	return pushAttachment(particle, ATTACH_KEYFRAME, offset, track, 0, stiffness);
+}
+
+// Attaches a particle to a point riding along with a sphere, anchored where the particle is now
+int ClothSheet::attach(Particle *particle, Sphere *anchor, GLfloat stiffness) {
+	return pushAttachment(particle, ATTACH_SPHERE, particle->position - anchor->getPosition(), 0, anchor, stiffness);
+}
+
+int ClothSheet::pushAttachment(Particle *particle, int targetType, vec3 offset, KeyframeTrack *track, Sphere *anchor, GLfloat stiffness) {
+	int id = nextAttachmentId++;
+
+	attachments.ids.push_back(id);
+	attachments.particles.push_back(particle);
+	attachments.targets.push_back(particle->position);
+	attachments.stiffness.push_back(stiffness);
+	attachments.targetTypes.push_back(targetType);
+	attachments.offsets.push_back(offset);
+	attachments.tracks.push_back(track);
+	attachments.anchors.push_back(anchor);
+
+	return id;
+}
+
+// Moves a static attachment's target
+// Note: Keyframe and sphere attachments keep an offset from their driver in the same slot, so they're left alone
+void ClothSheet::setAttachmentTarget(int id, vec3 target) {
+	for (int k = 0; k < attachments.ids.size(); k++) {
+		if (attachments.ids.at(k) == id) {
+			if (attachments.targetTypes.at(k) != ATTACH_STATIC) {
+				return;
+			}
+
+			attachments.offsets.at(k) = target;
+			attachments.targets.at(k) = target;
+			return;
+		}
+	}
+}
+
+// Removes an attachment by swapping the last entry into its slot
+void ClothSheet::removeAttachment(int id) {
+	for (int k = 0; k < attachments.ids.size(); k++) {
+		if (attachments.ids.at(k) != id) {
+			continue;
+		}
+
+		int last = (int)attachments.ids.size() - 1;
+
+		attachments.ids.at(k) = attachments.ids.at(last);
+		attachments.particles.at(k) = attachments.particles.at(last);
+		attachments.targets.at(k) = attachments.targets.at(last);
+		attachments.stiffness.at(k) = attachments.stiffness.at(last);
+		attachments.targetTypes.at(k) = attachments.targetTypes.at(last);
+		attachments.offsets.at(k) = attachments.offsets.at(last);
+		attachments.tracks.at(k) = attachments.tracks.at(last);
+		attachments.anchors.at(k) = attachments.anchors.at(last);
+
+		attachments.ids.pop_back();
+		attachments.particles.pop_back();
+		attachments.targets.pop_back();
+		attachments.stiffness.pop_back();
+		attachments.targetTypes.pop_back();
+		attachments.offsets.pop_back();
+		attachments.tracks.pop_back();
+		attachments.anchors.pop_back();
+		return;
+	}
+}
+
+// Evaluates every attachment target once per substep so the constraint iterations only read positions
+void ClothSheet::evaluateAttachmentTargets(GLfloat time) {
+	vec3 vVelocity;
+
+	for (int k = 0; k < attachments.ids.size(); k++) {
+		switch (attachments.targetTypes[k]) {
+		case ATTACH_KEYFRAME:
+			// Note: Without keys the target holds where it was, rather than drifting by the offset each substep
+			if (attachments.tracks[k]->isEmpty()) {
+				break;
+			}
+
+			attachments.tracks[k]->evaluate(time, attachments.targets[k], vVelocity);
+			attachments.targets[k] = attachments.targets[k] + attachments.offsets[k];
+			break;
+		case ATTACH_SPHERE:
+			attachments.targets[k] = attachments.anchors[k]->getPosition() + attachments.offsets[k];
+			break;
+		default:
+			attachments.targets[k] = attachments.offsets[k];
+			break;
+		}
+	}
+}
+
+// Adds an Actor to a list of possible collisions
+void ClothSheet::pushCollidable(Sphere *collidable) {
+	potentialColliders.push_back(collidable);
+}
+
+void ClothSheet::pushCollidable(Capsule *collidable) {
+	capsuleColliders.push_back(collidable);
+}
+
+void ClothSheet::pushCollidable(MeshCollider *collidable) {
+	meshColliders.push_back(collidable);
+}
+
+// Collides with every sphere and capsule collider component in the world
+void ClothSheet::pushCollidable(EntityWorld *world) {
+	entityWorlds.push_back(world);
+}
+
+vec3 ClothSheet::getPosition() {
+	return position;
+}
+
+std::vector< std::vector<Particle>> &ClothSheet::getParticles() {
+	return particles;
+}
+
+std::vector< std::vector<Spring>> &ClothSheet::getSprings() {
+	return springs;
+}
+
+std::vector<Triangle> &ClothSheet::getTriangles() {
+	return triangles;
+}
+
+// 1 for simulated particles and 0 for those outside the mask, row by row
+const std::vector<GLfloat> &ClothSheet::getParticleMask() {
+	return particleMask;
+}
+
+std::vector<ClothTile> &ClothSheet::getTiles() {
+	return tiles;
+}
+
+TriangleBVH &ClothSheet::getBVH() {
+	return bvh;
+}
+
+// Bounds of the whole sheet swept over the last step
+AABB ClothSheet::getBounds() {
+	return bounds;
+}
+
+// Turns the sheet about its top row into the horizontal plane, later rows further from the viewer, at rest
+void ClothSheet::layFlat() {
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < particles.at(i).size(); j++) {
+			Particle &particle = particles.at(i).at(j);
+			GLfloat drop = position.y - particle.position.y;
+
+			particle.position = vec3{ particle.position.x, position.y, particle.position.z - drop };
+			particle.prevPosition = particle.position;
+		}
+	}
+
+	updateTileBounds();
+	bvh.build(&triangles, CLOTH_THICKNESS, true);
+	invalidateDerived();
+}
+
+// Index of the upper triangle of grid cell (row, col), the lower triangle follows it. -1 outside the mask
+int ClothSheet::triangleIndex(int row, int col) {
+	return cellTriangles[row * ((int)particles.at(0).size() - 1) + col];
+}
+
+// Row-major index of one of this cloth's particles, -1 for any other particle
+int ClothSheet::getParticleIndex(const Particle *particle) {
+	int cols = (int)particles.at(0).size();
+
+	for (int i = 0; i < particles.size(); i++) {
+		const Particle *row = particles[i].data();
+
+		if (!std::less<const Particle*>()(particle, row) && std::less<const Particle*>()(particle, row + cols)) {
+			return i * cols + (int)(particle - row);
+		}
+	}
+
+	return -1;
+}
+
+// Registration order of a collider across spheres, capsules then meshes, -1 if the cloth doesn't collide with it
+int ClothSheet::getColliderIndex(const void *collider) {
+	int index = 0;
+
+	for (int i = 0; i < potentialColliders.size(); i++, index++) {
+		if (potentialColliders.at(i) == collider) {
+			return index;
+		}
+	}
+
+	for (int i = 0; i < capsuleColliders.size(); i++, index++) {
+		if (capsuleColliders.at(i) == collider) {
+			return index;
+		}
+	}
+
+	for (int i = 0; i < meshColliders.size(); i++, index++) {
+		if (meshColliders.at(i) == collider) {
+			return index;
+		}
+	}
+
+	return -1;
+}
+
+// Drops the cached derived quantities, for anything outside move() and settle() that moves particles
+void ClothSheet::invalidateDerived() {
+	particleSumsDirty = true;
+	springSumsDirty = true;
+	faceNormalsDirty = true;
+}
+
+// Bounds of the current particle positions
+AABB ClothSheet::getParticleBounds() {
+	return getStatistics().bounds;
+}
+
+// Mass-weighted centre of the simulated particles
+vec3 ClothSheet::getCentroid() {
+	if (particleSumsDirty) {
+		computeParticleSums();
+	}
+
+	return statistics.centroid;
+}
+
+GLfloat ClothSheet::getKineticEnergy() {
+	if (particleSumsDirty) {
+		computeParticleSums();
+	}
+
+	return statistics.kineticEnergy;
+}
+
+// Gravitational plus spring potential energy
+GLfloat ClothSheet::getPotentialEnergy() {
+	if (particleSumsDirty) {
+		computeParticleSums();
+	}
+
+	if (springSumsDirty) {
+		computeSpringSums();
+	}
+
+	return statistics.gravitationalEnergy + statistics.elasticEnergy;
+}
+
+// Mean of |length - rest length| / rest length over all springs
+GLfloat ClothSheet::getAverageStrain() {
+	if (springSumsDirty) {
+		computeSpringSums();
+	}
+
+	return statistics.averageStrain;
+}
+
+// Every aggregate at once, computing whichever are out of date
+const ClothStatistics &ClothSheet::getStatistics() {
+	if (particleSumsDirty) {
+		computeParticleSums();
+	}
+
+	if (springSumsDirty) {
+		computeSpringSums();
+	}
+
+	return statistics;
+}
+
+// Unit normal of each triangle, indexed as getTriangles()
+const std::vector<vec3> &ClothSheet::getFaceNormals() {
+	if (faceNormalsDirty) {
+		computeFaceNormals();
+	}
+
+	return faceNormals;
+}
+
+// Bounds, centroid, kinetic and gravitational energy in one pass over the simulated particles
+void ClothSheet::computeParticleSums() {
+	int rows = (int)particles.size();
+	int cols = (int)particles.at(0).size();
+	GLfloat stepLength = timeStep / substeps;
+	GLfloat minX = 1e30f, minY = 1e30f, minZ = 1e30f;
+	GLfloat maxX = -1e30f, maxY = -1e30f, maxZ = -1e30f;
+	GLfloat mass = 0.0f, momentX = 0.0f, momentY = 0.0f, momentZ = 0.0f;
+	GLfloat kinetic = 0.0f, gravitational = 0.0f;
+
+	#pragma omp parallel for schedule(static) reduction(min:minX, minY, minZ) reduction(max:maxX, maxY, maxZ) \
+		reduction(+:mass, momentX, momentY, momentZ, kinetic, gravitational)
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < cols; j++) {
+			if (particleMask[i * cols + j] == 0.0f) {
+				continue;
+			}
+
+			const Particle &particle = particles[i][j];
+			const vec3 &p = particle.position;
+
+			minX = std::min(minX, p.x);
+			minY = std::min(minY, p.y);
+			minZ = std::min(minZ, p.z);
+			maxX = std::max(maxX, p.x);
+			maxY = std::max(maxY, p.y);
+			maxZ = std::max(maxZ, p.z);
+
+			mass += particle.mass;
+			momentX += particle.mass * p.x;
+			momentY += particle.mass * p.y;
+			momentZ += particle.mass * p.z;
+			gravitational -= particle.mass * dot(gravity, p);
+
+			if (!particle.pinned) {
+				vec3 velocity = (p - particle.prevPosition) / stepLength;
+
+				kinetic += 0.5f * particle.mass * dot(velocity, velocity);
+			}
+		}
+	}
+
+	statistics.bounds = AABB{ vec3{ minX, minY, minZ }, vec3{ maxX, maxY, maxZ } };
+	statistics.centroid = mass > 0.0f ? vec3{ momentX, momentY, momentZ } / mass : position;
+	statistics.mass = mass;
+	statistics.kineticEnergy = kinetic;
+	statistics.gravitationalEnergy = gravitational;
+	particleSumsDirty = false;
+}
+
+// Spring potential energy and strain in one pass over the springs
+void ClothSheet::computeSpringSums() {
+	int rows = (int)springs.size();
+	GLfloat elastic = 0.0f, strainSum = 0.0f, maxStrain = 0.0f;
+	int springCount = 0;
+
+	#pragma omp parallel for schedule(static) reduction(+:elastic, strainSum, springCount) reduction(max:maxStrain)
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < springs[i].size(); j++) {
+			const Spring &spring = springs[i][j];
+			GLfloat stretch = magnitude(spring.p0->position - spring.p1->position) - spring.restLength;
+			GLfloat strain = fabs(stretch) / spring.restLength;
+
+			elastic += 0.5f * springK * stretch * stretch;
+			strainSum += strain;
+			maxStrain = std::max(maxStrain, strain);
+		}
+
+		springCount += (int)springs[i].size();
+	}
+
+	statistics.elasticEnergy = elastic;
+	statistics.averageStrain = springCount > 0 ? strainSum / springCount : 0.0f;
+	statistics.maxStrain = maxStrain;
+	springSumsDirty = false;
+}
+
+void ClothSheet::computeFaceNormals() {
+	int count = (int)triangles.size();
+
+	faceNormals.resize(count);
+
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < count; k++) {
+		const Triangle &tri = triangles[k];
+
+		faceNormals[k] = normalize(cross(tri.v1->position - tri.v0->position, tri.v2->position - tri.v0->position));
+	}
+
+	faceNormalsDirty = false;
+}
+
+// Generates a height*width matrix of particles and a matrix of springs
+void ClothSheet::generateParticleSheet(GLfloat height, GLfloat width) {
+	// Note: Spacings double as rest length of springs, kept square so the longer side spans two units
+	GLfloat xSpacing = 2.0f / (std::max(height, width) - 1.0f);
+	GLfloat ySpacing = xSpacing;
+	GLfloat xBendSpacing = xSpacing + xSpacing;
+	GLfloat yBendSpacing = ySpacing + ySpacing;
+	vec3 vSpacer = position;
+	vec4 vColor;
+
+	// Setting size of vector ahead of time to save cycles
+	particles = std::vector< std::vector<Particle>>(height, std::vector<Particle>(width));
+
+	// Generating particle matrix
+	for (int i = 0; i < (int)height; i++) {
+		vSpacer.x = position.x;
+
+		for (int j = 0; j < (int)width; j++) {
+			// Choosing color based on particle order
+			if (i % 2 != 0 && j % 2 != 0) {
+				vColor = vec4{ 0.941f, 0.427f, 0.102f, 1.0f };
+			} else {
+				vColor = vec4{ 0.996f, 1.0f, 0.906f, 1.0f };
+			}
+			
+			particles.at(i).at(j) = Particle{ 
+				vSpacer,
+				vSpacer,
+				vec3{ 0.0f, 0.0f, 0.0f },
+				vec3{ 0.0f, 0.0f, 0.0f },
+				vColor,
+				PARTICLE_MASS_KG,
+				particleMask[i * (int)width + j] == 0.0f };
+
+			vSpacer.x += xSpacing;
+		}
+
+		vSpacer.y -= ySpacing;
+	}
+
+	springs = std::vector< std::vector<Spring>>((int)height - 1);
+
+	int row = 0;
+	int col = 0;
+	int springGroupSize;
+	std::vector<char> keep;
+
+	// Generating spring matrix
+	for (int k = 0; k < springs.size(); k++) {
+		// Adding two bend springs per particle except for last two rows
+		if (k < springs.size() - 3) {
+			springs.at(k) = std::vector<Spring>(((int)width - 1) * 8 - 1);
+			springGroupSize = 8;
+		} else {
+			springs.at(k) = std::vector<Spring>(((int)width - 1) * 6);
+			springGroupSize = 6;
+		}
+
+		col = 0;
+		keep.assign(springs.at(k).size(), 0);
+
+		for (int l = 0; l < springs.at(k).size(); l += springGroupSize) {
+			// Keeping cell springs inside occupied cells
+			for (int s = l; s < l + 6; s++) {
+				keep.at(s) = cellMask[row * ((int)width - 1) + col] != 0.0f;
+			}
+
+			// Generating four structural and two shear springs per particle
+			springs.at(k).at(l) = Spring{ &particles.at(row).at(col), &particles.at(row + 1).at(col), ySpacing };
+			springs.at(k).at(l + 1) = Spring{ &particles.at(row).at(col), &particles.at(row).at(col + 1), xSpacing };
+			springs.at(k).at(l + 2) = Spring{ &particles.at(row).at(col + 1), &particles.at(row + 1).at(col + 1), ySpacing };
+			springs.at(k).at(l + 3) = Spring{ &particles.at(row + 1).at(col), &particles.at(row + 1).at(col + 1), xSpacing };
+			springs.at(k).at(l + 4) = Spring{ &particles.at(row + 1).at(col), &particles.at(row).at(col + 1),
+												sqrt((xSpacing * xSpacing) + (ySpacing * ySpacing)) };
+			springs.at(k).at(l + 5) = Spring{ &particles.at(row).at(col), &particles.at(row + 1).at(col + 1),
+												sqrt((xSpacing * xSpacing) + (ySpacing * ySpacing)) };
+
+			// Adding vertical bend spring, kept when the cells either side of both segments it spans are solid
+			if (k < springs.size() - 3) {
+				springs.at(k).at(l + 6) = Spring{ &particles.at(row).at(col), &particles.at(row + 2).at(col), yBendSpacing };
+				keep.at(l + 6) = isCellSolid(row, col - 1) && isCellSolid(row, col)
+								&& isCellSolid(row + 1, col - 1) && isCellSolid(row + 1, col);
+			}
+
+			// Adding horizontal bend spring, under the same rule
+			if (l + 7 < springs.at(k).size() - 3) {
+				springs.at(k).at(l + 7) = Spring{ &particles.at(row).at(col), &particles.at(row).at(col + 2), xBendSpacing };
+				keep.at(l + 7) = isCellSolid(row - 1, col) && isCellSolid(row, col)
+								&& isCellSolid(row - 1, col + 1) && isCellSolid(row, col + 1);
+			}
+
+			col++;
+		}
+
+		// Compacting the row down to the springs inside the mask
+		int kept = 0;
+		for (int s = 0; s < springs.at(k).size(); s++) {
+			if (keep.at(s)) {
+				springs.at(k).at(kept++) = springs.at(k).at(s);
+			}
+		}
+		springs.at(k).resize(kept);
+
+		row++;
+	}
+}
+
+// Whether a mask cell holds cloth for bend springs
+// Note: Cells past the grid border count as solid so the sheet's outer rows and columns keep their bend springs,
+// only cut-outs in the mask break bending across them
+bool ClothSheet::isCellSolid(int row, int col) {
+	int cellCols = (int)particles.at(0).size() - 1;
+
+	if (row < 0 || col < 0 || row >= (int)particles.size() - 1 || col >= cellCols) {
+		return true;
+	}
+
+	return cellMask[row * cellCols + col] != 0.0f;
+}
+
+// Generates the two triangles per grid cell in the same winding used by draw(), and their shared edges
+void ClothSheet::generateTriangles() {
+	triangles = std::vector<Triangle>();
+	triangles.reserve((particles.size() - 1) * (particles.at(0).size() - 1) * 2);
+	cellTriangles = std::vector<int>(cellMask.size(), -1);
+
+	for (int i = 0; i < particles.size() - 1; i++) {
+		for (int j = 0; j < particles.at(i).size() - 1; j++) {
+			int cell = i * ((int)particles.at(i).size() - 1) + j;
+
+			if (cellMask[cell] == 0.0f) {
+				continue;
+			}
+
+			cellTriangles[cell] = (int)triangles.size();
+			triangles.push_back(Triangle{ &particles.at(i + 1).at(j), &particles.at(i).at(j), &particles.at(i).at(j + 1) });
+			triangles.push_back(Triangle{ &particles.at(i + 1).at(j), &particles.at(i).at(j + 1), &particles.at(i + 1).at(j + 1) });
+		}
+	}
+
+	// Note: Edges are keyed by their particle pair so triangles sharing an edge reference the same one
+	std::map<std::pair<Particle*, Particle*>, int> edgeIndices;
+	edges = std::vector<Edge>();
+	triangleEdges = std::vector<int>(triangles.size() * 3);
+
+	for (int k = 0; k < triangles.size(); k++) {
+		Particle *vertices[3] = { triangles.at(k).v0, triangles.at(k).v1, triangles.at(k).v2 };
+
+		for (int side = 0; side < 3; side++) {
+			Particle *p0 = std::min(vertices[side], vertices[(side + 1) % 3]);
+			Particle *p1 = std::max(vertices[side], vertices[(side + 1) % 3]);
+			std::map<std::pair<Particle*, Particle*>, int>::iterator it = edgeIndices.find(std::make_pair(p0, p1));
+
+			if (it == edgeIndices.end()) {
+				it = edgeIndices.insert(std::make_pair(std::make_pair(p0, p1), (int)edges.size())).first;
+				edges.push_back(Edge{ p0, p1 });
+			}
+
+			triangleEdges.at(3 * k + side) = it->second;
+		}
+	}
+}
+
+// Splits the grid into square tiles of CLOTH_TILE_CELLS cells used by the cloth-cloth broad phase
+void ClothSheet::generateTiles() {
+	int cellRows = (int)particles.size() - 1;
+	int cellCols = (int)particles.at(0).size() - 1;
+
+	tiles = std::vector<ClothTile>();
+
+	for (int i = 0; i < cellRows; i += CLOTH_TILE_CELLS) {
+		for (int j = 0; j < cellCols; j += CLOTH_TILE_CELLS) {
+			ClothTile tile = ClothTile{ i, std::min(i + CLOTH_TILE_CELLS, cellRows),
+				j, std::min(j + CLOTH_TILE_CELLS, cellCols), emptyAABB() };
+			GLfloat occupied = 0.0f;
+
+			for (int k = tile.rowBegin; k < tile.rowEnd; k++) {
+				for (int l = tile.colBegin; l < tile.colEnd; l++) {
+					occupied += cellMask[k * cellCols + l];
+				}
+			}
+
+			// Dropping tiles that lie entirely outside the mask
+			if (occupied > 0.0f) {
+				tiles.push_back(tile);
+			}
+		}
+	}
+}
+
+// Recomputes tile bounds swept over the last step, padded by the contact distance
+void ClothSheet::updateTileBounds() {
+	vec3 vPadding = vec3{ CLOTH_CONTACT_DISTANCE, CLOTH_CONTACT_DISTANCE, CLOTH_CONTACT_DISTANCE };
+
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < (int)tiles.size(); k++) {
+		ClothTile &tile = tiles[k];
+		AABB tileBounds = emptyAABB();
+
+		for (int i = tile.rowBegin; i <= tile.rowEnd; i++) {
+			for (int j = tile.colBegin; j <= tile.colEnd; j++) {
+				if (particleMask[i * particles[i].size() + j] == 0.0f) {
+					continue;
+				}
+
+				tileBounds = expand(tileBounds, particles[i][j].position);
+				tileBounds = expand(tileBounds, particles[i][j].prevPosition);
+			}
+		}
+
+		tile.bounds = AABB{ tileBounds.min - vPadding, tileBounds.max + vPadding };
+	}
+
+	bounds = emptyAABB();
+
+	for (int k = 0; k < tiles.size(); k++) {
+		bounds = merge(bounds, tiles.at(k).bounds);
+	}
+}
+
+// Moves particles closer to their spring rest length over some number of iterations per substep
+// Returns the number of iterations run, fewer than requested if the tolerance was met
+int ClothSheet::satisfyConstraints(int iterations) {
+	GLfloat deltaDistance;
+	GLfloat maxError;
+	vec3 vCurrentDistance;
+	vec3 vConstraints;
+
+	Particle *p0;
+	Particle *p1;
+	Spring *spring;
+
+	// Note: Cloths in a solver island leave their springs to the island's coloured solve
+	int springRows = islandSolved ? 0 : (int)springs.size();
+
+	// Satisfying constraints the given number of times per substep
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		maxError = 0.0f;
+
+		for (int i = 0; i < springRows; i++) {
+			for (int j = 0; j < springs.at(i).size(); j++) {
+				spring = &springs.at(i).at(j);
+				p0 = spring->p0;
+				p1 = spring->p1;
+
+				vCurrentDistance = p0->position - p1->position;
+				deltaDistance = magnitude(vCurrentDistance);
+				maxError = std::max(maxError, fabs(deltaDistance - spring->restLength) / spring->restLength);
+
+				// Applying constraints to spring length under compression or tension
+				vConstraints = vCurrentDistance * (1.0f - spring->restLength / deltaDistance);
+				vConstraints = vConstraints * 0.5f;
+
+				if (!p0->pinned) {
+					p0->position = p0->position - vConstraints;
+				}
+
+				if (!p1->pinned) {
+					p1->position = p1->position + vConstraints;
+				}
+			}
+		}
+
+		// Pulling attached particles towards their targets
+		for (int j = 0; j < attachments.ids.size(); j++) {
+			Particle *attached = attachments.particles[j];
+
+			if (!attached->pinned) {
+				attached->position = attached->position + (attachments.targets[j] - attached->position) * attachments.stiffness[j];
+			}
+		}
+
+		// Note: The error is measured before this sweep's corrections, so the sweep that meets it still runs
+		if (maxError < constraintTolerance) {
+			return iteration + 1;
+		}
+	}
+
+	return iterations;
+}
+
+// Accumulates forces on each particle and stores acceleration
+void ClothSheet::accumulateForces() {
+	//Applying wind force
+	vec3 vWindNormal = normalize(vWindForce);
+	vec3 vWindAcceleration;
+	int occlusionCloth = windOcclusion != 0 ? windOcclusion->findCloth(this) : -1;
+
+	Particle *v0;
+	Particle *v1;
+	Particle *v2;
+	vec3 vFaceNormal;
+
+	// Note: Positions haven't moved since the last step ended, so normals drawn since then are reused
+	const std::vector<vec3> &normals = getFaceNormals();
+
+	for (int k = 0; k < particles.size() - 1; k++) {
+		for (int l = 0; l < particles.at(k).size() - 1; l++) {
+			int triangle = triangleIndex(k, l);
+
+			if (triangle < 0) {
+				continue;
+			}
+
+			GLfloat cellWeight = cellMask[k * (particles.at(k).size() - 1) + l];
+
+			// Upper tri normal for wind force acceleration
+			v0 = &particles.at(k + 1).at(l);
+			v1 = &particles.at(k).at(l);
+			v2 = &particles.at(k).at(l + 1);
+
+			vFaceNormal = normals[triangle];
+
+			vWindAcceleration = vFaceNormal * dot(vFaceNormal, vWindForce);
+			vWindAcceleration = (vWindAcceleration / (v0->mass + v1->mass + v2->mass)) * cellWeight;
+
+			if (windOcclusion != 0) {
+				vWindAcceleration = vWindAcceleration * windOcclusion->sample(occlusionCloth, (v0->position + v1->position + v2->position) / 3.0f);
+			}
+
+			v0->acceleration = v0->acceleration + vWindAcceleration;
+			v1->acceleration = v1->acceleration + vWindAcceleration;
+			v2->acceleration = v2->acceleration + vWindAcceleration;
+
+			// Lower tri normal for wind force acceleration
+			v1 = v2;
+			v2 = &particles.at(k + 1).at(l + 1);
+
+			vFaceNormal = normals[triangle + 1];
+
+			vWindAcceleration = vFaceNormal * dot(vFaceNormal, vWindForce);
+			vWindAcceleration = (vWindAcceleration / (v0->mass + v1->mass + v2->mass)) * cellWeight;
+
+			if (windOcclusion != 0) {
+				vWindAcceleration = vWindAcceleration * windOcclusion->sample(occlusionCloth, (v0->position + v1->position + v2->position) / 3.0f);
+			}
+
+			v0->acceleration = v0->acceleration + vWindAcceleration;
+			v1->acceleration = v1->acceleration + vWindAcceleration;
+			v2->acceleration = v2->acceleration + vWindAcceleration;
+		}
+	}
+
+	// Applying gravity and spring forces
+	GLfloat deltaDistance;
+	GLfloat currentDistMagnitude;
+	vec3 vCurrentDistance;
+	vec3 vSpringAcceleration;
+	vec3 vConstraints;
+
+	Particle *p0;
+	Particle *p1;
+	Spring *spring;
+
+	// Note: The fused kernel adds gravity during integration instead
+	vec3 vGravity = usesFusedKernel() ? vec3{ 0.0f, 0.0f, 0.0f } : gravity;
+
+	for (int i = 0; i < springs.size(); i++) {
+		for (int j = 0; j < springs.at(i).size(); j++) {
+			spring = &springs.at(i).at(j);
+			p0 = spring->p0;
+			p1 = spring->p1;
+
+			vCurrentDistance = p0->position - p1->position;
+			currentDistMagnitude = magnitude(vCurrentDistance);
+			deltaDistance = currentDistMagnitude - spring->restLength;
+
+			vSpringAcceleration = (vCurrentDistance / currentDistMagnitude) * (springK * deltaDistance);
+			vSpringAcceleration = vSpringAcceleration / p0->mass;
+
+			p0->acceleration = (vGravity / p0->mass) - vSpringAcceleration + p0->acceleration;
+			p1->acceleration = (vGravity / p1->mass) + vSpringAcceleration + p1->acceleration;
+		}
+	}
+}
+
+/////////////////////
+// class: RopeBatch
+/////////////////
+
+RopeBatch::RopeBatch(vec4 color, int nodeCount) {
+	this->color = color;
+	this->nodeCount = std::max(nodeCount, 2);
+	position = vec3{ 0.0f, 0.0f, 0.0f };
+	strandCount = 0;
+	iterations = ROPE_ITERATIONS;
+	timeStep = DEFAULT_TIME_STEP;
+}
+
+// Adds a straight strand from root to tip, returning its index
+// Note: Re-lays out every array to keep the strand index fastest, so strands should be added before simulating
+int RopeBatch::addStrand(vec3 root, vec3 tip, bool pinnedRoot) {
+	int newCount = strandCount + 1;
+	std::vector<GLfloat> *nodeArrays[7] = { &positionX, &positionY, &positionZ,
+		&prevPositionX, &prevPositionY, &prevPositionZ, &inverseMass };
+
+	for (int a = 0; a < 7; a++) {
+		std::vector<GLfloat> relaid(nodeCount * newCount);
+
+		for (int i = 0; i < nodeCount; i++) {
+			for (int s = 0; s < strandCount; s++) {
+				relaid[i * newCount + s] = (*nodeArrays[a])[i * strandCount + s];
+			}
+		}
+
+		nodeArrays[a]->swap(relaid);
+	}
+
+	strandCount = newCount;
+
+	for (int i = 0; i < nodeCount; i++) {
+		vec3 point = root + (tip - root) * ((GLfloat)i / (nodeCount - 1));
+		int index = i * strandCount + strandCount - 1;
+
+		setNode(index, point);
+		inverseMass[index] = (i == 0 && pinnedRoot) ? 0.0f : 1.0f;
+	}
+
+	restLengths.push_back(magnitude(tip - root) / (nodeCount - 1));
+
+	int segments = (nodeCount - 1) * strandCount;
+	std::vector<GLfloat> *segmentArrays[6] = { &directionX, &directionY, &directionZ, &diagonal, &offDiagonal, &lambda };
+
+	for (int a = 0; a < 6; a++) {
+		segmentArrays[a]->resize(segments);
+	}
+
+	position = getPosition();
+
+	return strandCount - 1;
+}
+
+// Moves a node to the point at rest, pinning or freeing it. Rest lengths keep the strand's original spacing
+void RopeBatch::placeNode(int strand, int node, vec3 point, bool pinned) {
+	int index = node * strandCount + strand;
+
+	setNode(index, point);
+	inverseMass[index] = pinned ? 0.0f : 1.0f;
+}
+
+// Exact constraint solves per move
+void RopeBatch::setIterations(int iterations) {
+	this->iterations = std::max(iterations, 1);
+}
+
+// Solver time per move, matching ClothSheet::setTimeStep
+void RopeBatch::setTimeStep(GLfloat timeStep) {
+	this->timeStep = timeStep;
+}
+
+// Draws each strand as an unlit line strip
+void RopeBatch::draw() {
+	glPushMatrix();
+	glDisable(GL_LIGHTING);
+	glLineWidth(2.0f);
+	glColor4f(color.x, color.y, color.z, color.w);
+
+	for (int s = 0; s < strandCount; s++) {
+		glBegin(GL_LINE_STRIP);
+
+		for (int i = 0; i < nodeCount; i++) {
+			int index = i * strandCount + s;
+			glVertex3f(positionX[index], positionY[index], positionZ[index]);
+		}
+
+		glEnd();
+	}
+
+	glEnable(GL_LIGHTING);
+	glPopMatrix();
+}
+
+// Verlet step under gravity, then alternating exact constraint solves and collision projection
+// Note: Like ClothSheet the solver advances by a fixed timeStep per move, and ropes carry no animation to
+// drive with the frame time
+void RopeBatch::move(long) {
+	if (strandCount == 0) {
+		return;
+	}
+
+	integrate(timeStep * timeStep);
+
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		solveConstraints();
+		handleCollision();
+	}
+
+	position = getPosition();
+}
+
+void RopeBatch::integrate(GLfloat timeTSquared) {
+	int count = nodeCount * strandCount;
+	GLfloat *x = &positionX[0];
+	GLfloat *y = &positionY[0];
+	GLfloat *z = &positionZ[0];
+	GLfloat *prevX = &prevPositionX[0];
+	GLfloat *prevY = &prevPositionY[0];
+	GLfloat *prevZ = &prevPositionZ[0];
+	const GLfloat *w = &inverseMass[0];
+
+	// Note: Inverse mass is 0 or 1, so multiplying by it freezes pinned nodes without a branch
+	#pragma omp simd
+	for (int k = 0; k < count; k++) {
+		GLfloat stepX = ((x[k] - prevX[k]) * ROPE_DAMPING + gravity.x * timeTSquared) * w[k];
+		GLfloat stepY = ((y[k] - prevY[k]) * ROPE_DAMPING + gravity.y * timeTSquared) * w[k];
+		GLfloat stepZ = ((z[k] - prevZ[k]) * ROPE_DAMPING + gravity.z * timeTSquared) * w[k];
+
+		prevX[k] = x[k];
+		prevY[k] = y[k];
+		prevZ[k] = z[k];
+		x[k] += stepX;
+		y[k] += stepY;
+		z[k] += stepZ;
+	}
+}
+
+// Solves (J W J^T) lambda = -C for every strand's segment lengths at once. The matrix is tridiagonal with
+// w_i + w_i+1 on the diagonal and -w_i+1 (n_i . n_i+1) beside it, so the Thomas algorithm solves it in O(n)
+void RopeBatch::solveConstraints() {
+	int segments = nodeCount - 1;
+	int n = strandCount;
+	GLfloat *x = &positionX[0];
+	GLfloat *y = &positionY[0];
+	GLfloat *z = &positionZ[0];
+	const GLfloat *w = &inverseMass[0];
+	const GLfloat *rest = &restLengths[0];
+	GLfloat *dx = &directionX[0];
+	GLfloat *dy = &directionY[0];
+	GLfloat *dz = &directionZ[0];
+	GLfloat *diag = &diagonal[0];
+	GLfloat *upper = &offDiagonal[0];
+	GLfloat *rhs = &lambda[0];
+
+	// Segment directions, constraint errors and matrix entries
+	for (int i = 0; i < segments; i++) {
+		#pragma omp simd
+		for (int s = 0; s < n; s++) {
+			int a = i * n + s;
+			int b = a + n;
+			GLfloat ex = x[b] - x[a];
+			GLfloat ey = y[b] - y[a];
+			GLfloat ez = z[b] - z[a];
+			GLfloat length = sqrt(ex * ex + ey * ey + ez * ez);
+			GLfloat inverseLength = 1.0f / std::max(length, 1e-12f);
+
+			dx[a] = ex * inverseLength;
+			dy[a] = ey * inverseLength;
+			dz[a] = ez * inverseLength;
+			rhs[a] = rest[s] - length;
+
+			// Note: The small term keeps segments with both ends pinned from making the system singular
+			diag[a] = w[a] + w[b] + 1e-6f;
+		}
+	}
+
+	for (int i = 0; i < segments - 1; i++) {
+		#pragma omp simd
+		for (int s = 0; s < n; s++) {
+			int a = i * n + s;
+			int b = a + n;
+
+			upper[a] = -w[b] * (dx[a] * dx[b] + dy[a] * dy[b] + dz[a] * dz[b]);
+		}
+	}
+
+	// Forward elimination, leaving the scaled upper diagonal in upper and the scaled right-hand side in rhs
+	#pragma omp simd
+	for (int s = 0; s < n; s++) {
+		upper[s] = (segments > 1) ? upper[s] / diag[s] : 0.0f;
+		rhs[s] = rhs[s] / diag[s];
+	}
+
+	for (int i = 1; i < segments; i++) {
+		#pragma omp simd
+		for (int s = 0; s < n; s++) {
+			int a = i * n + s;
+			int previous = a - n;
+			GLfloat lower = -w[a] * (dx[previous] * dx[a] + dy[previous] * dy[a] + dz[previous] * dz[a]);
+			GLfloat denominator = diag[a] - lower * upper[previous];
+
+			upper[a] = (i < segments - 1) ? upper[a] / denominator : 0.0f;
+			rhs[a] = (rhs[a] - lower * rhs[previous]) / denominator;
+		}
+	}
+
+	// Back substitution, rhs becomes lambda
+	for (int i = segments - 2; i >= 0; i--) {
+		#pragma omp simd
+		for (int s = 0; s < n; s++) {
+			int a = i * n + s;
+			rhs[a] -= upper[a] * rhs[a + n];
+		}
+	}
+
+	// Applying dx_j = w_j (lambda_j-1 n_j-1 - lambda_j n_j)
+	for (int j = 0; j < nodeCount; j++) {
+		#pragma omp simd
+		for (int s = 0; s < n; s++) {
+			int k = j * n + s;
+			GLfloat before = (j > 0) ? rhs[k - n] : 0.0f;
+			GLfloat after = (j < segments) ? rhs[k] : 0.0f;
+			GLfloat beforeX = (j > 0) ? dx[k - n] : 0.0f;
+			GLfloat beforeY = (j > 0) ? dy[k - n] : 0.0f;
+			GLfloat beforeZ = (j > 0) ? dz[k - n] : 0.0f;
+			GLfloat afterX = (j < segments) ? dx[k] : 0.0f;
+			GLfloat afterY = (j < segments) ? dy[k] : 0.0f;
+			GLfloat afterZ = (j < segments) ? dz[k] : 0.0f;
+
+			x[k] += w[k] * (before * beforeX - after * afterX);
+			y[k] += w[k] * (before * beforeY - after * afterY);
+			z[k] += w[k] * (before * beforeZ - after * afterZ);
+		}
+	}
+}
+
+// Projects nodes out of the same sphere, capsule and mesh colliders the cloth uses
+void RopeBatch::handleCollision() {
+	int count = nodeCount * strandCount;
+
+	for (int c = 0; c < potentialColliders.size(); c++) {
+		Sphere *collidable = potentialColliders.at(c);
+
+		for (int k = 0; k < count; k++) {
+			vec3 node = vec3{ positionX[k], positionY[k], positionZ[k] };
+
+			if (inverseMass[k] > 0.0f && collidable->contains(node)) {
+				vec3 vNormalizedDist = normalize(node - collidable->getPosition());
+				setNode(k, collidable->getPosition() + vNormalizedDist * (collidable->getRadius() * (1.0f + COLLIDER_SURFACE_OFFSET)));
+			}
+		}
+	}
+
+	for (int c = 0; c < capsuleColliders.size(); c++) {
+		Capsule *capsule = capsuleColliders.at(c);
+
+		for (int k = 0; k < count; k++) {
+			vec3 node = vec3{ positionX[k], positionY[k], positionZ[k] };
+
+			if (inverseMass[k] > 0.0f && capsule->contains(node)) {
+				vec3 vAxisPoint = closestPointOnSegment(node, capsule->getStart(), capsule->getEnd());
+				setNode(k, vAxisPoint + normalize(node - vAxisPoint) * (capsule->getRadius() * (1.0f + COLLIDER_SURFACE_OFFSET)));
+			}
+		}
+	}
+
+	for (int m = 0; m < meshColliders.size(); m++) {
+		MeshCollider *mesh = meshColliders.at(m);
+		GLfloat maxDisplacement = 0.0f;
+
+		meshQueryPoints.resize(count);
+
+		for (int k = 0; k < count; k++) {
+			meshQueryPoints[k] = vec3{ positionX[k], positionY[k], positionZ[k] };
+			maxDisplacement = std::max(maxDisplacement, magnitude(meshQueryPoints[k] - vec3{ prevPositionX[k], prevPositionY[k], prevPositionZ[k] }));
+		}
+
+		mesh->closestPoints(meshQueryPoints, MESH_CONTACT_DISTANCE + maxDisplacement + mesh->getMaxDisplacement(), meshContacts);
+
+		for (int k = 0; k < count; k++) {
+			MeshContact &contact = meshContacts[k];
+
+			if (contact.triangle >= 0 && contact.distance < CLOTH_THICKNESS && inverseMass[k] > 0.0f) {
+				setNode(k, contact.closest + contact.normal * CLOTH_THICKNESS);
+			}
+		}
+	}
+}
+
+void RopeBatch::setNode(int index, const vec3 &point) {
+	positionX[index] = prevPositionX[index] = point.x;
+	positionY[index] = prevPositionY[index] = point.y;
+	positionZ[index] = prevPositionZ[index] = point.z;
+}
+
+void RopeBatch::pushCollidable(Sphere *collidable) {
+	potentialColliders.push_back(collidable);
+}
+
+void RopeBatch::pushCollidable(Capsule *collidable) {
+	capsuleColliders.push_back(collidable);
+}
+
+void RopeBatch::pushCollidable(MeshCollider *collidable) {
+	meshColliders.push_back(collidable);
+}
+
+// Average of the strand roots
+vec3 RopeBatch::getPosition() {
+	vec3 sum = vec3{ 0.0f, 0.0f, 0.0f };
+
+	for (int s = 0; s < strandCount; s++) {
+		sum = sum + getNode(s, 0);
+	}
+
+	return strandCount > 0 ? sum / (GLfloat)strandCount : sum;
+}
+
+vec3 RopeBatch::getNode(int strand, int node) {
+	int index = node * strandCount + strand;
+	return vec3{ positionX[index], positionY[index], positionZ[index] };
+}
+
+int RopeBatch::getStrandCount() {
+	return strandCount;
+}
+
+int RopeBatch::getNodeCount() {
+	return nodeCount;
+}
+
+GLfloat RopeBatch::getRestLength(int strand) {
+	return restLengths.at(strand);
+}
+
+////////////////
+// class: Wind
+/////////////
+
+Wind::Wind(vec3 &windForce) {
+	timeBlowing = 0;
+	this->windForce = windForce;
+	enabled = true;
+}
+
+vec3 Wind::generateWindForce(long deltaT) {
+	timeBlowing += deltaT;
+
+	// Switching wind direction every 1.2 seconds;
+	if (timeBlowing > 1200) {
+		timeBlowing = 0;
+		windForce = windForce * -1.0f;
+	}
+
+    // Returning wind if enabled, 0 vector otherwise
+	return (enabled) ? windForce : vec3{ 0.0f, 0.0f, 0.0f };
+}
+
+void Wind::toggleWind() {
+	enabled = !enabled;
+}
+
+/////////////////////////
+// class: BenchmarkScene
+/////////////////////
+
+// Builds the named scene, leaving it invalid for unknown names
+BenchmarkScene::BenchmarkScene(const std::string &name, unsigned int seed) : random(seed) {
+	this->name = name;
+	world = new EntityWorld();
+	clothCollisions = new ClothCollisionSystem();
+	windOcclusion = new WindOcclusionGrid();
+	wind = 0;
+	time = 0;
+	valid = true;
+
+	generateSpherifiedCube(16, sphereVertices);
+
+	if (name == "flag") {
+		buildFlag();
+	} else if (name == "drape") {
+		buildDrape();
+	} else if (name == "curtains") {
+		buildCurtains();
+	} else if (name == "crumple") {
+		buildCrumple();
+	} else if (name == "obstacles") {
+		buildObstacles();
+	} else if (name == "catenary") {
+		buildCatenary();
+	} else if (name == "sag") {
+		buildSag();
+	} else {
+		valid = false;
+	}
+}
+
+BenchmarkScene::~BenchmarkScene() {
+	for (int i = 0; i < cloths.size(); i++) {
+		delete cloths.at(i);
+	}
+
+	for (int i = 0; i < ropes.size(); i++) {
+		delete ropes.at(i);
+	}
+
+	for (int i = 0; i < spheres.size(); i++) {
+		delete spheres.at(i);
+	}
+
+	for (int i = 0; i < capsules.size(); i++) {
+		delete capsules.at(i);
+	}
+
+	for (int i = 0; i < meshColliders.size(); i++) {
+		delete meshColliders.at(i);
+	}
+
+	for (int i = 0; i < tracks.size(); i++) {
+		delete tracks.at(i);
+	}
+
+	delete world;
+	delete clothCollisions;
+	delete windOcclusion;
+	delete wind;
+}
+
+const std::vector<std::string> &BenchmarkScene::getSceneNames() {
+	static const std::vector<std::string> names = { "flag", "drape", "curtains", "crumple", "obstacles", "catenary", "sag" };
+
+	return names;
+}
+
+// Same stage order as driver(): colliders, wind, cloths, cloth-cloth contact, then ropes
+void BenchmarkScene::step(long deltaT) {
+	time += deltaT;
+
+	for (int i = 0; i < spheres.size(); i++) {
+		spheres.at(i)->move(deltaT);
+	}
+
+	for (int i = 0; i < meshColliders.size(); i++) {
+		meshColliders.at(i)->move(deltaT);
+	}
+
+	world->update(deltaT);
+
+	vec3 windForce = generateWindForce(deltaT);
+	windOcclusion->update(windForce);
+
+	for (int i = 0; i < cloths.size(); i++) {
+		cloths.at(i)->applyWindForce(windForce);
+		cloths.at(i)->move(deltaT);
+	}
+
+	clothCollisions->handleCollisions();
+
+	for (int i = 0; i < ropes.size(); i++) {
+		ropes.at(i)->move(deltaT);
+	}
+}
+
+bool BenchmarkScene::isValid() {
+	return valid;
+}
+
+int BenchmarkScene::getParticleCount() {
+	int count = 0;
+
+	for (int i = 0; i < cloths.size(); i++) {
+		count += (int)(cloths.at(i)->getParticles().size() * cloths.at(i)->getParticles().at(0).size());
+	}
+
+	for (int i = 0; i < ropes.size(); i++) {
+		count += ropes.at(i)->getStrandCount() * ropes.at(i)->getNodeCount();
+	}
+
+	return count;
+}
+
+std::vector<ClothSheet*> &BenchmarkScene::getCloths() {
+	return cloths;
+}
+
+std::vector<RopeBatch*> &BenchmarkScene::getRopes() {
+	return ropes;
+}
+
+// Reports every cloth's events, and contacts between cloths, to the queue
+void BenchmarkScene::setEventQueue(SimulationEventQueue *queue) {
+	for (int i = 0; i < cloths.size(); i++) {
+		cloths.at(i)->setEventQueue(queue);
+	}
+
+	clothCollisions->setEventQueue(queue);
+}
+
+// Note: Built from the raw generator output, since std distributions may differ between standard libraries
+GLfloat BenchmarkScene::uniform(GLfloat min, GLfloat max) {
+	return min + (max - min) * (GLfloat)(random() / 4294967296.0);
+}
+
+ClothSheet *BenchmarkScene::addCloth(vec3 position, int rows, int cols) {
+	vec4 color = vec4{ 0.212f, 0.969f, 0.627f, 1.0f };
+	ClothSheet *cloth = new ClothSheet(position, color, rows, cols);
+
+	cloths.push_back(cloth);
+	clothCollisions->pushCloth(cloth);
+	cloth->pushCollidable(world);
+
+	return cloth;
+}
+
+// Static unless given a keyframe track afterwards
+Sphere *BenchmarkScene::addSphere(vec3 position, GLfloat radius) {
+	vec4 color = vec4{ 0.212f, 0.969f, 0.627f, 1.0f };
+	Sphere *sphere = new Sphere(position, color, 1.0f, radius, sphereVertices);
+
+	sphere->toggleMovement();
+	spheres.push_back(sphere);
+	windOcclusion->pushCollidable(sphere);
+
+	for (int i = 0; i < cloths.size(); i++) {
+		cloths.at(i)->pushCollidable(sphere);
+	}
+
+	return sphere;
+}
+
+// A closed sphere mesh whose surface wobbles in lobes travelling around its vertical axis, cached as one
+// looping cycle of mesh frames. Collides with every cloth added so far
+// Note: The wobble is small enough to keep the body convex, so particles pushed inside always find their
+// closest point on a face rather than collapsing onto a crease
+MeshCollider *BenchmarkScene::addWobblingBlob(vec3 center, GLfloat radius) {
+	vec4 color = vec4{ 0.627f, 0.212f, 0.969f, 1.0f };
+	MeshCollider *blob = new MeshCollider(color);
+	std::vector< std::vector<vec3>> frames(SCENE_BLOB_FRAMES);
+	std::vector<int> indices;
+	GLfloat phase = uniform(0.0f, 2.0f * PI);
+	int stacks = SCENE_BLOB_STACKS;
+	int slices = 2 * SCENE_BLOB_STACKS;
+	int bottom = (stacks - 1) * slices + 1;
+
+	// Vertices are the top pole, stacks - 1 rings of slices vertices from the top down, then the bottom pole
+	for (int f = 0; f < frames.size(); f++) {
+		GLfloat cycle = 2.0f * PI * f / frames.size() + phase;
+
+		frames.at(f).push_back(center + vec3{ 0.0f, radius, 0.0f });
+
+		for (int i = 1; i < stacks; i++) {
+			GLfloat polar = PI * i / stacks;
+
+			for (int j = 0; j < slices; j++) {
+				GLfloat azimuth = 2.0f * PI * j / slices;
+				GLfloat wobble = 1.0f + SCENE_BLOB_WOBBLE * sin(polar) * sin(SCENE_BLOB_LOBES * azimuth - cycle);
+
+				frames.at(f).push_back(center + vec3{ sin(polar) * cos(azimuth), cos(polar), -sin(polar) * sin(azimuth) } * (radius * wobble));
+			}
+		}
+
+		frames.at(f).push_back(center - vec3{ 0.0f, radius, 0.0f });
+	}
+
+	// Fans around the poles and two triangles per quad between rings, wound counter-clockwise seen from outside
+	for (int j = 0; j < slices; j++) {
+		int next = (j + 1) % slices;
+
+		indices.push_back(0);
+		indices.push_back(1 + j);
+		indices.push_back(1 + next);
+
+		for (int i = 1; i < stacks - 1; i++) {
+			int upper = 1 + (i - 1) * slices;
+			int lower = upper + slices;
+			int quad[6] = { upper + j, lower + j, lower + next, upper + j, lower + next, upper + next };
+
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+
+		indices.push_back(bottom);
+		indices.push_back(bottom - slices + next);
+		indices.push_back(bottom - slices + j);
+	}
+
+	blob->setAnimationCache(indices, frames, SCENE_BLOB_FRAME_DURATION);
+	meshColliders.push_back(blob);
+	windOcclusion->pushCollidable(blob);
+
+	for (int i = 0; i < cloths.size(); i++) {
+		cloths.at(i)->pushCollidable(blob);
+	}
+
+	return blob;
+}
+
+// The regular reversing wind plus three sinusoidal gusts with seeded frequencies, phases and directions,
+// up to gustiness times the wind's strength along each axis
+// Note: Cloth accelerations carry over between frames, so any steady wind would keep building up. Both parts
+// average out to zero over time
+void BenchmarkScene::addTurbulentWind(vec3 windForce, GLfloat gustiness) {
+	GLfloat strength = magnitude(windForce) * gustiness;
+
+	wind = new Wind(windForce);
+
+	for (int k = 0; k < 3; k++) {
+		gustFrequencies.push_back(uniform(0.002f, 0.012f));
+		gustPhases.push_back(uniform(0.0f, 2.0f * PI));
+		gustAmplitudes.push_back(vec3{ uniform(-strength, strength), uniform(-strength, strength), uniform(-strength, strength) });
+	}
+
+	for (int i = 0; i < cloths.size(); i++) {
+		windOcclusion->pushCloth(cloths.at(i));
+	}
+}
+
+vec3 BenchmarkScene::generateWindForce(long deltaT) {
+	if (wind == 0) {
+		return vec3{ 0.0f, 0.0f, 0.0f };
+	}
+
+	vec3 windForce = wind->generateWindForce(deltaT);
+
+	for (int k = 0; k < gustFrequencies.size(); k++) {
+		windForce = windForce + gustAmplitudes.at(k) * sin(gustFrequencies.at(k) * time + gustPhases.at(k));
+	}
+
+	return windForce;
+}
+
+// A flag held along its left edge, flapping in gusty wind blowing through it
+void BenchmarkScene::buildFlag() {
+	ClothSheet *flag = addCloth(vec3{ -1.0f, 1.0f, -2.0f }, 40, 64);
+	std::vector< std::vector<Particle>> &particles = flag->getParticles();
+
+	flag->detach();
+
+	for (int i = 0; i < particles.size(); i++) {
+		flag->attach(&particles.at(i).at(0), particles.at(i).at(0).position, 1.0f);
+	}
+
+	addTurbulentWind(vec3{ 1.0f, 0.0f, -2.0f }, 0.75f);
+}
+
+// A loose square sheet falling flat onto a sphere and sliding into folds around it
+void BenchmarkScene::buildDrape() {
+	ClothSheet *cloth = addCloth(vec3{ -1.0f, 0.8f, -1.0f }, 64, 64);
+
+	cloth->layFlat();
+	cloth->detach();
+	addSphere(vec3{ 0.0f, 0.0f, -2.0f }, 0.6f);
+}
+
+// 32 curtains hung by their corners in a staggered row, each overlapping its neighbours so gusts push them
+// into one another
+void BenchmarkScene::buildCurtains() {
+	for (int k = 0; k < 32; k++) {
+		addCloth(vec3{ -12.8f + 0.8f * k, 1.0f, -2.0f - 0.05f * (k % 2) }, 32, 24);
+	}
+
+	addTurbulentWind(vec3{ 0.5f, 0.0f, -2.0f }, 1.0f);
+}
+
+// A self-colliding sheet dropped edge first onto the ground so it folds up on itself
+// Note: Particles start with a small seeded velocity so the sheet doesn't fall perfectly symmetrically.
+// Projection would push particles a fraction of the ground sphere's radius clear of it, so the ground
+// uses barrier contact
+void BenchmarkScene::buildCrumple() {
+	ClothSheet *cloth = addCloth(vec3{ -1.0f, 1.0f, -2.0f }, 48, 48);
+	std::vector< std::vector<Particle>> &particles = cloth->getParticles();
+
+	cloth->detach();
+	cloth->toggleSelfCollision();
+	cloth->setContactMode(CONTACT_BARRIER);
+
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < particles.at(i).size(); j++) {
+			Particle &particle = particles.at(i).at(j);
+
+			particle.prevPosition = particle.prevPosition + vec3{ 0.0f, 0.0f, uniform(-0.0002f, 0.0002f) };
+		}
+	}
+
+	addSphere(vec3{ 0.0f, -1.2f - SCENE_GROUND_RADIUS, -2.0f }, SCENE_GROUND_RADIUS);
+}
+
+// A sheet falling through keyframed spheres, fixed capsules, a wobbling mesh and a crowd of small bouncing
+// sphere entities
+void BenchmarkScene::buildObstacles() {
+	ClothSheet *cloth = addCloth(vec3{ -1.0f, 1.0f, -1.0f }, 64, 64);
+
+	cloth->layFlat();
+	cloth->detach();
+
+	for (int k = 0; k < 6; k++) {
+		Sphere *sphere = addSphere(vec3{ uniform(-0.8f, 0.8f), uniform(-0.6f, 0.4f), uniform(-2.8f, -1.2f) }, uniform(0.15f, 0.3f));
+		KeyframeTrack *track = new KeyframeTrack();
+		vec3 center = sphere->getPosition();
+
+		for (int key = 0; key <= 4; key++) {
+			vec3 offset = (key == 0 || key == 4) ? vec3{ 0.0f, 0.0f, 0.0f }
+				: vec3{ uniform(-0.3f, 0.3f), uniform(-0.2f, 0.2f), uniform(-0.3f, 0.3f) };
+
+			track->addKey(key * 1000.0f, center + offset);
+		}
+
+		tracks.push_back(track);
+		sphere->setKeyframeTrack(track);
+		sphere->toggleMovement();
+	}
+
+	for (int k = 0; k < 3; k++) {
+		vec3 start = vec3{ uniform(-1.0f, 1.0f), uniform(-1.0f, -0.2f), -3.0f };
+		vec3 end = vec3{ uniform(-1.0f, 1.0f), uniform(-1.0f, -0.2f), -1.0f };
+		vec4 color = vec4{ 0.969f, 0.627f, 0.212f, 1.0f };
+		Capsule *capsule = new Capsule(start, end, color, 0.1f);
+
+		capsules.push_back(capsule);
+		cloth->pushCollidable(capsule);
+	}
+
+	AABB crowdBounds = AABB{ vec3{ -1.0f, -1.2f, -3.0f }, vec3{ 1.0f, 0.0f, -1.0f } };
+
+	for (int c = 0; c < 200; c++) {
+		vec3 start = vec3{ uniform(-1.0f, 1.0f), uniform(-1.2f, 0.0f), uniform(-3.0f, -1.0f) };
+		vec3 velocity = vec3{ uniform(-0.5f, 0.5f), uniform(-0.5f, 0.5f), uniform(-0.5f, 0.5f) } * SPHERE_SPEED;
+		Entity entity = world->createEntity(start);
+
+		world->addBounceMotion(entity, velocity, crowdBounds);
+		world->addSphereCollider(entity, 0.05f);
+	}
+
+	addWobblingBlob(vec3{ 0.0f, -0.9f, -2.0f }, 0.4f);
+}
+
+// A hanging chain with its ends pinned closer together than its length, placed on the catenary it hangs in
+// Note: Nodes are spaced evenly along the curve's arc length, x = a * asinh(s / a) from the middle, so every
+// link starts at its rest length
+void BenchmarkScene::buildCatenary() {
+	vec4 color = vec4{ 0.969f, 0.627f, 0.212f, 1.0f };
+	RopeBatch *chain = new RopeBatch(color, 41);
+	vec3 middle = vec3{ 0.0f, 0.5f, -2.0f };
+	double length = 2.0;
+	double span = length * EVALUATION_CATENARY_SPAN;
+	double a = solveCatenaryParameter(span, length);
+	int last = chain->getNodeCount() - 1;
+
+	chain->addStrand(middle - vec3{ (GLfloat)length / 2.0f, 0.0f, 0.0f }, middle + vec3{ (GLfloat)length / 2.0f, 0.0f, 0.0f }, true);
+
+	for (int i = 0; i <= last; i++) {
+		double x = a * asinh((length * i / last - length / 2.0) / a);
+		double y = -a * (cosh(span / (2.0 * a)) - cosh(x / a));
+
+		chain->placeNode(0, i, middle + vec3{ (GLfloat)x, (GLfloat)y, 0.0f }, i == 0 || i == last);
+	}
+
+	ropes.push_back(chain);
+}
+
+// A flat sheet pinned at its four corners, sagging and swinging under its own weight
+void BenchmarkScene::buildSag() {
+	ClothSheet *cloth = addCloth(vec3{ -1.0f, 0.5f, -1.0f }, 32, 32);
+	std::vector< std::vector<Particle>> &particles = cloth->getParticles();
+
+	cloth->layFlat();
+	cloth->detach();
+
+	particles.front().front().pinned = true;
+	particles.front().back().pinned = true;
+	particles.back().front().pinned = true;
+	particles.back().back().pinned = true;
+}
+
+/////////////////////////////////
+// class: ClothCollisionSystem
+/////////////////////////////
+
+ClothCollisionSystem::ClothCollisionSystem() {
+	events = 0;
+}
+
+void ClothCollisionSystem::pushCloth(ClothSheet *cloth) {
+	cloths.push_back(cloth);
+
+	if (events != 0) {
+		events->registerCloth(cloth);
+	}
+}
+
+// Registers the system's cloths with the queue too, since contacts are recorded against either sheet
+void ClothCollisionSystem::setEventQueue(SimulationEventQueue *queue) {
+	events = queue;
+
+	for (int i = 0; i < cloths.size() && queue != 0; i++) {
+		queue->registerCloth(cloths.at(i));
+	}
+}
+
+// Pushes apart particles and triangles of different sheets that come within CLOTH_CONTACT_DISTANCE
+void ClothCollisionSystem::handleCollisions() {
+	tilePairs.clear();
+
+	// Broad phase: whole cloth bounds first, then tiles of overlapping cloths
+	for (int a = 0; a < cloths.size(); a++) {
+		for (int b = a + 1; b < cloths.size(); b++) {
+			if (overlaps(cloths.at(a)->getBounds(), cloths.at(b)->getBounds())) {
+				findTilePairs(a, b);
+			}
+		}
+	}
+
+	if (tilePairs.empty()) {
+		return;
+	}
+
+	// Narrow phase: contacts are only gathered here so overlapping pairs can run in parallel
+	pairContacts.resize(tilePairs.size());
+
+	#pragma omp parallel for schedule(dynamic, 4)
+	for (int k = 0; k < (int)tilePairs.size(); k++) {
+		pairContacts[k].clear();
+		collideTiles(tilePairs[k], pairContacts[k]);
+	}
+
+	// Applying corrections serially since neighbouring pairs share particles
+	for (int k = 0; k < tilePairs.size(); k++) {
+		for (int c = 0; c < pairContacts.at(k).size(); c++) {
+			ClothContact &contact = pairContacts.at(k).at(c);
+			const Triangle *tri = contact.triangle;
+			Particle *vertices[3] = { tri->v0, tri->v1, tri->v2 };
+			GLfloat weights[3] = { contact.barycentric.x, contact.barycentric.y, contact.barycentric.z };
+
+			// Note: Pinned particles don't move, so the rest of the contact takes up their share
+			GLfloat particleWeight = contact.particle->pinned ? 0.0f : 1.0f;
+			GLfloat totalWeight = particleWeight;
+
+			for (int v = 0; v < 3; v++) {
+				totalWeight += vertices[v]->pinned ? 0.0f : weights[v] * weights[v];
+			}
+
+			if (totalWeight <= 0.0f) {
+				continue;
+			}
+
+			contact.particle->position = contact.particle->position + contact.correction * (particleWeight / totalWeight);
+
+			for (int v = 0; v < 3; v++) {
+				if (!vertices[v]->pinned) {
+					vertices[v]->position = vertices[v]->position - contact.correction * (weights[v] / totalWeight);
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < cloths.size(); i++) {
+		cloths.at(i)->invalidateDerived();
+	}
+}
+
+// Sort and sweep along x over the tiles of two overlapping cloths
+void ClothCollisionSystem::findTilePairs(int clothA, int clothB) {
+	std::vector<ClothTile> &tilesA = cloths.at(clothA)->getTiles();
+	std::vector<ClothTile> &tilesB = cloths.at(clothB)->getTiles();
+	AABB overlap = AABB{ componentMax(cloths.at(clothA)->getBounds().min, cloths.at(clothB)->getBounds().min),
+		componentMin(cloths.at(clothA)->getBounds().max, cloths.at(clothB)->getBounds().max) };
+
+	// Note: Entries are tile indices, offset by tilesA.size() for tiles of cloth B
+	std::vector<int> sorted;
+	sorted.reserve(tilesA.size() + tilesB.size());
+
+	for (int i = 0; i < tilesA.size(); i++) {
+		if (overlaps(tilesA.at(i).bounds, overlap)) {
+			sorted.push_back(i);
+		}
+	}
+
+	for (int i = 0; i < tilesB.size(); i++) {
+		if (overlaps(tilesB.at(i).bounds, overlap)) {
+			sorted.push_back((int)tilesA.size() + i);
+		}
+	}
+
+	int offset = (int)tilesA.size();
+	auto tileOf = [&](int entry) -> const ClothTile& {
+		return (entry < offset) ? tilesA[entry] : tilesB[entry - offset];
+	};
+
+	std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+		return tileOf(a).bounds.min.x < tileOf(b).bounds.min.x;
+	});
+
+	for (int i = 0; i < sorted.size(); i++) {
+		const ClothTile &tile = tileOf(sorted.at(i));
+
+		for (int j = i + 1; j < sorted.size(); j++) {
+			const ClothTile &other = tileOf(sorted.at(j));
+
+			if (other.bounds.min.x > tile.bounds.max.x) {
+				break;
+			}
+
+			// Only pairing tiles from different cloths
+			if ((sorted.at(i) < offset) == (sorted.at(j) < offset) || !overlaps(tile.bounds, other.bounds)) {
+				continue;
+			}
+
+			int a = std::min(sorted.at(i), sorted.at(j));
+			int b = std::max(sorted.at(i), sorted.at(j));
+			tilePairs.push_back(TilePair{ clothA, a, clothB, b - offset });
+		}
+	}
+}
+
+void ClothCollisionSystem::collideTiles(const TilePair &pair, std::vector<ClothContact> &contacts) {
+	ClothSheet *clothA = cloths[pair.clothA];
+	ClothSheet *clothB = cloths[pair.clothB];
+	const ClothTile &tileA = clothA->getTiles()[pair.tileA];
+	const ClothTile &tileB = clothB->getTiles()[pair.tileB];
+
+	collideParticles(clothA, tileA, clothB, tileB, contacts);
+	collideParticles(clothB, tileB, clothA, tileA, contacts);
+}
+
+// Tests particles owned by one tile against the triangles of another
+void ClothCollisionSystem::collideParticles(ClothSheet *particleCloth, const ClothTile &particleTile,
+		ClothSheet *triangleCloth, const ClothTile &triangleTile, std::vector<ClothContact> &contacts) {
+	std::vector< std::vector<Particle>> &particles = particleCloth->getParticles();
+	std::vector<Triangle> &triangles = triangleCloth->getTriangles();
+	const std::vector<GLfloat> &particleMask = particleCloth->getParticleMask();
+
+	// Note: Tiles on the last row/col also own the particles on the sheet edge
+	int rowEnd = (particleTile.rowEnd == (int)particles.size() - 1) ? particleTile.rowEnd + 1 : particleTile.rowEnd;
+	int colEnd = (particleTile.colEnd == (int)particles[0].size() - 1) ? particleTile.colEnd + 1 : particleTile.colEnd;
+
+	for (int i = particleTile.rowBegin; i < rowEnd; i++) {
+		for (int j = particleTile.colBegin; j < colEnd; j++) {
+			Particle *particle = &particles[i][j];
+			AABB sweptBounds = expand(AABB{ particle->prevPosition, particle->prevPosition }, particle->position);
+
+			if (particleMask[i * particles[i].size() + j] == 0.0f || !overlaps(sweptBounds, triangleTile.bounds)) {
+				continue;
+			}
+
+			for (int k = triangleTile.rowBegin; k < triangleTile.rowEnd; k++) {
+				for (int l = triangleTile.colBegin; l < triangleTile.colEnd; l++) {
+					int first = triangleCloth->triangleIndex(k, l);
+
+					if (first < 0) {
+						continue;
+					}
+
+					for (int t = first; t < first + 2; t++) {
+						const Triangle &tri = triangles[t];
+						vec3 vFaceNormal = normalize(cross(tri.v1->position - tri.v0->position, tri.v2->position - tri.v0->position));
+						GLfloat prevSide = dot(particle->prevPosition - tri.v0->position, vFaceNormal);
+						GLfloat currSide = dot(particle->position - tri.v0->position, vFaceNormal);
+
+						// Skipping triangles whose plane stayed out of reach during the step
+						if (prevSide * currSide > 0.0f && fabs(currSide) >= CLOTH_CONTACT_DISTANCE) {
+							continue;
+						}
+
+						vec3 barycentric;
+						vec3 closest;
+
+						if (prevSide * currSide < 0.0f) {
+							// Particle passed through the plane this step, testing where it crossed
+							vec3 vCrossing = particle->position - vFaceNormal * currSide;
+							closest = closestPointOnTriangle(vCrossing, tri.v0->position, tri.v1->position, tri.v2->position, barycentric);
+
+							if (magnitude(vCrossing - closest) >= CLOTH_CONTACT_DISTANCE) {
+								continue;
+							}
+						} else {
+							closest = closestPointOnTriangle(particle->position, tri.v0->position, tri.v1->position, tri.v2->position, barycentric);
+
+							if (magnitude(particle->position - closest) >= CLOTH_CONTACT_DISTANCE) {
+								continue;
+							}
+						}
+
+						// Keeping the particle on the side of the triangle it came from
+						vec3 vNormal = (prevSide < 0.0f) ? vFaceNormal * -1.0f : vFaceNormal;
+						GLfloat separation = dot(particle->position - closest, vNormal);
+
+						contacts.push_back(ClothContact{ particle, &tri, barycentric,
+							vNormal * (CLOTH_CONTACT_DISTANCE - separation) });
+
+						if (events != 0) {
+							events->record(EVENT_CLOTH_CONTACT, particleCloth, particle, triangleCloth, CLOTH_CONTACT_DISTANCE - separation);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+///////////////////////////
+// class: ClothSeamSystem
+///////////////////////
+
+ClothSeamSystem::ClothSeamSystem() {
+	colorOffsets.assign(1, 0);
+	sewingTime = 0;
+	dirty = false;
+}
+
+void ClothSeamSystem::pushCloth(ClothSheet *cloth) {
+	if (std::find(cloths.begin(), cloths.end(), cloth) == cloths.end()) {
+		cloths.push_back(cloth);
+		cloth->setIslandSolved(true);
+		dirty = true;
+	}
+}
+
+// Sews one edge of clothA to one edge of clothB, resampling the shorter edge so both ends line up.
+// Returns the number of seams added, a sewDuration of 0 closes them immediately
+int ClothSeamSystem::stitch(ClothSheet *clothA, ClothEdgeSide sideA, ClothSheet *clothB, ClothEdgeSide sideB, long sewDuration) {
+	std::vector<Particle*> edgeA;
+	std::vector<Particle*> edgeB;
+
+	gatherEdge(clothA, sideA, edgeA);
+	gatherEdge(clothB, sideB, edgeB);
+
+	if (edgeA.empty() || edgeB.empty()) {
+		return 0;
+	}
+
+	pushCloth(clothA);
+	pushCloth(clothB);
+
+	int count = (int)std::max(edgeA.size(), edgeB.size());
+
+	for (int i = 0; i < count; i++) {
+		GLfloat t = (count > 1) ? (GLfloat)i / (count - 1) : 0.0f;
+		Particle *p0 = edgeA.at((int)(t * (edgeA.size() - 1) + 0.5f));
+		Particle *p1 = edgeB.at((int)(t * (edgeB.size() - 1) + 0.5f));
+		GLfloat startLength = magnitude(p0->position - p1->position);
+
+		seams.push_back(Seam{ p0, p1, startLength, std::min(startLength, SEAM_REST_LENGTH), sewingTime, sewDuration, -1 });
+	}
+
+	dirty = true;
+
+	return count;
+}
+
+// Collects the active particles along one side of a cloth, skipping any masked out
+void ClothSeamSystem::gatherEdge(ClothSheet *cloth, ClothEdgeSide side, std::vector<Particle*> &edge) {
+	std::vector< std::vector<Particle>> &particles = cloth->getParticles();
+	const std::vector<GLfloat> &particleMask = cloth->getParticleMask();
+	int rows = (int)particles.size();
+	int cols = (int)particles.at(0).size();
+	bool alongRow = (side == EDGE_TOP || side == EDGE_BOTTOM);
+	int length = alongRow ? cols : rows;
+
+	for (int k = 0; k < length; k++) {
+		int row = alongRow ? ((side == EDGE_TOP) ? 0 : rows - 1) : k;
+		int col = alongRow ? k : ((side == EDGE_LEFT) ? 0 : cols - 1);
+
+		if (particleMask[row * cols + col] != 0.0f) {
+			edge.push_back(&particles.at(row).at(col));
+		}
+	}
+}
+
+// Gathers every spring of the island's cloths plus the seams, then colours and reorders them by colour
+void ClothSeamSystem::buildIsland() {
+	std::vector<Particle*> p0s;
+	std::vector<Particle*> p1s;
+	std::vector<GLfloat> rests;
+	std::vector<int> seamIndices;
+
+	for (int c = 0; c < cloths.size(); c++) {
+		std::vector< std::vector<Spring>> &springs = cloths.at(c)->getSprings();
+
+		for (int i = 0; i < springs.size(); i++) {
+			for (int j = 0; j < springs.at(i).size(); j++) {
+				p0s.push_back(springs.at(i).at(j).p0);
+				p1s.push_back(springs.at(i).at(j).p1);
+				rests.push_back(springs.at(i).at(j).restLength);
+				seamIndices.push_back(-1);
+			}
+		}
+	}
+
+	for (int s = 0; s < seams.size(); s++) {
+		p0s.push_back(seams.at(s).p0);
+		p1s.push_back(seams.at(s).p1);
+		rests.push_back(seams.at(s).startLength);
+		seamIndices.push_back(s);
+	}
+
+	// Greedy colouring, each particle remembers the colours of the constraints already touching it
+	std::unordered_map<Particle*, unsigned long long> usedColors;
+	std::vector<int> colors(p0s.size());
+	std::vector<int> colorCounts(SEAM_MAX_COLORS + 1, 0);
+
+	for (int k = 0; k < p0s.size(); k++) {
+		unsigned long long &used0 = usedColors[p0s[k]];
+		unsigned long long &used1 = usedColors[p1s[k]];
+		unsigned long long used = used0 | used1;
+		int color = 0;
+
+		while (color < SEAM_MAX_COLORS && (used & (1ULL << color)) != 0) {
+			color++;
+		}
+
+		if (color < SEAM_MAX_COLORS) {
+			used0 |= 1ULL << color;
+			used1 |= 1ULL << color;
+		}
+
+		colors[k] = color;
+		colorCounts[color]++;
+	}
+
+	// Laying constraints out colour by colour, the overflow colour goes last and isn't given an offset
+	colorOffsets.assign(1, 0);
+	std::vector<int> colorSlots(SEAM_MAX_COLORS + 1, 0);
+
+	for (int color = 0; color < SEAM_MAX_COLORS && colorCounts[color] > 0; color++) {
+		colorSlots[color] = colorOffsets.back();
+		colorOffsets.push_back(colorOffsets.back() + colorCounts[color]);
+	}
+
+	colorSlots[SEAM_MAX_COLORS] = colorOffsets.back();
+
+	constraintP0.resize(p0s.size());
+	constraintP1.resize(p0s.size());
+	restLengths.resize(p0s.size());
+
+	for (int k = 0; k < p0s.size(); k++) {
+		int slot = colorSlots[colors[k]]++;
+
+		constraintP0[slot] = p0s[k];
+		constraintP1[slot] = p1s[k];
+		restLengths[slot] = rests[k];
+
+		if (seamIndices[k] >= 0) {
+			seams.at(seamIndices[k]).constraint = slot;
+		}
+	}
+
+	dirty = false;
+}
+
+// Advances sewing and runs the coloured projection sweeps over the whole island, as many as the cloths'
+// largest constraint iteration budget
+// Note: Springs are projected after the cloths' collision handling, so contact is restored on the next move
+void ClothSeamSystem::solve(long deltaT) {
+	if (dirty) {
+		buildIsland();
+	}
+
+	if (constraintP0.empty()) {
+		return;
+	}
+
+	int iterations = 1;
+
+	for (int i = 0; i < cloths.size(); i++) {
+		iterations = std::max(iterations, cloths.at(i)->getConstraintIterations());
+	}
+
+	sewingTime += deltaT;
+
+	for (int s = 0; s < seams.size(); s++) {
+		Seam &seam = seams.at(s);
+		GLfloat progress = 1.0f;
+
+		if (seam.sewDuration > 0) {
+			progress = std::min((GLfloat)(sewingTime - seam.startTime) / seam.sewDuration, 1.0f);
+		}
+
+		restLengths[seam.constraint] = seam.startLength + (seam.targetLength - seam.startLength) * progress;
+	}
+
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		for (int color = 0; color + 1 < colorOffsets.size(); color++) {
+			projectRange(colorOffsets[color], colorOffsets[color + 1], true);
+		}
+
+		// Overflow constraints may share particles, so they are projected serially
+		projectRange(colorOffsets.back(), (int)constraintP0.size(), false);
+	}
+
+	for (int i = 0; i < cloths.size(); i++) {
+		cloths.at(i)->refreshBounds();
+	}
+}
+
+// Projects constraints [begin, end), which only run in parallel when they touch disjoint particles
+void ClothSeamSystem::projectRange(int begin, int end, bool parallel) {
+	#pragma omp parallel for schedule(static) if(parallel)
+	for (int k = begin; k < end; k++) {
+		Particle *p0 = constraintP0[k];
+		Particle *p1 = constraintP1[k];
+		vec3 vCurrentDistance = p0->position - p1->position;
+		GLfloat deltaDistance = magnitude(vCurrentDistance);
+
+		// Note: Fully sewn seams can bring both particles together
+		if (deltaDistance > 1e-9f) {
+			vec3 vConstraints = vCurrentDistance * ((1.0f - restLengths[k] / deltaDistance) * 0.5f);
+
+			if (!p0->pinned) {
+				p0->position = p0->position - vConstraints;
+			}
+
+			if (!p1->pinned) {
+				p1->position = p1->position + vConstraints;
+			}
+		}
+	}
+}
+
+int ClothSeamSystem::getColorCount() {
+	return (int)colorOffsets.size() - 1 + ((colorOffsets.back() < constraintP0.size()) ? 1 : 0);
+}
+
+int ClothSeamSystem::getConstraintCount() {
+	return (int)constraintP0.size();
+}
+
+////////////////////////////////
+// class: SimulationEventQueue
+////////////////////////////
+
+SimulationEventQueue::SimulationEventQueue() {
+#ifdef _OPENMP
+	threadBuffers.resize(omp_get_max_threads());
+#else
+	threadBuffers.resize(1);
+#endif
+	step = 0;
+}
+
+// Safe to call from any thread of a parallel region, each thread only touches its own buffer
+void SimulationEventQueue::record(SimulationEventType type, ClothSheet *cloth, Particle *particle, const void *other, GLfloat magnitude) {
+#ifdef _OPENMP
+	int thread = omp_get_thread_num();
+#else
+	int thread = 0;
+#endif
+
+	threadBuffers[thread].events.push_back(SimulationEvent{ type, step, cloth, particle, other, particle->position, magnitude, -1, -1, -1 });
+}
+
+// Gives the cloth the next cloth index, which orders its events
+void SimulationEventQueue::registerCloth(ClothSheet *cloth) {
+	if (findCloth(cloth) < 0) {
+		clothIndices[cloth] = (int)cloths.size();
+		cloths.push_back(cloth);
+	}
+}
+
+int SimulationEventQueue::findCloth(const void *cloth) {
+	std::unordered_map<const void*, int>::iterator it = clothIndices.find(cloth);
+
+	return it != clothIndices.end() ? it->second : -1;
+}
+
+// Note: Particles are allocated once with their cloth, so each particle's index is only searched for the first
+// time it reports an event
+int SimulationEventQueue::findParticle(ClothSheet *cloth, const Particle *particle) {
+	std::unordered_map<const Particle*, int>::iterator it = particleIndices.find(particle);
+
+	if (it != particleIndices.end()) {
+		return it->second;
+	}
+
+	int index = cloth->getParticleIndex(particle);
+
+	particleIndices[particle] = index;
+	return index;
+}
+
+// Cloth index for other cloths, otherwise the collider's registration order with the reporting cloth
+int SimulationEventQueue::findOther(ClothSheet *cloth, const void *other) {
+	if (other == 0) {
+		return -1;
+	}
+
+	int otherCloth = findCloth(other);
+
+	if (otherCloth >= 0) {
+		return otherCloth;
+	}
+
+	std::pair<const void*, const void*> key(cloth, other);
+	std::map<std::pair<const void*, const void*>, int>::iterator it = colliderIndices.find(key);
+
+	if (it != colliderIndices.end()) {
+		return it->second;
+	}
+
+	int index = cloth->getColliderIndex(other);
+
+	colliderIndices[key] = index;
+	return index;
+}
+
+// Registration order of the cloth, -1 if it isn't registered
+int SimulationEventQueue::getClothIndex(const ClothSheet *cloth) {
+	return findCloth(cloth);
+}
+
+// Remembers how far every thread buffer has been filled this step
+SimulationEventMark SimulationEventQueue::mark() {
+	SimulationEventMark result = SimulationEventMark{ step, std::vector<int>(threadBuffers.size()) };
+
+	for (int t = 0; t < threadBuffers.size(); t++) {
+		result.sizes[t] = (int)threadBuffers[t].events.size();
+	}
+
+	return result;
+}
+
+// Drops the cloth's events recorded since the mark, e.g. by a step that was rolled back. Rollback reports,
+// events of other cloths and everything from earlier steps stay
+void SimulationEventQueue::discard(const SimulationEventMark &mark, const ClothSheet *cloth) {
+	if (mark.step != step) {
+		return;
+	}
+
+	for (int t = 0; t < threadBuffers.size(); t++) {
+		std::vector<SimulationEvent> &buffer = threadBuffers[t].events;
+		int kept = t < mark.sizes.size() ? std::min(mark.sizes[t], (int)buffer.size()) : 0;
+
+		for (int e = kept; e < buffer.size(); e++) {
+			if (buffer[e].cloth != cloth || buffer[e].type == EVENT_ROLLBACK) {
+				buffer[kept++] = buffer[e];
+			}
+		}
+
+		buffer.resize(kept);
+	}
+}
+
+void SimulationEventQueue::subscribe(SimulationEventType type, SimulationEventCallback callback, void *userData) {
+	callbackTypes.push_back(type);
+	callbacks.push_back(callback);
+	callbackData.push_back(userData);
+}
+
+// Ends the step: merges the thread buffers and hands the ordered events to each matching callback
+void SimulationEventQueue::flush() {
+	merge();
+
+	for (int e = 0; e < events.size(); e++) {
+		for (int c = 0; c < callbacks.size(); c++) {
+			if (callbackTypes[c] == events[e].type) {
+				callbacks[c](events[e], callbackData[c]);
+			}
+		}
+	}
+
+	step++;
+}
+
+// Orders events by type then source so the result doesn't depend on thread scheduling. Substeps and solver
+// iterations report the same contact many times, so only the deepest report per particle and partner is kept
+void SimulationEventQueue::merge() {
+	events.clear();
+
+	for (int t = 0; t < threadBuffers.size(); t++) {
+		events.insert(events.end(), threadBuffers[t].events.begin(), threadBuffers[t].events.end());
+		threadBuffers[t].events.clear();
+	}
+
+	// Note: Ordering by indices rather than pointers, so callbacks see the same order whatever the heap layout
+	for (int e = 0; e < events.size(); e++) {
+		SimulationEvent &event = events[e];
+
+		event.clothIndex = findCloth(event.cloth);
+		event.particleIndex = findParticle(event.cloth, event.particle);
+		event.otherIndex = findOther(event.cloth, event.other);
+	}
+
+	std::sort(events.begin(), events.end(), [](const SimulationEvent &a, const SimulationEvent &b) {
+		if (a.type != b.type) {
+			return a.type < b.type;
+		}
+
+		if (a.clothIndex != b.clothIndex) {
+			return a.clothIndex < b.clothIndex;
+		}
+
+		if (a.particleIndex != b.particleIndex) {
+			return a.particleIndex < b.particleIndex;
+		}
+
+		if (a.otherIndex != b.otherIndex) {
+			return a.otherIndex < b.otherIndex;
+		}
+
+		return a.magnitude > b.magnitude;
+	});
+
+	int kept = 0;
+
+	for (int e = 0; e < events.size(); e++) {
+		if (kept > 0 && events[kept - 1].type == events[e].type && events[kept - 1].clothIndex == events[e].clothIndex
+				&& events[kept - 1].particleIndex == events[e].particleIndex && events[kept - 1].otherIndex == events[e].otherIndex) {
+			continue;
+		}
+
+		events[kept++] = events[e];
+	}
+
+	events.resize(kept);
+
+	// Note: Picking up thread count changes here, between parallel regions
+#ifdef _OPENMP
+	threadBuffers.resize(std::max((int)threadBuffers.size(), omp_get_max_threads()));
+#endif
+}
+
+// Events of the last flushed step
+const std::vector<SimulationEvent> &SimulationEventQueue::getEvents() {
+	return events;
+}
+
+long SimulationEventQueue::getStep() {
+	return step;
+}
+
+///////////////////////////////
+// class: WindOcclusionGrid
+///////////////////////////
+
+WindOcclusionGrid::WindOcclusionGrid() {
+	bounds = emptyAABB();
+	cellSize = vec3{ 1.0f, 1.0f, 1.0f };
+	axis = 0;
+	reversed = false;
+	active = false;
+}
+
+void WindOcclusionGrid::pushCloth(ClothSheet *cloth) {
+	cloths.push_back(cloth);
+	cloth->setWindOcclusion(this);
+}
+
+void WindOcclusionGrid::pushCollidable(Sphere *collidable) {
+	spheres.push_back(collidable);
+}
+
+void WindOcclusionGrid::pushCollidable(Capsule *collidable) {
+	capsules.push_back(collidable);
+}
+
+void WindOcclusionGrid::pushCollidable(MeshCollider *collidable) {
+	meshColliders.push_back(collidable);
+}
+
+// Rebuilds occupancy from the current scene and marches transmittance downwind, once per frame before cloth moves
+void WindOcclusionGrid::update(const vec3 &windForce) {
+	GLfloat strength = magnitude(windForce);
+
+	active = strength > 0.0f && !cloths.empty();
+
+	if (!active) {
+		return;
+	}
+
+	vec3 windDirection = windForce / strength;
+	GLfloat components[3] = { fabs(windDirection.x), fabs(windDirection.y), fabs(windDirection.z) };
+	GLfloat signs[3] = { windDirection.x, windDirection.y, windDirection.z };
+
+	axis = 0;
+	for (int d = 1; d < 3; d++) {
+		if (components[d] > components[axis]) {
+			axis = d;
+		}
+	}
+	reversed = signs[axis] < 0.0f;
+
+	computeBounds();
+
+	opacity.assign(WIND_GRID_CELLS * WIND_GRID_CELLS * WIND_GRID_CELLS, 0.0f);
+
+	for (int i = 0; i < spheres.size(); i++) {
+		rasterizeSphere(spheres.at(i)->getPosition(), spheres.at(i)->getRadius());
+	}
+
+	for (int i = 0; i < capsules.size(); i++) {
+		rasterizeCapsule(capsules.at(i)->getStart(), capsules.at(i)->getEnd(), capsules.at(i)->getRadius());
+	}
+
+	for (int i = 0; i < meshColliders.size(); i++) {
+		rasterizeMesh(meshColliders.at(i));
+	}
+
+	colliderOpacity = opacity;
+	transmittances.resize(cloths.size());
+
+	for (int c = 0; c < cloths.size(); c++) {
+		opacity = colliderOpacity;
+
+		for (int i = 0; i < cloths.size(); i++) {
+			if (i != c) {
+				rasterizeCloth(cloths.at(i), windDirection);
+			}
+		}
+
+		propagate(windDirection, transmittances.at(c));
+	}
+}
+
+// Index to sample the cloth's transmittance with, -1 for cloths the grid doesn't know
+int WindOcclusionGrid::findCloth(const ClothSheet *cloth) {
+	for (int i = 0; i < cloths.size(); i++) {
+		if (cloths.at(i) == cloth) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// Fraction of the wind reaching the point on the given cloth, trilinearly interpolated from the wind entering
+// each cell
+GLfloat WindOcclusionGrid::sample(int cloth, const vec3 &point) {
+	if (!active || cloth < 0 || cloth >= transmittances.size()) {
+		return 1.0f;
+	}
+
+	const std::vector<GLfloat> &transmittance = transmittances[cloth];
+
+	GLfloat coords[3] = { (point.x - bounds.min.x) / cellSize.x - 0.5f,
+						(point.y - bounds.min.y) / cellSize.y - 0.5f,
+						(point.z - bounds.min.z) / cellSize.z - 0.5f };
+	int base[3];
+	GLfloat weights[3];
+
+	for (int d = 0; d < 3; d++) {
+		coords[d] = std::min(std::max(coords[d], 0.0f), (GLfloat)(WIND_GRID_CELLS - 1));
+		base[d] = std::min((int)coords[d], WIND_GRID_CELLS - 2);
+		weights[d] = coords[d] - base[d];
+	}
+
+	GLfloat result = 0.0f;
+
+	for (int corner = 0; corner < 8; corner++) {
+		int dx = corner & 1;
+		int dy = (corner >> 1) & 1;
+		int dz = (corner >> 2) & 1;
+		GLfloat weight = (dx ? weights[0] : 1.0f - weights[0])
+						* (dy ? weights[1] : 1.0f - weights[1])
+						* (dz ? weights[2] : 1.0f - weights[2]);
+
+		result += weight * transmittance[cellIndex(base[0] + dx, base[1] + dy, base[2] + dz)];
+	}
+
+	return result;
+}
+
+// Maps a cell's world axis coordinates to its slice-major index
+int WindOcclusionGrid::cellIndex(int x, int y, int z) {
+	int coords[3] = { x, y, z };
+	int slice = reversed ? WIND_GRID_CELLS - 1 - coords[axis] : coords[axis];
+	int u = coords[(axis + 1) % 3];
+	int v = coords[(axis + 2) % 3];
+
+	return (slice * WIND_GRID_CELLS + u) * WIND_GRID_CELLS + v;
+}
+
+// Fits the grid around every registered cloth plus a margin, since only cloth ever samples it
+void WindOcclusionGrid::computeBounds() {
+	bounds = emptyAABB();
+
+	for (int i = 0; i < cloths.size(); i++) {
+		bounds = merge(bounds, cloths.at(i)->getBounds());
+	}
+
+	vec3 extent = bounds.max - bounds.min;
+	GLfloat margin = 0.25f * std::max(std::max(extent.x, extent.y), extent.z) + CLOTH_THICKNESS;
+	vec3 vMargin = vec3{ margin, margin, margin };
+
+	bounds.min = bounds.min - vMargin;
+	bounds.max = bounds.max + vMargin;
+	cellSize = (bounds.max - bounds.min) / (GLfloat)WIND_GRID_CELLS;
+}
+
+// Raises the opacity of every cell the box touches
+void WindOcclusionGrid::rasterizeBox(const AABB &box, GLfloat boxOpacity) {
+	if (!overlaps(box, bounds)) {
+		return;
+	}
+
+	int lo[3];
+	int hi[3];
+	GLfloat boxMin[3] = { box.min.x - bounds.min.x, box.min.y - bounds.min.y, box.min.z - bounds.min.z };
+	GLfloat boxMax[3] = { box.max.x - bounds.min.x, box.max.y - bounds.min.y, box.max.z - bounds.min.z };
+	GLfloat sizes[3] = { cellSize.x, cellSize.y, cellSize.z };
+
+	for (int d = 0; d < 3; d++) {
+		lo[d] = std::max((int)floor(boxMin[d] / sizes[d]), 0);
+		hi[d] = std::min((int)floor(boxMax[d] / sizes[d]), WIND_GRID_CELLS - 1);
+	}
+
+	for (int x = lo[0]; x <= hi[0]; x++) {
+		for (int y = lo[1]; y <= hi[1]; y++) {
+			for (int z = lo[2]; z <= hi[2]; z++) {
+				GLfloat &cell = opacity[cellIndex(x, y, z)];
+				cell = std::max(cell, boxOpacity);
+			}
+		}
+	}
+}
+
+// Marks cells whose centres lie inside the sphere as fully opaque
+void WindOcclusionGrid::rasterizeSphere(const vec3 &centre, GLfloat radius) {
+	rasterizeCapsule(centre, centre, radius);
+}
+
+void WindOcclusionGrid::rasterizeCapsule(const vec3 &start, const vec3 &end, GLfloat radius) {
+	vec3 vRadius = vec3{ radius, radius, radius };
+	AABB box = AABB{ componentMin(start, end) - vRadius, componentMax(start, end) + vRadius };
+
+	if (!overlaps(box, bounds)) {
+		return;
+	}
+
+	int lo[3];
+	int hi[3];
+	GLfloat boxMin[3] = { box.min.x - bounds.min.x, box.min.y - bounds.min.y, box.min.z - bounds.min.z };
+	GLfloat boxMax[3] = { box.max.x - bounds.min.x, box.max.y - bounds.min.y, box.max.z - bounds.min.z };
+	GLfloat sizes[3] = { cellSize.x, cellSize.y, cellSize.z };
+
+	for (int d = 0; d < 3; d++) {
+		lo[d] = std::max((int)floor(boxMin[d] / sizes[d]), 0);
+		hi[d] = std::min((int)floor(boxMax[d] / sizes[d]), WIND_GRID_CELLS - 1);
+	}
+
+	for (int x = lo[0]; x <= hi[0]; x++) {
+		for (int y = lo[1]; y <= hi[1]; y++) {
+			for (int z = lo[2]; z <= hi[2]; z++) {
+				vec3 centre = bounds.min + vec3{ (x + 0.5f) * cellSize.x, (y + 0.5f) * cellSize.y, (z + 0.5f) * cellSize.z };
+
+				if (magnitude(centre - closestPointOnSegment(centre, start, end)) <= radius) {
+					opacity[cellIndex(x, y, z)] = 1.0f;
+				}
+			}
+		}
+	}
+}
+
+// Marks cells crossed by the mesh's surface, found by querying its BVH with each cell's box
+void WindOcclusionGrid::rasterizeMesh(MeshCollider *mesh) {
+	AABB meshBounds = mesh->getBounds();
+
+	if (!overlaps(meshBounds, bounds)) {
+		return;
+	}
+
+	std::vector<int> hits;
+
+	for (int x = 0; x < WIND_GRID_CELLS; x++) {
+		for (int y = 0; y < WIND_GRID_CELLS; y++) {
+			for (int z = 0; z < WIND_GRID_CELLS; z++) {
+				vec3 cellMin = bounds.min + vec3{ x * cellSize.x, y * cellSize.y, z * cellSize.z };
+				AABB cell = AABB{ cellMin, cellMin + cellSize };
+
+				if (!overlaps(cell, meshBounds)) {
+					continue;
+				}
+
+				hits.clear();
+				mesh->getBVH().queryAABB(cell, hits);
+
+				if (!hits.empty()) {
+					opacity[cellIndex(x, y, z)] = 1.0f;
+				}
+			}
+		}
+	}
+}
+
+// Rasterizes each tile's bounds, weighted by how squarely the tile faces the wind so edge-on cloth stays clear
+// Note: Only ever rasterized into another cloth's transmittance
+void WindOcclusionGrid::rasterizeCloth(ClothSheet *cloth, const vec3 &windDirection) {
+	std::vector< std::vector<Particle>> &particles = cloth->getParticles();
+	std::vector<ClothTile> &tiles = cloth->getTiles();
+
+	for (int k = 0; k < tiles.size(); k++) {
+		const ClothTile &tile = tiles.at(k);
+		vec3 diagonal0 = particles[tile.rowEnd][tile.colEnd].position - particles[tile.rowBegin][tile.colBegin].position;
+		vec3 diagonal1 = particles[tile.rowEnd][tile.colBegin].position - particles[tile.rowBegin][tile.colEnd].position;
+		vec3 normal = cross(diagonal0, diagonal1);
+		GLfloat area = magnitude(normal);
+
+		if (area <= 0.0f) {
+			continue;
+		}
+
+		rasterizeBox(tile.bounds, CLOTH_WIND_OPACITY * fabs(dot(normal, windDirection)) / area);
+	}
+}
+
+// Marches slice by slice downwind. The wind entering a cell is what left the point one slice upwind along
+// the wind direction, bilinearly sampled since that point falls between cells
+void WindOcclusionGrid::propagate(const vec3 &windDirection, std::vector<GLfloat> &transmittance) {
+	int sliceSize = WIND_GRID_CELLS * WIND_GRID_CELLS;
+	int u = (axis + 1) % 3;
+	int v = (axis + 2) % 3;
+	GLfloat direction[3] = { windDirection.x, windDirection.y, windDirection.z };
+	GLfloat sizes[3] = { cellSize.x, cellSize.y, cellSize.z };
+
+	// Lateral shift, in cells, between a cell centre and its upwind point in the previous slice
+	GLfloat step = sizes[axis] / fabs(direction[axis]);
+	GLfloat shiftU = -direction[u] * step / sizes[u];
+	GLfloat shiftV = -direction[v] * step / sizes[v];
+
+	transmittance.assign(opacity.size(), 1.0f);
+
+	for (int slice = 1; slice < WIND_GRID_CELLS; slice++) {
+		const GLfloat *previousIn = &transmittance[(slice - 1) * sliceSize];
+		const GLfloat *previousOpacity = &opacity[(slice - 1) * sliceSize];
+		GLfloat *current = &transmittance[slice * sliceSize];
+
+		#pragma omp parallel for schedule(static)
+		for (int i = 0; i < WIND_GRID_CELLS; i++) {
+			GLfloat fu = std::min(std::max(i + shiftU, 0.0f), (GLfloat)(WIND_GRID_CELLS - 1));
+			int iu = std::min((int)fu, WIND_GRID_CELLS - 2);
+			GLfloat wu = fu - iu;
+
+			for (int j = 0; j < WIND_GRID_CELLS; j++) {
+				GLfloat fv = std::min(std::max(j + shiftV, 0.0f), (GLfloat)(WIND_GRID_CELLS - 1));
+				int iv = std::min((int)fv, WIND_GRID_CELLS - 2);
+				GLfloat wv = fv - iv;
+				int c00 = iu * WIND_GRID_CELLS + iv;
+				int c10 = c00 + WIND_GRID_CELLS;
+
+				current[i * WIND_GRID_CELLS + j] =
+					(1.0f - wu) * (1.0f - wv) * previousIn[c00] * (1.0f - previousOpacity[c00])
+					+ (1.0f - wu) * wv * previousIn[c00 + 1] * (1.0f - previousOpacity[c00 + 1])
+					+ wu * (1.0f - wv) * previousIn[c10] * (1.0f - previousOpacity[c10])
+					+ wu * wv * previousIn[c10 + 1] * (1.0f - previousOpacity[c10 + 1]);
+			}
+		}
+	}
+}
+
+////////////////////////////////////
+// class: ClothEquilibriumSolver
+////////////////////////////////
+
+ClothEquilibriumSolver::ClothEquilibriumSolver(ClothSheet &cloth) {
+	std::vector< std::vector<Particle>> &particles = cloth.getParticles();
+	std::vector< std::vector<Spring>> &springs = cloth.getSprings();
+	std::unordered_map<const Particle*, int> indices;
+	double maxStiffness = 0.0;
+
+	particleCount = 0;
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < particles.at(i).size(); j++) {
+			Particle &particle = particles.at(i).at(j);
+
+			indices[&particle] = particleCount++;
+			particleRefs.push_back(&particle);
+			pinned.push_back(particle.pinned);
+			positions.push_back(particle.position.x);
+			positions.push_back(particle.position.y);
+			positions.push_back(particle.position.z);
+			weights.push_back(particle.mass * gravity.x);
+			weights.push_back(particle.mass * gravity.y);
+			weights.push_back(particle.mass * gravity.z);
+		}
+	}
+
+	for (int i = 0; i < springs.size(); i++) {
+		for (int j = 0; j < springs.at(i).size(); j++) {
+			const Spring &spring = springs.at(i).at(j);
+
+			springEnds.push_back(indices[spring.p0]);
+			springEnds.push_back(indices[spring.p1]);
+			restLengths.push_back(spring.restLength);
+			baseStiffness.push_back(SETTLE_STIFFNESS * spring.p0->mass * magnitude(gravity) / spring.restLength);
+			maxStiffness = std::max(maxStiffness, baseStiffness.back());
+		}
+	}
+
+	// Note: Keeps directions with no stiffness at all (e.g. out of plane for a slack flat sheet) solvable
+	baseRegularization = 1e-8 * maxStiffness;
+	stiffness = baseStiffness;
+	regularization = baseRegularization;
+	hessianBlocks = std::vector<double>(restLengths.size() * 6);
+}
+
+// Solves with springs softened and stiffened back in stages, returning the total Newton iterations
+// Note: Straight Newton on stiff springs crawls through large rotations since every linearized step
+// stretches them, soft springs let the cloth swing into place first
+int ClothEquilibriumSolver::solve(int maxIterations) {
+	int total = 0;
+
+	for (int stage = SETTLE_STAGES - 1; stage >= 0; stage--) {
+		double scale = pow(10.0, -stage);
+
+		for (int s = 0; s < restLengths.size(); s++) {
+			stiffness[s] = baseStiffness[s] * scale;
+		}
+
+		regularization = baseRegularization * scale;
+		total += newton(maxIterations, stage == 0 ? SETTLE_TOLERANCE : 10.0 * SETTLE_TOLERANCE);
+	}
+
+	return total;
+}
+
+// Runs damped Newton iterations until no free particle has a net force above the tolerance (relative to its weight)
+int ClothEquilibriumSolver::newton(int maxIterations, double tolerance) {
+	int count = 3 * particleCount;
+	std::vector<double> grad(count);
+	std::vector<double> step(count);
+	std::vector<double> trial(count);
+	std::vector<double> rhs(count);
+
+	for (int iteration = 0; iteration < maxIterations; iteration++) {
+		gradient(positions, grad);
+
+		double residual = 0.0;
+		for (int n = 0; n < particleCount; n++) {
+			double weight = sqrt(weights[3 * n] * weights[3 * n] + weights[3 * n + 1] * weights[3 * n + 1] + weights[3 * n + 2] * weights[3 * n + 2]);
+
+			for (int d = 0; d < 3; d++) {
+				residual = std::max(residual, fabs(grad[3 * n + d]) / std::max(weight, 1e-12));
+			}
+		}
+
+		if (residual < tolerance) {
+			return iteration;
+		}
+
+		computeHessian(positions);
+
+		for (int i = 0; i < count; i++) {
+			rhs[i] = -grad[i];
+		}
+
+		conjugateGradient(rhs, step);
+
+		// Falling back to steepest descent if CG didn't produce a descent direction
+		double slope = 0.0;
+		for (int i = 0; i < count; i++) {
+			slope += grad[i] * step[i];
+		}
+
+		if (slope >= 0.0) {
+			step = rhs;
+			slope = 0.0;
+
+			for (int i = 0; i < count; i++) {
+				slope -= grad[i] * grad[i];
+			}
+		}
+
+		// Backtracking until the Armijo condition holds
+		double current = energy(positions);
+		double alpha = 1.0;
+
+		for (int search = 0; search < 30; search++) {
+			for (int i = 0; i < count; i++) {
+				trial[i] = positions[i] + alpha * step[i];
+			}
 
-	generateParticleSheet((GLfloat)width, (GLfloat)height);
+			if (energy(trial) <= current + 1e-4 * alpha * slope) {
+				break;
+			}
 
-	potentialColliders = std::vector<Sphere*>();
+			alpha *= 0.5;
+		}
 
-	pinnedParticles = std::queue<Particle*>();
+		positions.swap(trial);
 
-	// Pinning top left three particles
-	particles.at(0).at(0).pinned = true;
-	pinnedParticles.push(&particles.at(0).at(0));
-	particles.at(0).at(1).pinned = true;
-	pinnedParticles.push(&particles.at(0).at(1));
-	particles.at(0).at(2).pinned = true;
-	pinnedParticles.push(&particles.at(0).at(2));
+		// Also stopping once the drape has stopped moving, slack regions converge slowly but barely move
+		double largestStep = 0.0;
+		for (int i = 0; i < count; i++) {
+			largestStep = std::max(largestStep, fabs(alpha * step[i]));
+		}
 
-	// Pinning top right three particles
-	particles.at(0).at(particles.size() - 1).pinned = true;
-	pinnedParticles.push(&particles.at(0).at(particles.size() - 1));
-	particles.at(0).at(particles.size() - 2).pinned = true;
-	pinnedParticles.push(&particles.at(0).at(particles.size() - 2));
-	particles.at(0).at(particles.size() - 3).pinned = true;
-	pinnedParticles.push(&particles.at(0).at(particles.size() - 3));
+		if (largestStep < SETTLE_STEP_TOLERANCE) {
+			return iteration + 1;
+		}
+	}
+
+	return maxIterations;
 }
 
-// Draws cloth using particle positions for vertices
-void ClothSheet::draw() {
-	// Declaring normal calculation variables
-	vec3 normal;
-	vec3 p1;
-	vec3 p2;
-	vec3 p3;
+// Writes the solved positions back into the cloth's particles
+void ClothEquilibriumSolver::apply() {
+	for (int n = 0; n < particleCount; n++) {
+		particleRefs[n]->position = vec3{ (GLfloat)positions[3 * n], (GLfloat)positions[3 * n + 1], (GLfloat)positions[3 * n + 2] };
+	}
+}
 
-	// Applying transformations
-	glPushMatrix();
+// E = sum of 0.5 k (|d| - L)^2 over springs, minus sum of m g . x over free particles
+double ClothEquilibriumSolver::energy(const std::vector<double> &x) {
+	double total = 0.0;
 
-	// Drawing current actor
-	glBegin(GL_TRIANGLES);
+	for (int s = 0; s < restLengths.size(); s++) {
+		int p0 = springEnds[2 * s];
+		int p1 = springEnds[2 * s + 1];
+		double dist[3] = { x[3 * p0] - x[3 * p1], x[3 * p0 + 1] - x[3 * p1 + 1], x[3 * p0 + 2] - x[3 * p1 + 2] };
+		double stretch = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]) - restLengths[s];
 
-	// Drawing object
-	for (int i = 0; i < particles.size() - 1; i++) {
-		for (int j = 0; j < particles.at(i).size() - 1; j++) {
-			//glColor4f(color.x, color.y, color.z, color.w);
-			glColor4f(particles.at(i).at(j).color.x, particles.at(i).at(j).color.y, 
-						particles.at(i).at(j).color.z, particles.at(i).at(j).color.w);
+		total += 0.5 * stiffness[s] * stretch * stretch;
+	}
 
-			// Finding upper tri normal for lighting
-			p1 = particles.at(i + 1).at(j).position;
-			p2 = particles.at(i).at(j).position;
-			p3 = particles.at(i).at(j + 1).position;
+	for (int n = 0; n < particleCount; n++) {
+		if (!pinned[n]) {
+			total -= weights[3 * n] * x[3 * n] + weights[3 * n + 1] * x[3 * n + 1] + weights[3 * n + 2] * x[3 * n + 2];
+		}
+	}
 
-			normal = normalize(cross(p2 - p1, p3 - p1));
-			glNormal3f(normal.x, normal.y, normal.z);
+	return total;
+}
 
-			// Specifying upper triangle vertices
-			glVertex3f(p1.x, p1.y, p1.z);
-			glVertex3f(p2.x, p2.y, p2.z);
-			glVertex3f(p3.x, p3.y, p3.z);
+// Pinned particles get a zero gradient so they never move
+void ClothEquilibriumSolver::gradient(const std::vector<double> &x, std::vector<double> &result) {
+	for (int n = 0; n < particleCount; n++) {
+		for (int d = 0; d < 3; d++) {
+			result[3 * n + d] = -weights[3 * n + d];
+		}
+	}
 
-			// Finding lower tri normal for lighting
-			p1 = particles.at(i + 1).at(j).position;
-			p2 = particles.at(i).at(j + 1).position;
-			p3 = particles.at(i + 1).at(j + 1).position;
+	for (int s = 0; s < restLengths.size(); s++) {
+		int p0 = springEnds[2 * s];
+		int p1 = springEnds[2 * s + 1];
+		double dist[3] = { x[3 * p0] - x[3 * p1], x[3 * p0 + 1] - x[3 * p1 + 1], x[3 * p0 + 2] - x[3 * p1 + 2] };
+		double length = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
+		double scale = stiffness[s] * (length - restLengths[s]) / length;
 
-			normal = normalize(cross(p2 - p1, p3 - p1));
-			glNormal3f(normal.x, normal.y, normal.z);
+		for (int d = 0; d < 3; d++) {
+			result[3 * p0 + d] += scale * dist[d];
+			result[3 * p1 + d] -= scale * dist[d];
+		}
+	}
 
-			// Specifying lower triangle vertices
-			glVertex3f(p1.x, p1.y, p1.z);
-			glVertex3f(p2.x, p2.y, p2.z);
-			glVertex3f(p3.x, p3.y, p3.z);
+	for (int n = 0; n < particleCount; n++) {
+		if (pinned[n]) {
+			result[3 * n] = result[3 * n + 1] = result[3 * n + 2] = 0.0;
 		}
 	}
+}
 
-	// Done drawing current actor
-	glEnd();
-	glPopMatrix();
+// Stores each spring's 3x3 block k (n n^T + max(0, 1 - L / |d|) (I - n n^T)) as its 6 unique entries
+void ClothEquilibriumSolver::computeHessian(const std::vector<double> &x) {
+	for (int s = 0; s < restLengths.size(); s++) {
+		int p0 = springEnds[2 * s];
+		int p1 = springEnds[2 * s + 1];
+		double dist[3] = { x[3 * p0] - x[3 * p1], x[3 * p0 + 1] - x[3 * p1 + 1], x[3 * p0 + 2] - x[3 * p1 + 2] };
+		double length = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
+		double n[3] = { dist[0] / length, dist[1] / length, dist[2] / length };
+		double tension = std::max(1.0 - restLengths[s] / length, 0.0);
+		double *block = &hessianBlocks[6 * s];
+
+		block[0] = stiffness[s] * (n[0] * n[0] + tension * (1.0 - n[0] * n[0]));
+		block[1] = stiffness[s] * (n[1] * n[1] + tension * (1.0 - n[1] * n[1]));
+		block[2] = stiffness[s] * (n[2] * n[2] + tension * (1.0 - n[2] * n[2]));
+		block[3] = stiffness[s] * (1.0 - tension) * n[0] * n[1];
+		block[4] = stiffness[s] * (1.0 - tension) * n[0] * n[2];
+		block[5] = stiffness[s] * (1.0 - tension) * n[1] * n[2];
+	}
 }
 
-// Moves particles using Verlet integration
-void ClothSheet::move(long deltaT) {
-	// Note: Using a fixed timestep for this simulation
-	GLfloat timeTSquared = 0.01f;
-	vec3 vTempPos;
+void ClothEquilibriumSolver::multiplyHessian(const std::vector<double> &p, std::vector<double> &result) {
+	for (int i = 0; i < result.size(); i++) {
+		result[i] = regularization * p[i];
+	}
 
-	Particle *particle;
+	for (int s = 0; s < restLengths.size(); s++) {
+		int p0 = springEnds[2 * s];
+		int p1 = springEnds[2 * s + 1];
+		const double *block = &hessianBlocks[6 * s];
+		double dp[3] = { p[3 * p0] - p[3 * p1], p[3 * p0 + 1] - p[3 * p1 + 1], p[3 * p0 + 2] - p[3 * p1 + 2] };
+		double q[3] = { block[0] * dp[0] + block[3] * dp[1] + block[4] * dp[2],
+						block[3] * dp[0] + block[1] * dp[1] + block[5] * dp[2],
+						block[4] * dp[0] + block[5] * dp[1] + block[2] * dp[2] };
+
+		for (int d = 0; d < 3; d++) {
+			result[3 * p0 + d] += q[d];
+			result[3 * p1 + d] -= q[d];
+		}
+	}
 
-	accumulateForces();
-	satisfyConstraints();
+	for (int n = 0; n < particleCount; n++) {
+		if (pinned[n]) {
+			result[3 * n] = result[3 * n + 1] = result[3 * n + 2] = 0.0;
+		}
+	}
+}
+
+// Solves H x = rhs over the free particles, stopping early once the residual drops by the Newton forcing term
+void ClothEquilibriumSolver::conjugateGradient(const std::vector<double> &rhs, std::vector<double> &result) {
+	int count = (int)rhs.size();
+	std::vector<double> residual = rhs;
+	std::vector<double> direction = rhs;
+	std::vector<double> product(count);
+	double residualNorm = 0.0;
+
+	std::fill(result.begin(), result.end(), 0.0);
+
+	for (int i = 0; i < count; i++) {
+		residualNorm += residual[i] * residual[i];
+	}
+
+	double target = residualNorm * 1e-4;
+
+	for (int iteration = 0; iteration < SETTLE_CG_ITERATIONS && residualNorm > target; iteration++) {
+		multiplyHessian(direction, product);
+
+		double curvature = 0.0;
+		for (int i = 0; i < count; i++) {
+			curvature += direction[i] * product[i];
+		}
+
+		if (curvature <= 0.0) {
+			break;
+		}
+
+		double alpha = residualNorm / curvature;
+		double nextNorm = 0.0;
+
+		for (int i = 0; i < count; i++) {
+			result[i] += alpha * direction[i];
+			residual[i] -= alpha * product[i];
+			nextNorm += residual[i] * residual[i];
+		}
+
+		for (int i = 0; i < count; i++) {
+			direction[i] = residual[i] + (nextNorm / residualNorm) * direction[i];
+		}
+
+		residualNorm = nextNorm;
+	}
+}
+
+/////////////////////////////////
+// class: ClothGradientSolver
+/////////////////////////////
+
+// Copies the cloth's current state and topology into flat arrays
+// Note: State vectors hold positions, previous positions and accelerations, 3 * particleCount values each
+ClothGradientSolver::ClothGradientSolver(ClothSheet &cloth, int steps) {
+	std::vector< std::vector<Particle>> &particles = cloth.getParticles();
+	std::vector< std::vector<Spring>> &springs = cloth.getSprings();
+	std::vector<Triangle> &triangles = cloth.getTriangles();
+	std::unordered_map<const Particle*, int> indices;
 
+	this->steps = steps;
+	checkpointInterval = std::max((int)ceil(sqrt((double)steps)), 1);
+	iterations = cloth.getConstraintIterations();
+	timeTSquared = (double)cloth.getTimeStep() * cloth.getTimeStep();
+
+	particleCount = 0;
 	for (int i = 0; i < particles.size(); i++) {
-		for (int j = 0; j < particles.at(i).size(); j++) {
-			particle = &particles.at(i).at(j);
+		particleCount += (int)particles.at(i).size();
+	}
 
-			if(!particle->pinned) {
-				vTempPos = particle->position;
-				
-				// Calculating new position and storing previous position
-				particle->position = ((particle->position * 2.0f) - particle->prevPosition * damperConstD) 
-							+ (particle->acceleration * timeTSquared);
-				particle->prevPosition = vTempPos;
+	initialState = std::vector<double>(9 * particleCount);
+	pinned = std::vector<char>(particleCount);
+	masses = std::vector<double>(particleCount);
+
+	int n = 0;
+	for (int i = 0; i < particles.size(); i++) {
+		for (int j = 0; j < particles.at(i).size(); j++, n++) {
+			const Particle &particle = particles.at(i).at(j);
+			const vec3 *values[3] = { &particle.position, &particle.prevPosition, &particle.acceleration };
+
+			for (int block = 0; block < 3; block++) {
+				initialState.at(3 * (block * particleCount + n)) = values[block]->x;
+				initialState.at(3 * (block * particleCount + n) + 1) = values[block]->y;
+				initialState.at(3 * (block * particleCount + n) + 2) = values[block]->z;
 			}
+
+			pinned.at(n) = particle.pinned;
+			masses.at(n) = particle.mass;
+			indices[&particle] = n;
+		}
+	}
+
+	for (int i = 0; i < springs.size(); i++) {
+		for (int j = 0; j < springs.at(i).size(); j++) {
+			springEnds.push_back(indices[springs.at(i).at(j).p0]);
+			springEnds.push_back(indices[springs.at(i).at(j).p1]);
+			restLengths.push_back(springs.at(i).at(j).restLength);
 		}
 	}
 
-	handleCollision();
+	for (int k = 0; k < triangles.size(); k++) {
+		triangleVertices.push_back(indices[triangles.at(k).v0]);
+		triangleVertices.push_back(indices[triangles.at(k).v1]);
+		triangleVertices.push_back(indices[triangles.at(k).v2]);
+	}
+
+	sweepPositions = std::vector<double>((size_t)iterations * 3 * particleCount);
+	springPositions = std::vector<double>(restLengths.size() * 6);
 }
 
-// Handles collisions with nearby Spheres
-void ClothSheet::handleCollision() {
-	Particle *particle;
-	Sphere* collidable;
-	vec3 vDistance;
-	vec3 vNormalizedDist;
-	vec3 vScaledDist;
+// Runs the forward model, storing particle positions after every step
+void ClothGradientSolver::simulate(const SimulationParameters &params, std::vector< std::vector<vec3>> &frames) {
+	std::vector<double> state = initialState;
+	frames = std::vector< std::vector<vec3>>(steps, std::vector<vec3>(particleCount));
 
-	// Setting offset from surface when projecting
-	GLfloat offsetScalar = 0.03f;
+	for (int t = 0; t < steps; t++) {
+		forwardStep(params, state);
 
-	for (int i = 0; i < potentialColliders.size(); i++) {
-		collidable = potentialColliders.at(i);
-		
-		for (int i = 0; i < particles.size(); i++) {
-			for (int j = 0; j < particles.at(i).size(); j++) {
-				particle = &particles.at(i).at(j);
+		for (int n = 0; n < particleCount; n++) {
+			frames[t][n] = vec3{ (GLfloat)state[3 * n], (GLfloat)state[3 * n + 1], (GLfloat)state[3 * n + 2] };
+		}
+	}
+}
 
-				if (collidable->contains(particle->position)) {
-					vDistance = particle->position - collidable->getPosition();
-					vNormalizedDist = normalize(vDistance);
-					vScaledDist = (vNormalizedDist * sphere->getRadius());
-					
-					// Getting vector to position on surface of sphere from origin plus small offset
-					particle->position = collidable->getPosition() 
-										+ (vNormalizedDist * sphere->getRadius())
-										+ (vScaledDist * offsetScalar);
-				}
+// Returns the sum of squared position errors against the reference frames (empty frames are skipped)
+// and its gradient with respect to the parameters, keeping only every checkpointInterval-th state in memory
+double ClothGradientSolver::computeGradient(const SimulationParameters &params,
+		const std::vector< std::vector<vec3>> &referenceFrames, ParameterGradient &gradient) {
+	std::vector< std::vector<double>> checkpoints;
+	std::vector<double> state = initialState;
+	double loss = 0.0;
+
+	gradient = ParameterGradient{ 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+	// Forward pass, saving a checkpoint at the start of every segment
+	for (int t = 0; t < steps; t++) {
+		if (t % checkpointInterval == 0) {
+			checkpoints.push_back(state);
+		}
+
+		forwardStep(params, state);
+
+		if (t < referenceFrames.size()) {
+			loss += frameLoss(state, referenceFrames[t], 0);
+		}
+	}
+
+	// Reverse pass, recomputing each segment's states from its checkpoint
+	std::vector<double> adjoint(9 * particleCount, 0.0);
+	std::vector< std::vector<double>> segment;
+
+	for (int c = (int)checkpoints.size() - 1; c >= 0; c--) {
+		int first = c * checkpointInterval;
+		int last = std::min(first + checkpointInterval, steps);
+
+		segment.resize(last - first + 1);
+		segment[0] = checkpoints[c];
+
+		for (int t = first; t < last; t++) {
+			segment[t - first + 1] = segment[t - first];
+			forwardStep(params, segment[t - first + 1]);
+		}
+
+		for (int t = last - 1; t >= first; t--) {
+			// Note: Frame t is the state after step t, i.e. segment entry t - first + 1
+			if (t < referenceFrames.size()) {
+				frameLoss(segment[t - first + 1], referenceFrames[t], &adjoint);
 			}
+
+			backwardStep(params, segment[t - first], adjoint, gradient);
 		}
 	}
+
+	return loss;
 }
 
-// Applies a given wind force to the cloth
-void ClothSheet::applyWindForce(vec3 &windForce) {
-	vWindForce = windForce;
+double ClothGradientSolver::frameLoss(const std::vector<double> &state, const std::vector<vec3> &reference, std::vector<double> *adjoint) {
+	double loss = 0.0;
+
+	if (reference.size() != particleCount) {
+		return loss;
+	}
+
+	for (int n = 0; n < particleCount; n++) {
+		double error[3] = { state[3 * n] - reference[n].x, state[3 * n + 1] - reference[n].y, state[3 * n + 2] - reference[n].z };
+
+		for (int d = 0; d < 3; d++) {
+			loss += error[d] * error[d];
+
+			if (adjoint != 0) {
+				(*adjoint)[3 * n + d] += 2.0 * error[d];
+			}
+		}
+	}
+
+	return loss;
 }
 
-// Unpins pinned particles
-void ClothSheet::detach() {
-	while (!pinnedParticles.empty()) {
-		pinnedParticles.front()->pinned = false;
-		pinnedParticles.pop();
+// Follows the project-first Verlet path of ClothSheet::advance with a single substep: forces at the current
+// positions, constraint sweeps, then integration. Wind occlusion, collisions and attachments are not modelled
+void ClothGradientSolver::forwardStep(const SimulationParameters &params, std::vector<double> &state) {
+	double *x = &state[0];
+	double *xp = &state[3 * particleCount];
+	double *a = &state[6 * particleCount];
+
+	accumulateForces(params, x, a);
+	satisfyConstraints(x, iterations);
+
+	for (int n = 0; n < particleCount; n++) {
+		if (pinned[n]) {
+			continue;
+		}
+
+		for (int d = 0; d < 3; d++) {
+			double current = x[3 * n + d];
+			x[3 * n + d] = 2.0 * current - xp[3 * n + d] * params.damping + a[3 * n + d] * timeTSquared;
+			xp[3 * n + d] = current;
+		}
 	}
 }
 
-// Adds an Actor to a list of possible collisions
-void ClothSheet::pushCollidable(Sphere *collidable) {
-	potentialColliders.push_back(collidable);
+void ClothGradientSolver::accumulateForces(const SimulationParameters &params, const double *x, double *a) {
+	double wind[3] = { params.wind.x, params.wind.y, params.wind.z };
+	double g[3] = { gravity.x, gravity.y, gravity.z };
+
+	for (int k = 0; k < triangleVertices.size(); k += 3) {
+		const double *x0 = &x[3 * triangleVertices[k]];
+		const double *x1 = &x[3 * triangleVertices[k + 1]];
+		const double *x2 = &x[3 * triangleVertices[k + 2]];
+		double e1[3] = { x1[0] - x0[0], x1[1] - x0[1], x1[2] - x0[2] };
+		double e2[3] = { x2[0] - x0[0], x2[1] - x0[1], x2[2] - x0[2] };
+		double u[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		double length = sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+		double totalMass = masses[triangleVertices[k]] + masses[triangleVertices[k + 1]] + masses[triangleVertices[k + 2]];
+		double windDot = (u[0] * wind[0] + u[1] * wind[1] + u[2] * wind[2]) / length;
+
+		for (int v = 0; v < 3; v++) {
+			for (int d = 0; d < 3; d++) {
+				a[3 * triangleVertices[k + v] + d] += (u[d] / length) * windDot / totalMass;
+			}
+		}
+	}
+
+	for (int s = 0; s < restLengths.size(); s++) {
+		int p0 = springEnds[2 * s];
+		int p1 = springEnds[2 * s + 1];
+		double dist[3] = { x[3 * p0] - x[3 * p1], x[3 * p0 + 1] - x[3 * p1 + 1], x[3 * p0 + 2] - x[3 * p1 + 2] };
+		double length = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
+		double scale = params.springK * (1.0 - restLengths[s] / length) / masses[p0];
+
+		for (int d = 0; d < 3; d++) {
+			a[3 * p0 + d] += g[d] / masses[p0] - dist[d] * scale;
+			a[3 * p1 + d] += g[d] / masses[p1] + dist[d] * scale;
+		}
+	}
 }
 
-vec3 ClothSheet::getPosition() {
-	return position;
+void ClothGradientSolver::satisfyConstraints(double *x, int sweeps) {
+	for (int iteration = 0; iteration < sweeps; iteration++) {
+		for (int s = 0; s < restLengths.size(); s++) {
+			int p0 = springEnds[2 * s];
+			int p1 = springEnds[2 * s + 1];
+			double dist[3] = { x[3 * p0] - x[3 * p1], x[3 * p0 + 1] - x[3 * p1 + 1], x[3 * p0 + 2] - x[3 * p1 + 2] };
+			double length = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
+			double scale = 0.5 * (1.0 - restLengths[s] / length);
+
+			for (int d = 0; d < 3; d++) {
+				if (!pinned[p0]) {
+					x[3 * p0 + d] -= dist[d] * scale;
+				}
+
+				if (!pinned[p1]) {
+					x[3 * p1 + d] += dist[d] * scale;
+				}
+			}
+		}
+	}
 }
 
-// Generates a height*width matrix of particles and a matrix of springs
-void ClothSheet::generateParticleSheet(GLfloat height, GLfloat width) {
-	// Note: Spacings double as rest length of springs
-	GLfloat xSpacing = 2.0f / (height - 1.0f);
-	GLfloat ySpacing = 2.0f / (width - 1.0f);
-	GLfloat xBendSpacing = xSpacing + xSpacing;
-	GLfloat yBendSpacing = ySpacing + ySpacing;
-	vec3 vSpacer = position;
-	vec4 vColor;
+// Pulls the adjoint of the state after a step back to the state before it, accumulating parameter gradients
+void ClothGradientSolver::backwardStep(const SimulationParameters &params, const std::vector<double> &stateBefore,
+		std::vector<double> &adjoint, ParameterGradient &gradient) {
+	int count = 3 * particleCount;
+	const double *xBefore = &stateBefore[0];
+	const double *xp = &stateBefore[count];
+	double *xBar = &adjoint[0];
+	double *xpBar = &adjoint[count];
+	double *aBar = &adjoint[2 * count];
+
+	// Recomputing the positions at the start of every constraint sweep
+	std::vector<double> x(xBefore, xBefore + count);
+
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		std::copy(x.begin(), x.end(), sweepPositions.begin() + (size_t)iteration * count);
+		satisfyConstraints(&x[0], 1);
+	}
 
-	// Setting size of vector ahead of time to save cycles
-	particles = std::vector< std::vector<Particle>>(height, std::vector<Particle>(width));
+	// Integration: x' = 2 xc - d xp + a h^2 and xp' = xc for free particles, pinned ones keep their state
+	std::vector<double> xcBar(count);
 
-	// Generating particle matrix
-	for (int i = 0; i < (int)height; i++) {
-		vSpacer.x = position.x;
+	for (int n = 0; n < particleCount; n++) {
+		for (int d = 0; d < 3; d++) {
+			int i = 3 * n + d;
 
-		for (int j = 0; j < (int)width; j++) {
-			// Choosing color based on particle order
-			if (i % 2 != 0 && j % 2 != 0) {
-				vColor = vec4{ 0.941f, 0.427f, 0.102f, 1.0f };
-			} else {
-				vColor = vec4{ 0.996f, 1.0f, 0.906f, 1.0f };
+			if (pinned[n]) {
+				xcBar[i] = xBar[i];
+				continue;
 			}
-			
-			particles.at(i).at(j) = Particle{ 
-				vSpacer,
-				vSpacer,
-				vec3{ 0.0f, 0.0f, 0.0f },
-				vColor,
-				PARTICLE_MASS_KG,
-				false };
 
-			vSpacer.x += xSpacing;
-		}
+			gradient.damping -= xp[i] * xBar[i];
+			xcBar[i] = 2.0 * xBar[i] + xpBar[i];
+			aBar[i] += timeTSquared * xBar[i];
+			xpBar[i] = -params.damping * xBar[i];
+		}
+	}
+
+	// Constraint sweeps in reverse, replaying each sweep to recover the positions every projection saw
+	for (int iteration = iterations - 1; iteration >= 0; iteration--) {
+		std::copy(sweepPositions.begin() + (size_t)iteration * count, sweepPositions.begin() + (size_t)(iteration + 1) * count, x.begin());
+
+		for (int s = 0; s < restLengths.size(); s++) {
+			int p0 = springEnds[2 * s];
+			int p1 = springEnds[2 * s + 1];
+			double dist[3] = { x[3 * p0] - x[3 * p1], x[3 * p0 + 1] - x[3 * p1 + 1], x[3 * p0 + 2] - x[3 * p1 + 2] };
+			double length = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
+			double scale = 0.5 * (1.0 - restLengths[s] / length);
+
+			for (int d = 0; d < 3; d++) {
+				springPositions[6 * s + d] = dist[d];
+
+				if (!pinned[p0]) {
+					x[3 * p0 + d] -= dist[d] * scale;
+				}
+
+				if (!pinned[p1]) {
+					x[3 * p1 + d] += dist[d] * scale;
+				}
+			}
+		}
+
+		for (int s = (int)restLengths.size() - 1; s >= 0; s--) {
+			int p0 = springEnds[2 * s];
+			int p1 = springEnds[2 * s + 1];
+			const double *dist = &springPositions[6 * s];
+			double length = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
+			double ratio = restLengths[s] / length;
+
+			// c = 0.5 d (1 - r / |d|), with p0 -= c and p1 += c, and dc/dd = 0.5 ((1 - r / |d|) I + r d d^T / |d|^3)
+			double cBar[3];
+			for (int d = 0; d < 3; d++) {
+				cBar[d] = (pinned[p0] ? 0.0 : -xcBar[3 * p0 + d]) + (pinned[p1] ? 0.0 : xcBar[3 * p1 + d]);
+			}
+
+			double projection = (dist[0] * cBar[0] + dist[1] * cBar[1] + dist[2] * cBar[2]) * ratio / (length * length);
+
+			for (int d = 0; d < 3; d++) {
+				double distBar = 0.5 * ((1.0 - ratio) * cBar[d] + dist[d] * projection);
+				xcBar[3 * p0 + d] += distBar;
+				xcBar[3 * p1 + d] -= distBar;
+			}
+		}
+	}
+
+	// Forces: a' = a + F(x), so the adjoint of a passes straight through and F adds to x and parameter adjoints
+	std::copy(xcBar.begin(), xcBar.end(), xBar);
+
+	double wind[3] = { params.wind.x, params.wind.y, params.wind.z };
+
+	for (int k = 0; k < triangleVertices.size(); k += 3) {
+		int v0 = triangleVertices[k];
+		int v1 = triangleVertices[k + 1];
+		int v2 = triangleVertices[k + 2];
+		const double *x0 = &xBefore[3 * v0];
+		const double *x1 = &xBefore[3 * v1];
+		const double *x2 = &xBefore[3 * v2];
+		double e1[3] = { x1[0] - x0[0], x1[1] - x0[1], x1[2] - x0[2] };
+		double e2[3] = { x2[0] - x0[0], x2[1] - x0[1], x2[2] - x0[2] };
+		double u[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		double length = sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+		double normal[3] = { u[0] / length, u[1] / length, u[2] / length };
+		double totalMass = masses[v0] + masses[v1] + masses[v2];
+		double fBar[3];
+
+		for (int d = 0; d < 3; d++) {
+			fBar[d] = aBar[3 * v0 + d] + aBar[3 * v1 + d] + aBar[3 * v2 + d];
+		}
+
+		// f = n (n . w) / M
+		double nDotW = normal[0] * wind[0] + normal[1] * wind[1] + normal[2] * wind[2];
+		double nDotF = normal[0] * fBar[0] + normal[1] * fBar[1] + normal[2] * fBar[2];
+
+		gradient.windX += normal[0] * nDotF / totalMass;
+		gradient.windY += normal[1] * nDotF / totalMass;
+		gradient.windZ += normal[2] * nDotF / totalMass;
+
+		double nBar[3];
+		for (int d = 0; d < 3; d++) {
+			nBar[d] = (fBar[d] * nDotW + wind[d] * nDotF) / totalMass;
+		}
+
+		// n = u / |u|, then u = e1 x e2
+		double nDotNBar = normal[0] * nBar[0] + normal[1] * nBar[1] + normal[2] * nBar[2];
+		double uBar[3];
+		for (int d = 0; d < 3; d++) {
+			uBar[d] = (nBar[d] - normal[d] * nDotNBar) / length;
+		}
+
+		double e1Bar[3] = { e2[1] * uBar[2] - e2[2] * uBar[1], e2[2] * uBar[0] - e2[0] * uBar[2], e2[0] * uBar[1] - e2[1] * uBar[0] };
+		double e2Bar[3] = { uBar[1] * e1[2] - uBar[2] * e1[1], uBar[2] * e1[0] - uBar[0] * e1[2], uBar[0] * e1[1] - uBar[1] * e1[0] };
+
+		for (int d = 0; d < 3; d++) {
+			xBar[3 * v1 + d] += e1Bar[d];
+			xBar[3 * v2 + d] += e2Bar[d];
+			xBar[3 * v0 + d] -= e1Bar[d] + e2Bar[d];
+		}
+	}
+
+	for (int s = 0; s < restLengths.size(); s++) {
+		int p0 = springEnds[2 * s];
+		int p1 = springEnds[2 * s + 1];
+		double dist[3] = { xBefore[3 * p0] - xBefore[3 * p1], xBefore[3 * p0 + 1] - xBefore[3 * p1 + 1], xBefore[3 * p0 + 2] - xBefore[3 * p1 + 2] };
+		double length = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
+		double ratio = restLengths[s] / length;
+
+		// s = k d (1 - r / |d|) / m0, with a0 -= s and a1 += s
+		double sBar[3];
+		for (int d = 0; d < 3; d++) {
+			sBar[d] = aBar[3 * p1 + d] - aBar[3 * p0 + d];
+		}
+
+		double dDotS = dist[0] * sBar[0] + dist[1] * sBar[1] + dist[2] * sBar[2];
+		gradient.springK += dDotS * (1.0 - ratio) / masses[p0];
+
+		double scale = params.springK / masses[p0];
+		double projection = dDotS * ratio / (length * length);
+
+		for (int d = 0; d < 3; d++) {
+			double distBar = scale * ((1.0 - ratio) * sBar[d] + dist[d] * projection);
+			xBar[3 * p0 + d] += distBar;
+			xBar[3 * p1 + d] -= distBar;
+		}
+	}
+}
+
+///////////////////////
+// class: TriangleBVH
+///////////////////
+
+TriangleBVH::TriangleBVH() {
+	triangles = 0;
+	swept = false;
+	margin = 0.0f;
+	builtSurfaceArea = 0.0f;
+	refitsSinceCheck = 0;
+}
+
+// Builds the hierarchy top-down with median splits along the widest centroid axis
+// Note: Swept trees bound each triangle over the last step (prevPosition to position) for continuous queries
+void TriangleBVH::build(const std::vector<Triangle> *triangles, GLfloat margin, bool swept) {
+	this->triangles = triangles;
+	this->margin = margin;
+	this->swept = swept;
 
-		vSpacer.y -= ySpacing;
-	}
+	nodes.clear();
+	levels.clear();
+	triangleIndices = std::vector<int>(triangles->size());
 
-	springs = std::vector< std::vector<Spring>>((int)height - 1);
+	if (triangles->empty()) {
+		return;
+	}
 
-	int row = 0;
-	int col = 0;
-	int springGroupSize;
+	std::vector<vec3> centroids(triangles->size());
 
-	// Generating spring matrix
-	for (int k = 0; k < springs.size(); k++) {
-		// Adding two bend springs per particle except for last two rows
-		if (k < springs.size() - 3) {
-			springs.at(k) = std::vector<Spring>(((int)width - 1) * 8 - 1);
-			springGroupSize = 8;
-		} else {
-			springs.at(k) = std::vector<Spring>(((int)width - 1) * 6);
-			springGroupSize = 6;
-		}
+	for (int i = 0; i < triangles->size(); i++) {
+		const Triangle &tri = triangles->at(i);
+		triangleIndices.at(i) = i;
+		centroids.at(i) = (tri.v0->position + tri.v1->position + tri.v2->position) / 3.0f;
+	}
 
-		col = 0;
+	// Note: A binary tree over n triangles has fewer than 2n nodes
+	nodes.reserve(2 * triangles->size() / BVH_LEAF_SIZE + 1);
+	buildNode(0, (int)triangles->size(), 0, centroids);
 
-		for (int l = 0; l < springs.at(k).size(); l += springGroupSize) {
-			// Generating four structural and two shear springs per particle
-			springs.at(k).at(l) = Spring{ &particles.at(row).at(col), &particles.at(row + 1).at(col), ySpacing };
-			springs.at(k).at(l + 1) = Spring{ &particles.at(row).at(col), &particles.at(row).at(col + 1), xSpacing };
-			springs.at(k).at(l + 2) = Spring{ &particles.at(row).at(col + 1), &particles.at(row + 1).at(col + 1), ySpacing };
-			springs.at(k).at(l + 3) = Spring{ &particles.at(row + 1).at(col), &particles.at(row + 1).at(col + 1), xSpacing };
-			springs.at(k).at(l + 4) = Spring{ &particles.at(row + 1).at(col), &particles.at(row).at(col + 1),
-												sqrt((xSpacing * xSpacing) + (ySpacing * ySpacing)) };
-			springs.at(k).at(l + 5) = Spring{ &particles.at(row).at(col), &particles.at(row + 1).at(col + 1),
-												sqrt((xSpacing * xSpacing) + (ySpacing * ySpacing)) };
+	refit();
+	builtSurfaceArea = totalSurfaceArea();
+	refitsSinceCheck = 0;
+}
 
-			// Adding vertical bend spring
-			if (k < springs.size() - 3) {
-				springs.at(k).at(l + 6) = Spring{ &particles.at(row).at(col), &particles.at(row + 2).at(col), yBendSpacing };
-			}
+int TriangleBVH::buildNode(int first, int count, int depth, const std::vector<vec3> &centroids) {
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back(BVHNode{ emptyAABB(), -1, -1, first, count });
 
-			// Adding horizontal bend spring
-			if (l + 7 < springs.at(k).size() - 3) {
-				particles.size();
-				springs.at(k).at(l + 7) = Spring{ &particles.at(row).at(col), &particles.at(row).at(col + 2), xBendSpacing };
-			}
+	if (levels.size() <= depth) {
+		levels.resize(depth + 1);
+	}
+	levels.at(depth).push_back(nodeIndex);
 
-			col++;
-		}
+	if (count <= BVH_LEAF_SIZE) {
+		return nodeIndex;
+	}
 
-		row++;
+	// Finding widest axis of the centroid bounds
+	AABB centroidBounds = emptyAABB();
+	for (int i = first; i < first + count; i++) {
+		centroidBounds = expand(centroidBounds, centroids.at(triangleIndices.at(i)));
 	}
-}
 
-// Moves particles closer to their spring rest length over some number of iterations per frame
-void ClothSheet::satisfyConstraints() {
-	GLfloat deltaDistance;
-	vec3 vCurrentDistance;
-	vec3 vConstraints;
+	vec3 extent = centroidBounds.max - centroidBounds.min;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
 
-	Particle *p0;
-	Particle *p1;
-	Spring *spring;
+	// Partitioning around the median centroid
+	int half = count / 2;
+	std::nth_element(triangleIndices.begin() + first, triangleIndices.begin() + first + half,
+		triangleIndices.begin() + first + count,
+		[&centroids, axis](int a, int b) {
+			const vec3 &ca = centroids[a];
+			const vec3 &cb = centroids[b];
+			return (axis == 0) ? ca.x < cb.x : ((axis == 1) ? ca.y < cb.y : ca.z < cb.z);
+		});
 
-	// Satisfying constraints CONSTRAINT_ITERATIONS times per frame
-	for (int iteration = 0; iteration < CONSTRAINT_ITERATIONS; iteration++) {
-		for (int i = 0; i < springs.size(); i++) {
-			for (int j = 0; j < springs.at(i).size(); j++) {
-				spring = &springs.at(i).at(j);
-				p0 = spring->p0;
-				p1 = spring->p1;
+	int left = buildNode(first, half, depth + 1, centroids);
+	int right = buildNode(first + half, count - half, depth + 1, centroids);
 
-				vCurrentDistance = p0->position - p1->position;
-				deltaDistance = magnitude(vCurrentDistance);
+	nodes.at(nodeIndex).left = left;
+	nodes.at(nodeIndex).right = right;
+	nodes.at(nodeIndex).count = 0;
 
-				// Applying constraints to spring length under compression or tension
-				vConstraints = vCurrentDistance * (1.0f - spring->restLength / deltaDistance);
-				vConstraints = vConstraints * 0.5f;
+	return nodeIndex;
+}
 
-				if (!p0->pinned) {
-					p0->position = p0->position - vConstraints;
-				}
+// Recomputes node bounds bottom-up, one tree level at a time so each level can run in parallel
+void TriangleBVH::refit() {
+	for (int depth = (int)levels.size() - 1; depth >= 0; depth--) {
+		const std::vector<int> &level = levels[depth];
 
-				if (!p1->pinned) {
-					p1->position = p1->position + vConstraints;
+		#pragma omp parallel for schedule(static)
+		for (int k = 0; k < (int)level.size(); k++) {
+			BVHNode &node = nodes[level[k]];
+
+			if (node.left < 0) {
+				AABB bounds = emptyAABB();
+
+				for (int i = node.first; i < node.first + node.count; i++) {
+					bounds = merge(bounds, triangleBounds(triangleIndices[i]));
 				}
+
+				node.bounds = bounds;
+			} else {
+				node.bounds = merge(nodes[node.left].bounds, nodes[node.right].bounds);
 			}
 		}
 	}
 }
 
-// Accumulates forces on each particle and stores acceleration
-void ClothSheet::accumulateForces() {
-	//Applying wind force
-	vec3 vWindNormal = normalize(vWindForce);
-	vec3 vWindAcceleration;
+// Refits every step and periodically rebuilds if the refitted tree has degraded too far
+void TriangleBVH::update() {
+	if (nodes.empty()) {
+		return;
+	}
 
-	Particle *v0;
-	Particle *v1;
-	Particle *v2;
-	vec3 vFaceNormal;
+	refit();
 
-	for (int k = 0; k < particles.size() - 1; k++) {
-		for (int l = 0; l < particles.at(k).size() - 1; l++) {
-			// Finding upper tri normal for wind force acceleration
-			v0 = &particles.at(k + 1).at(l);
-			v1 = &particles.at(k).at(l);
-			v2 = &particles.at(k).at(l + 1);
+	if (++refitsSinceCheck >= BVH_QUALITY_CHECK_INTERVAL) {
+		refitsSinceCheck = 0;
 
-			vFaceNormal = normalize(cross(v1->position - v0->position, v2->position - v0->position));
+		if (totalSurfaceArea() > builtSurfaceArea * BVH_REBUILD_RATIO) {
+			build(triangles, margin, swept);
+		}
+	}
+}
 
-			vWindAcceleration = vFaceNormal * dot(vFaceNormal, vWindForce);
-			vWindAcceleration = vWindAcceleration / (v0->mass + v1->mass + v2->mass);
+// Finds the closest triangle hit along a ray, triangle is -1 on a miss
+RayHit TriangleBVH::intersectRay(const Ray &ray) {
+	RayHit hit = RayHit{ -1, 1e30f, 0.0f, 0.0f };
 
-			v0->acceleration = v0->acceleration + vWindAcceleration;
-			v1->acceleration = v1->acceleration + vWindAcceleration;
-			v2->acceleration = v2->acceleration + vWindAcceleration;
+	if (nodes.empty()) {
+		return hit;
+	}
 
-			// Finding lower tri normal for wind force acceleration
-			v1 = v2;
-			v2 = &particles.at(k + 1).at(l + 1);
+	vec3 invDir = vec3{ 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
 
-			vFaceNormal = normalize(cross(v1->position - v0->position, v2->position - v0->position));
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
 
-			vWindAcceleration = vFaceNormal * dot(vFaceNormal, vWindForce);
-			vWindAcceleration = vWindAcceleration / (v0->mass + v1->mass + v2->mass);
+	while (stackSize > 0) {
+		const BVHNode &node = nodes[stack[--stackSize]];
 
-			v0->acceleration = v0->acceleration + vWindAcceleration;
-			v1->acceleration = v1->acceleration + vWindAcceleration;
-			v2->acceleration = v2->acceleration + vWindAcceleration;
+		// Slab test against node bounds
+		vec3 t0 = (node.bounds.min - ray.origin);
+		vec3 t1 = (node.bounds.max - ray.origin);
+		t0 = vec3{ t0.x * invDir.x, t0.y * invDir.y, t0.z * invDir.z };
+		t1 = vec3{ t1.x * invDir.x, t1.y * invDir.y, t1.z * invDir.z };
+		vec3 tNear = componentMin(t0, t1);
+		vec3 tFar = componentMax(t0, t1);
+		GLfloat tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		GLfloat tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, hit.t));
+
+		if (tEnter > tExit) {
+			continue;
+		}
+
+		if (node.left >= 0) {
+			stack[stackSize++] = node.right;
+			stack[stackSize++] = node.left;
+			continue;
+		}
+
+		// Moller-Trumbore intersection against leaf triangles
+		for (int i = node.first; i < node.first + node.count; i++) {
+			const Triangle &tri = (*triangles)[triangleIndices[i]];
+			vec3 edge1 = tri.v1->position - tri.v0->position;
+			vec3 edge2 = tri.v2->position - tri.v0->position;
+			vec3 pVec = cross(ray.direction, edge2);
+			GLfloat det = dot(edge1, pVec);
+
+			if (fabs(det) < 1e-12f) {
+				continue;
+			}
+
+			GLfloat invDet = 1.0f / det;
+			vec3 tVec = ray.origin - tri.v0->position;
+			GLfloat u = dot(tVec, pVec) * invDet;
+
+			if (u < 0.0f || u > 1.0f) {
+				continue;
+			}
+
+			vec3 qVec = cross(tVec, edge1);
+			GLfloat v = dot(ray.direction, qVec) * invDet;
+
+			if (v < 0.0f || u + v > 1.0f) {
+				continue;
+			}
+
+			GLfloat t = dot(edge2, qVec) * invDet;
+
+			if (t > 0.0f && t < hit.t) {
+				hit = RayHit{ triangleIndices[i], t, u, v };
+			}
 		}
 	}
 
-	// Applying gravity and spring forces
-	GLfloat deltaDistance;
-	GLfloat currentDistMagnitude;
-	vec3 vCurrentDistance;
-	vec3 vSpringAcceleration;
-	vec3 vConstraints;
+	return hit;
+}
 
-	Particle *p0;
-	Particle *p1;
-	Spring *spring;
+void TriangleBVH::intersectRays(const std::vector<Ray> &rays, std::vector<RayHit> &hits) {
+	hits.resize(rays.size());
 
-	for (int i = 0; i < springs.size(); i++) {
-		for (int j = 0; j < springs.at(i).size(); j++) {
-			spring = &springs.at(i).at(j);
-			p0 = spring->p0;
-			p1 = spring->p1;
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < (int)rays.size(); i++) {
+		hits[i] = intersectRay(rays[i]);
+	}
+}
 
-			vCurrentDistance = p0->position - p1->position;
-			currentDistMagnitude = magnitude(vCurrentDistance);
-			deltaDistance = currentDistMagnitude - spring->restLength;
+// Appends indices of all triangles whose bounds overlap the given box
+void TriangleBVH::queryAABB(const AABB &box, std::vector<int> &results) {
+	if (nodes.empty()) {
+		return;
+	}
 
-			vSpringAcceleration = (vCurrentDistance / currentDistMagnitude) * (springConstK * deltaDistance);
-			vSpringAcceleration = vSpringAcceleration / p0->mass;
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const BVHNode &node = nodes[stack[--stackSize]];
+
+		if (!overlaps(node.bounds, box)) {
+			continue;
+		}
+
+		if (node.left >= 0) {
+			stack[stackSize++] = node.right;
+			stack[stackSize++] = node.left;
+			continue;
+		}
 
-			p0->acceleration = (gravity / p0->mass) - vSpringAcceleration + p0->acceleration;
-			p1->acceleration = (gravity / p1->mass) + vSpringAcceleration + p1->acceleration;
+		for (int i = node.first; i < node.first + node.count; i++) {
+			if (overlaps(triangleBounds(triangleIndices[i]), box)) {
+				results.push_back(triangleIndices[i]);
+			}
 		}
 	}
 }
 
-////////////////
-// class: Wind
-/////////////
+void TriangleBVH::queryAABBs(const std::vector<AABB> &boxes, std::vector< std::vector<int>> &results) {
+	results.resize(boxes.size());
 
-Wind::Wind(vec3 &windForce) {
-	timeBlowing = 0;
-	this->windForce = windForce;
-	enabled = true;
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < (int)boxes.size(); i++) {
+		results[i].clear();
+		queryAABB(boxes[i], results[i]);
+	}
 }
 
-vec3 Wind::generateWindForce(long deltaT) {
-	timeBlowing += deltaT;
+AABB TriangleBVH::getBounds() {
+	return nodes.empty() ? emptyAABB() : nodes.front().bounds;
+}
 
-	// Switching wind direction every 1.2 seconds;
-	if (timeBlowing > 1200) {
-		timeBlowing = 0;
-		windForce = windForce * -1.0f;
+bool TriangleBVH::isEmpty() {
+	return nodes.empty();
+}
+
+AABB TriangleBVH::triangleBounds(int triangle) {
+	const Triangle &tri = (*triangles)[triangle];
+	vec3 vMargin = vec3{ margin, margin, margin };
+
+	vec3 lower = componentMin(componentMin(tri.v0->position, tri.v1->position), tri.v2->position);
+	vec3 upper = componentMax(componentMax(tri.v0->position, tri.v1->position), tri.v2->position);
+
+	if (swept) {
+		lower = componentMin(lower, componentMin(componentMin(tri.v0->prevPosition, tri.v1->prevPosition), tri.v2->prevPosition));
+		upper = componentMax(upper, componentMax(componentMax(tri.v0->prevPosition, tri.v1->prevPosition), tri.v2->prevPosition));
 	}
 
-    // Returning wind if enabled, 0 vector otherwise
-	return (enabled) ? windForce : vec3{ 0.0f, 0.0f, 0.0f };
+	return AABB{ lower - vMargin, upper + vMargin };
 }
 
-void Wind::toggleWind() {
-	enabled = !enabled;
+GLfloat TriangleBVH::totalSurfaceArea() {
+	GLfloat area = 0.0f;
+
+	for (int i = 0; i < nodes.size(); i++) {
+		area += surfaceArea(nodes.at(i).bounds);
+	}
+
+	return area;
 }
 
 //////////////////////
@@ -1195,3 +8767,281 @@ vec4 operator+(const vec4 &u, const vec4 &v) {
 	return vec4{ u.x + v.x, u.y + v.y, u.z + v.z, u.w + v.w };
 }
 
+vec3 componentMin(const vec3 &u, const vec3 &v) {
+	return vec3{ std::min(u.x, v.x), std::min(u.y, v.y), std::min(u.z, v.z) };
+}
+
+vec3 componentMax(const vec3 &u, const vec3 &v) {
+	return vec3{ std::max(u.x, v.x), std::max(u.y, v.y), std::max(u.z, v.z) };
+}
+
+AABB emptyAABB() {
+	return AABB{ vec3{ 1e30f, 1e30f, 1e30f }, vec3{ -1e30f, -1e30f, -1e30f } };
+}
+
+AABB merge(const AABB &a, const AABB &b) {
+	return AABB{ componentMin(a.min, b.min), componentMax(a.max, b.max) };
+}
+
+AABB expand(const AABB &box, const vec3 &point) {
+	return AABB{ componentMin(box.min, point), componentMax(box.max, point) };
+}
+
+bool overlaps(const AABB &a, const AABB &b) {
+	return a.min.x <= b.max.x && a.max.x >= b.min.x
+		&& a.min.y <= b.max.y && a.max.y >= b.min.y
+		&& a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+GLfloat surfaceArea(const AABB &box) {
+	vec3 extent = box.max - box.min;
+	return 2.0f * ((extent.x * extent.y) + (extent.y * extent.z) + (extent.z * extent.x));
+}
+
+// Closest point on triangle abc to a point, also returning its barycentric weights for a, b and c
+vec3 closestPointOnTriangle(const vec3 &point, const vec3 &a, const vec3 &b, const vec3 &c, vec3 &barycentric) {
+	vec3 ab = b - a;
+	vec3 ac = c - a;
+	vec3 ap = point - a;
+
+	// Checking vertex and edge regions before falling back to the face
+	GLfloat d1 = dot(ab, ap);
+	GLfloat d2 = dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		barycentric = vec3{ 1.0f, 0.0f, 0.0f };
+		return a;
+	}
+
+	vec3 bp = point - b;
+	GLfloat d3 = dot(ab, bp);
+	GLfloat d4 = dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) {
+		barycentric = vec3{ 0.0f, 1.0f, 0.0f };
+		return b;
+	}
+
+	GLfloat vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		GLfloat v = d1 / (d1 - d3);
+		barycentric = vec3{ 1.0f - v, v, 0.0f };
+		return a + ab * v;
+	}
+
+	vec3 cp = point - c;
+	GLfloat d5 = dot(ab, cp);
+	GLfloat d6 = dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) {
+		barycentric = vec3{ 0.0f, 0.0f, 1.0f };
+		return c;
+	}
+
+	GLfloat vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		GLfloat w = d2 / (d2 - d6);
+		barycentric = vec3{ 1.0f - w, 0.0f, w };
+		return a + ac * w;
+	}
+
+	GLfloat va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		GLfloat w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		barycentric = vec3{ 0.0f, 1.0f - w, w };
+		return b + (c - b) * w;
+	}
+
+	GLfloat denom = 1.0f / (va + vb + vc);
+	GLfloat v = vb * denom;
+	GLfloat w = vc * denom;
+	barycentric = vec3{ 1.0f - v - w, v, w };
+
+	return a + ab * v + ac * w;
+}
+
+// Shortest distance between segments p0p1 and q0q1
+GLfloat segmentDistance(const vec3 &p0, const vec3 &p1, const vec3 &q0, const vec3 &q1) {
+	vec3 onP;
+	vec3 onQ;
+
+	return closestPointsOnSegments(p0, p1, q0, q1, onP, onQ);
+}
+
+// Closest points between segments p0p1 and q0q1, returning the distance between them
+GLfloat closestPointsOnSegments(const vec3 &p0, const vec3 &p1, const vec3 &q0, const vec3 &q1, vec3 &onP, vec3 &onQ) {
+	vec3 d1 = p1 - p0;
+	vec3 d2 = q1 - q0;
+	vec3 r = p0 - q0;
+	GLfloat a = dot(d1, d1);
+	GLfloat e = dot(d2, d2);
+	GLfloat f = dot(d2, r);
+	GLfloat s = 0.0f;
+	GLfloat t = 0.0f;
+
+	if (a <= 1e-12f && e <= 1e-12f) {
+		onP = p0;
+		onQ = q0;
+		return magnitude(r);
+	}
+
+	if (a <= 1e-12f) {
+		t = std::min(std::max(f / e, 0.0f), 1.0f);
+	} else {
+		GLfloat c = dot(d1, r);
+
+		if (e <= 1e-12f) {
+			s = std::min(std::max(-c / a, 0.0f), 1.0f);
+		} else {
+			GLfloat b = dot(d1, d2);
+			GLfloat denom = a * e - b * b;
+
+			// Note: Parallel segments take any s, the clamps below fix up t
+			s = (denom > 1e-12f) ? std::min(std::max((b * f - c * e) / denom, 0.0f), 1.0f) : 0.0f;
+			t = (b * s + f) / e;
+
+			if (t < 0.0f) {
+				t = 0.0f;
+				s = std::min(std::max(-c / a, 0.0f), 1.0f);
+			} else if (t > 1.0f) {
+				t = 1.0f;
+				s = std::min(std::max((b - c) / a, 0.0f), 1.0f);
+			}
+		}
+	}
+
+	onP = p0 + d1 * s;
+	onQ = q0 + d2 * t;
+
+	return magnitude(onP - onQ);
+}
+
+vec3 closestPointOnSegment(const vec3 &point, const vec3 &p0, const vec3 &p1) {
+	vec3 d = p1 - p0;
+	GLfloat lengthSq = dot(d, d);
+
+	if (lengthSq <= 1e-12f) {
+		return p0;
+	}
+
+	return p0 + d * std::min(std::max(dot(point - p0, d) / lengthSq, 0.0f), 1.0f);
+}
+
+// Closest points between segment p0p1 and triangle abc, returning the distance between them
+GLfloat closestPointsSegmentTriangle(const vec3 &p0, const vec3 &p1, const vec3 &a, const vec3 &b, const vec3 &c,
+		vec3 &onSegment, vec3 &onTriangle, vec3 &barycentric) {
+	// Checking whether the segment passes through the triangle first
+	vec3 normal = cross(b - a, c - a);
+	GLfloat d0 = dot(p0 - a, normal);
+	GLfloat d1 = dot(p1 - a, normal);
+
+	if (d0 * d1 < 0.0f) {
+		vec3 crossing = p0 + (p1 - p0) * (d0 / (d0 - d1));
+		vec3 projected = closestPointOnTriangle(crossing, a, b, c, barycentric);
+
+		if (magnitude(projected - crossing) < 1e-6f) {
+			onSegment = crossing;
+			onTriangle = projected;
+			return 0.0f;
+		}
+	}
+
+	// Otherwise the closest pair involves a segment endpoint or a triangle edge
+	vec3 candidates[5];
+	vec3 onEdge;
+	closestPointsOnSegments(p0, p1, a, b, candidates[2], onEdge);
+	closestPointsOnSegments(p0, p1, b, c, candidates[3], onEdge);
+	closestPointsOnSegments(p0, p1, c, a, candidates[4], onEdge);
+	candidates[0] = p0;
+	candidates[1] = p1;
+
+	GLfloat best = 1e30f;
+
+	for (int i = 0; i < 5; i++) {
+		vec3 candidateBarycentric;
+		vec3 point = closestPointOnTriangle(candidates[i], a, b, c, candidateBarycentric);
+		GLfloat distance = magnitude(candidates[i] - point);
+
+		if (distance < best) {
+			best = distance;
+			onSegment = candidates[i];
+			onTriangle = point;
+			barycentric = candidateBarycentric;
+		}
+	}
+
+	return best;
+}
+
+// Finds the roots of a*t^3 + b*t^2 + c*t + d in [0, 1] in ascending order, returning how many were found
+int solveCubicInUnitInterval(double a, double b, double c, double d, double roots[3]) {
+	double bounds[4];
+	int boundCount = 0;
+	int rootCount = 0;
+
+	// Splitting [0, 1] at the critical points so the cubic is monotonic on each piece
+	bounds[boundCount++] = 0.0;
+
+	double qa = 3.0 * a;
+	double qb = 2.0 * b;
+	double critical[2];
+	int criticalCount = 0;
+
+	if (fabs(qa) > 1e-15) {
+		double discriminant = qb * qb - 4.0 * qa * c;
+
+		if (discriminant > 0.0) {
+			double root = sqrt(discriminant);
+			critical[criticalCount++] = (-qb - root) / (2.0 * qa);
+			critical[criticalCount++] = (-qb + root) / (2.0 * qa);
+
+			if (critical[0] > critical[1]) {
+				std::swap(critical[0], critical[1]);
+			}
+		}
+	} else if (fabs(qb) > 1e-15) {
+		critical[criticalCount++] = -c / qb;
+	}
+
+	for (int i = 0; i < criticalCount; i++) {
+		if (critical[i] > 0.0 && critical[i] < 1.0) {
+			bounds[boundCount++] = critical[i];
+		}
+	}
+
+	bounds[boundCount++] = 1.0;
+
+	// Bisecting every piece whose ends change sign
+	for (int i = 0; i < boundCount - 1; i++) {
+		double lo = bounds[i];
+		double hi = bounds[i + 1];
+		double fLo = ((a * lo + b) * lo + c) * lo + d;
+		double fHi = ((a * hi + b) * hi + c) * hi + d;
+
+		if (fLo == 0.0) {
+			if (rootCount == 0 || roots[rootCount - 1] != lo) {
+				roots[rootCount++] = lo;
+			}
+			continue;
+		}
+
+		if (fLo * fHi > 0.0) {
+			continue;
+		}
+
+		for (int iteration = 0; iteration < 40; iteration++) {
+			double mid = 0.5 * (lo + hi);
+			double fMid = ((a * mid + b) * mid + c) * mid + d;
+
+			if (fLo * fMid <= 0.0) {
+				hi = mid;
+			} else {
+				lo = mid;
+				fLo = fMid;
+			}
+		}
+
+		if (rootCount < 3) {
+			roots[rootCount++] = 0.5 * (lo + hi);
+		}
+	}
+
+	return rootCount;
+}